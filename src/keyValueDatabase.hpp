@@ -6,10 +6,13 @@
  * Key-value-database-for-Arduino may be used as a simple database with the following functions (see examples in BasicUsage.ino).
  * The functions are thread-safe:
  *
- *    - Insert (key, value)                                   - inserts a new key-value pair
+ *    - Insert (key, value, optional time-to-live)             - inserts a new key-value pair (time-to-live in seconds is only available if __KEY_VALUE_DATABASE_TTL__ is #defined)
  *
  *    - FindBlockOffset (key)                                 - searches (memory) Map for key
  *    - FindValue (key, optional block offset)                - searches (memory) Map for blockOffset connected to key and then it reads the value from (disk) data file (it works slightly faster if block offset is already known, such as during iterations)
+ *    - WithValue (key, callback function, optional block offset) - same as FindValue, but instead of copying the value it passes a pointer to it (in internal read buffer) to callback function
+ *      (String keys can be passed to FindBlockOffset, FindValue, WithValue and [] operator as characters, like FindValue ("SSID", &value), so that no temporary String is needed)
+ *    - FindLowerBound, FindUpperBound, FindFloor, FindCeiling (key, found key, optional value, optional block offset) - finds the neighbouring key of the key and reads its value
  *
  *    - Update (key, new value, optional block offset)        - updates the value associated by the key (it works slightly faster if block offset is already known, such as during iterations)
  *    - Update (key, callback function, optional blockoffset) - if the calculation is made with existing value then this is prefered method, since calculation is performed while database is being loceks
@@ -19,8 +22,29 @@
  *
  *    - Delete (key)                                          - deletes key-value pair identified by the key
  *    - Truncate                                              - deletes all key-value pairs
+ *    - Verify (data file name, optional repair, optional number of bad blocks) - checks the blocks of a data file that is not opened (and marks the bad ones as free)
+ *    - SlackStatistics (statistics)                          - how many updates fit into their blocks and how many needed a new one, how much of the used blocks is slack
+ *    - SpaceReport (report)                                  - how the data file is used: live bytes, slack, free blocks (with a histogram of their sizes), the largest free block and how fast the data file grows
+ *    - MaintenanceStep (max blocks, optional compact, optional pass completed) - merges the neighbouring free blocks (and moves the used blocks into the free space
+ *                                                              before them if compact) of at most max blocks, so the database is locked only for a short time
+ *    - SetMaintenancePolicy (policy)                         - lets Delete, Update and Commit run MaintenanceStep by themselves when the data file gets too large for its data
+ *    - Stats                                                 - counters of lookups, inserts, updates, deletes, disk reads and writes, free blocks and locking since Open, if __KEY_VALUE_DATABASE_STATISTICS__ is #defined
+ *    - LatencyHistogram (operation), LatencyReport (buffer, size, optional json) - how long FindValue, Insert, Update, Delete and waiting for the lock take,
+ *                                                              if __KEY_VALUE_DATABASE_LATENCY_HISTOGRAMS__ is #defined
+ *    - SetTraceCallback (callback function)                  - calls the callback function after each of these operations, if __KEY_VALUE_DATABASE_TRACE__ is #defined
+ *
+ *    - Begin, Commit, Rollback                               - Insert, Update and Delete between Begin and Commit are only staged in memory and then written all at once,
+ *                                                              so that either all or none of them survive a reset
+ *
+ *    - SetTTL (key, time-to-live)                            - sets (or clears with 0) the time-to-live of the key, if __KEY_VALUE_DATABASE_TTL__ is #defined
+ *    - ExpireStep (max keys, optional number of expired keys) - deletes at most max keys of the expired keys, so the database is locked only for a short time
  *
  *    - Iterate                                               - iterate (list) through all the keys and their blockOffsets with an Iterator
+ *      (or only through a range of them, starting with an iterator returned by lower_bound, upper_bound, floor or ceiling (key))
+ *    - select (i), rank (key), count (from, to)              - order statistics in O (log n) for pagination, if __MAP_ORDER_STATISTICS__ is #defined
+ *
+ *    - AddIndex (secondary index)                            - adds (before Open) a secondary index on a field of the values, its Find (index key, callback) and FindRange (from, to, callback)
+ *                                                              find key-value pairs by that field
  *
  *    - Lock                                                  - locks (takes the semaphore) to (temporary) prevent other taska accessing keyValueDatabase
  *    - Unlock                                                - frees the lock
@@ -34,16 +58,66 @@
  *    - semaphore to synchronize (possible) multi-tasking accesses to keyValueDatabase
  *
  *    (disk) data file structure:
- *       - data file consists consecutive of blocks
+ *       - data file starts with a 16 byte header: magic number "KVDB", format version, header size, flags of the #defines that change the data file format
+ *         (__KEY_VALUE_DATABASE_TTL__, __KEY_VALUE_DATABASE_CHECKSUM__, __KEY_VALUE_DATABASE_SEGMENT_SIZE__ and __KEY_VALUE_DATABASE_COMPRESSION__) and a fingerprint
+ *         of how keys and values are stored (0 terminated characters or their fixed sizes and the compression dictionary). Open returns err_data_changed if they don't match the ones the database has been compiled with.
+ *         A data file without the header, written by the versions before, is upgraded by Open: it is copied behind a new header into dataFileName.upg,
+ *         which then replaces it. The versions before had none of these #defines, so if any of them is #defined Open returns err_data_changed instead
+ *         and leaves the data file as it is.
+ *       - then the data file consists consecutive of blocks (segment files, if there are more of them, don't have the header)
  *       - Each block starts with int16_t number which denotes the size of the block (in bytes). If the number is positive the block is considered to be used
  *         with useful data, if the number is negative the block is considered to be deleted (free). Positive int16_t numbers can vary from 0 to 32768, so
  *         32768 is the maximum size of a single data block.
  *       - after the block size number, a key and its value are stored in the block (only if the block is beeing used).
+ *       - blocks with String values get some slack (free space at their end) so that the values can grow a little without moving to a new block. It starts
+ *         with __KEY_VALUE_DATABASE_PCT_FREE__ of the value size and then follows how much the String values grow when they are updated (keys never change
+ *         so they don't get any). A value that outgrows its block gets a new one at least 1.5 times as large, so the values that keep growing move less and less often.
+ *       - a new block only takes the part of a free block it needs, the rest (if it is at least __KEY_VALUE_DATABASE_MIN_SPLIT_SIZE__ bytes) stays free.
+ *         MaintenanceStep merges the neighbouring free blocks into larger ones and, when compacting, moves the used blocks into the free space before them, so that
+ *         the free space gathers towards the end of the data file (the file itself doesn't get shorter, but the new blocks fill the free space before it grows again).
+ *       - if __KEY_VALUE_DATABASE_TTL__ is #defined there is an uint32_t expiry time (time (NULL) seconds, 0 = never) between the block size and the key.
+ *         Expired keys are not found by FindValue, WithValue and Update any more (and can be inserted again), but they are only deleted by ExpireStep,
+ *         which takes them from (memory) expiry heap in expiry time order. Until then they are still visible to iterators, FindBlockOffset, neighbouring key and
+ *         secondary index queries.
+ *       - if __KEY_VALUE_DATABASE_CHECKSUM__ is #defined the last field before the key is an uint32_t CRC32C checksum of the block size (as if the block was used),
+ *         expiry time, key and value. A block with a wrong checksum is reported as err_data_changed when it is read (by Open as well), Verify finds such blocks
+ *         and the next good block after them, even if the block size itself has been corrupted.
+ *       - if __KEY_VALUE_DATABASE_COMPRESSION__ is #defined String values of at least __KEY_VALUE_DATABASE_COMPRESSION_MIN_SIZE__ characters are stored compressed
+ *         (with LZ77 like matches, up to 18 bytes long and 4 KB back, optionally into a static dictionary) if that makes them shorter: byte 0xFF (which never
+ *         appears in UTF-8 text) followed by uint16_t compressed size, uint16_t length and the compressed data. Other String values are stored as before.
  *
  *    (memory) Map structure:
  *       - the key is the same key as used for keyValueDatabase
+ *       - with many String keys consider using inlineString<> keys instead (see std/inlineString.hpp), they are stored on disk the same way as String keys but
+ *         short ones (up to 23 characters by default) are kept inside the Map nodes, which saves a heap allocation per key and makes searching faster
+ *       - if the keys share long prefixes (like URLs or paths) consider using prefixString<> keys (see std/prefixString.hpp), everything up to the last '/'
+ *         is kept only once in a shared prefix table and the Map nodes only keep a pointer to it and the rest of the key
  *       - the value is an offset to data file block containing the data, keyValueDatabase' value will be fetched from there. Data file offset is
  *         stored in uint32_t so maximum data file offest can theoretically be 4294967296, but ESP32 files can't be that large.
+ *       - if __KEY_VALUE_DATABASE_SEGMENT_SIZE__ is #defined the data is split into more segment files (dataFileName, dataFileName.1, dataFileName.2, ...)
+ *         and the value is a 64 bit (segment, offset) address instead: segment number in the upper 32 bits and the offset within the segment file
+ *         in the lower 32 bits. A new segment file is started when appending a block would make the last one larger than __KEY_VALUE_DATABASE_SEGMENT_SIZE__.
+ *       - if __KEY_VALUE_DATABASE_KEYS_ON_DISK__ is #defined the keys are not kept in memory at all, there is an array of (32 bit key fingerprint, block offset)
+ *         entries, sorted by fingerprint, instead of Map. It takes 8 bytes per key (with 32 bit block offsets) regardless of the key size, but each key has to be
+ *         verified by reading its block, so FindBlockOffset needs a disk read and Insert needs one if another key has the same fingerprint. Keys are not kept
+ *         in order then: iteration goes in fingerprint order, reading each key from disk, and there are no first_element, last_element and neighbouring key queries. Fixed size keys
+ *         are fingerprinted by their bytes so they shouldn't have padding bytes.
+ *
+ *    (memory) Bloom filter:
+ *       - if __KEY_VALUE_DATABASE_BLOOM_FILTER_BITS_PER_KEY__ is #defined there is also a Bloom filter of key fingerprints, built by Open and updated by Insert.
+ *         FindBlockOffset, FindValue, WithValue and Update return err_not_found for most of the missing keys without searching the index (or reading the disk
+ *         with __KEY_VALUE_DATABASE_KEYS_ON_DISK__). Deleted keys stay in the filter until it gets rebuilt, which happens when as many keys have been inserted
+ *         since it was built as there were keys then, so that inserting and deleting keys (like session tokens) doesn't fill it up.
+ *
+ *    (disk) transaction journal file (dataFileName.tx):
+ *       - Commit writes the new blocks of a transaction into free (or appended) space while they are still marked as free, then it writes the journal:
+ *         the list of (block offset, block size) changes that make the new blocks used and the old ones free, followed by a commit record with a checksum.
+ *         Only then are the block sizes changed in the data file and the journal removed. If the controller resets in between, Open finds a complete
+ *         journal and changes the block sizes again, an incomplete journal is simply ignored, since the data file hasn't been changed yet.
+ *
+ *    (memory) secondary indexes:
+ *       - each secondary index is a Map of (index key, block offset) entries, the index key is returned by the index' extractor function from the value.
+ *         Insert, Update and Delete keep them up to date, Open rebuilds them, so the values have to be read by Open as well if there are any.
  *
  *    (memory) vector structure:
  *       - a free block list vector contains structures with:
@@ -61,16 +135,43 @@
 
     // ----- TUNNING PARAMETERS -----
 
-    #define __KEY_VALUE_DATABASE_PCT_FREE__ 0.2 // how much space is left free in data block to let data "breed" a little - only makes sense for String values 
+    #define __KEY_VALUE_DATABASE_PCT_FREE__ 0.2 // how much space is left free in data block to let data "breed" a little - only makes sense for String values, it is only the initial value, which then adapts to how much the values grow when they are updated
+
+    #define __KEY_VALUE_DATABASE_MIN_SPLIT_SIZE__ 32 // a new block only takes a part of a larger free block if at least this many bytes are left over, smaller leftovers stay in the new block as its slack
 
     // #define __USE_KEY_VALUE_DATABASE_EXCEPTIONS__   // uncomment this line if you want Map to throw exceptions
 
+    // #define __KEY_VALUE_DATABASE_SEGMENT_SIZE__ 0x40000000 // uncomment this line if the data doesn't fit into a single file (SD cards for example), a new segment file is started when the last one would grow beyond this size
+
+    // #define __KEY_VALUE_DATABASE_KEYS_ON_DISK__  // uncomment this line if the keys don't fit into memory, only 8 byte key fingerprints are kept there then and the keys are verified by reading them from disk
+
+    // #define __KEY_VALUE_DATABASE_TTL__ // uncomment this line if the keys should be able to expire, the expiry time is kept in each block then (the data file format changes) and time (NULL) has to be set (by NTP for example)
+
+    // #define __KEY_VALUE_DATABASE_CHECKSUM__ // uncomment this line to keep a CRC32C checksum in each block (the data file format changes), so that corrupted blocks are detected when they are read and Verify can skip (and repair) them
+
+    // #define __KEY_VALUE_DATABASE_COMPRESSION__ // uncomment this line to compress String values (like JSON) before they are written, which saves flash space and writes (the data file format changes)
+    #define __KEY_VALUE_DATABASE_COMPRESSION_MIN_SIZE__ 24 // shorter String values are not compressed, they would hardly get any shorter (unless they can use the dictionary)
+    // #define __KEY_VALUE_DATABASE_COMPRESSION_DICTIONARY__ "{\"id\":,\"name\":\"\",\"value\":true,false,null}" // uncomment this line to let the compression refer to the text that the values often contain, which helps short values most (changing it makes the data file unreadable)
+
+    // #define __KEY_VALUE_DATABASE_STATISTICS__ // uncomment this line to count what the database does (see Stats), which shows the databases that wear the flash most, it takes a few more instructions per call and uses micros () to time the lock
+
+    // #define __KEY_VALUE_DATABASE_LATENCY_HISTOGRAMS__ // uncomment this line to keep histograms of how long FindValue, Insert, Update, Delete and waiting for the lock take (see LatencyHistogram and LatencyReport), they take a fixed amount of memory
+    #define __KEY_VALUE_DATABASE_LATENCY_BUCKETS__ 24 // bucket i counts the latencies from 2^i to 2^(i+1) microseconds, the last one also all the longer ones (24 buckets reach 8 s)
+    // #define __KEY_VALUE_DATABASE_TRACE__ // uncomment this line to be able to set a callback function that is called after each FindValue, Insert, Update, Delete and wait for the lock (see SetTraceCallback)
+
+    // #define __KEY_VALUE_DATABASE_BLOOM_FILTER_BITS_PER_KEY__ 10 // uncomment this line if many of the keys searched for do not exist, a Bloom filter of this many bits per key answers most of such searches without searching the index (10 bits per key give about 1 % false positives)
+
 
 
     // ----- CODE -----
     
     #include "std/Map.hpp"
+    #include "std/inlineString.hpp"
+    #include "std/prefixString.hpp"
     #include "std/vector.hpp"
+    #ifdef __KEY_VALUE_DATABASE_LATENCY_HISTOGRAMS__
+        #include <stdarg.h> // LatencyReport
+    #endif
 
     // error flags - only tose not defined in Map.hpp, please, note that all error flgs are negative (char) numbers
     #define err_data_changed    ((signed char) 0b10010000) // -112 - unexpected data value found
@@ -84,11 +185,18 @@
     // #define err_bad_alloc       ((signed char) 0b10000001)  // -127 - out of memory
 
 
+    #ifdef __KEY_VALUE_DATABASE_SEGMENT_SIZE__
+        typedef uint64_t blockOffsetType; // (segment, offset) address: segment number in the upper 32 bits, offset within the segment file in the lower 32 bits
+    #else
+        typedef uint32_t blockOffsetType; // offset within the (only) data file
+    #endif
+
+
     #ifdef SEMAPHORE_H // RTOS is running beneath Arduino sketch, multitasking (and semaphores) is supported
         static SemaphoreHandle_t __keyValueDatabaseSemaphore__ = xSemaphoreCreateMutex (); 
     #endif
 
-    template <class keyType, class valueType> class keyValueDatabase : private Map<keyType, uint32_t> {
+    template <class keyType, class valueType> class keyValueDatabase : private Map<keyType, blockOffsetType> {
         
         friend class Proxy;
   
@@ -96,6 +204,20 @@
 
             signed char __errorFlags__ = 0;
 
+            // String keys (String, inlineString or prefixString) are stored as 0 terminated characters, all the other keys as they are (fixed size)
+            template<typename T, typename U = void> struct is_string { static const bool value = false; };
+            template<typename U> struct is_string<String, U> { static const bool value = true; };
+            template<size_t N, typename U> struct is_string<inlineString<N>, U> { static const bool value = true; };
+            template<size_t N, typename U> struct is_string<prefixString<N>, U> { static const bool value = true; };
+
+            // the functions that take the keys as characters only exist for String keys: __charKeysOnly__<K>::type is only defined if K is a String key
+            template<bool B, typename T> struct __enableIf__ {};
+            template<typename T> struct __enableIf__<true, T> { typedef T type; };
+            template<typename K, typename T> struct __charKeysOnly__ : __enableIf__<is_string<K>::value, T> {};
+
+            // selects the code for String keys (__boolTag__<true>) or the other keys (__boolTag__<false>), when both have to compile
+            template <bool B> struct __boolTag__ {};
+
 
         public:
 
@@ -104,6 +226,16 @@
 
             ~keyValueDatabase () { 
                 Close ();
+                if (__readBuffer__) free (__readBuffer__);
+                #ifdef __KEY_VALUE_DATABASE_KEYS_ON_DISK__
+                    if (__fingerprintIndex__) free (__fingerprintIndex__);
+                #endif
+                #ifdef __KEY_VALUE_DATABASE_BLOOM_FILTER_BITS_PER_KEY__
+                    if (__bloomFilter__) free (__bloomFilter__);
+                #endif
+                #ifdef __KEY_VALUE_DATABASE_COMPRESSION__
+                    __releaseCompressedValue__ ();
+                #endif
             } 
 
 
@@ -114,6 +246,9 @@
             
             signed char Open (const char *dataFileName) {
                 // log_i ("(dataFileName)");
+                #ifdef __KEY_VALUE_DATABASE_STATISTICS__
+                    unsigned long openStarted = millis ();
+                #endif
                 Lock ();
                 if (__dataFile__) {
                     // log_e ("data already loaded error: err_cant_do_it_now");
@@ -127,6 +262,42 @@
 
                 // load new data
                 strcpy (__dataFileName__, dataFileName);
+                __secondaryIndexesClear__ ();
+                __pctFree__ = __KEY_VALUE_DATABASE_PCT_FREE__;
+                __inPlaceUpdates__ = 0;
+                __relocations__ = 0;
+                __maintenanceOffset__ = __fileHeaderSize__;
+                __maintenanceChecks__ = 0;
+                __appendedBytes__ = 0;
+                __lastSpaceReportAppendedBytes__ = 0;
+                __openedMillis__ = __lastSpaceReportMillis__ = millis ();
+                #ifdef __KEY_VALUE_DATABASE_STATISTICS__
+                    __statistics__ = {};
+                #endif
+                #ifdef __KEY_VALUE_DATABASE_LATENCY_HISTOGRAMS__
+                    memset (__latencyHistograms__, 0, sizeof (__latencyHistograms__));
+                #endif
+                #ifdef __KEY_VALUE_DATABASE_TTL__
+                    __expiryHeap__.clear ();
+                #endif
+                __dataFileSize__ = 0;
+                #ifdef __KEY_VALUE_DATABASE_SEGMENT_SIZE__
+                    __dataFileSegment__ = 0;
+                    __lastSegment__ = 0;
+                    __lastSegmentSize__ = 0;
+                #endif
+                #ifdef __KEY_VALUE_DATABASE_KEYS_ON_DISK__
+                    __fingerprintIndexSize__ = 0; // in case the data has already been loaded and closed, the fingerprints are read again
+                #else
+                    // as long as the keys come in ascending order (if they were inserted that way, for example) they are only collected and
+                    // the Map is built from them at once, in O(n) and without any rotations
+                    bool keysAreSorted = Map<keyType, blockOffsetType>::empty ();
+                    vector<typename Map<keyType, blockOffsetType>::Pair> sortedPairs;
+                #endif
+
+                // an upgrade that was interrupted after the old data file had already been removed only needs to be completed
+                if (!fileSystem.exists (dataFileName) && fileSystem.exists (__upgradeFileName__ ()))
+                    fileSystem.rename (__upgradeFileName__ (), dataFileName);
 
                 __dataFile__ = fileSystem.open (dataFileName, "r+"); // , false);
                 if (!__dataFile__) {
@@ -157,33 +328,113 @@
                     return err_file_io;
                 }
 
-                __dataFileSize__ = __dataFile__.size ();         
-                uint64_t blockOffset = 0;
+                // finish the transaction that was being committed when the controller reset (if there was one)
+                {
+                    signed char e = __recoverJournal__ ();
+                    if (e) { // != OK
+                        // log_e ("error recovering the transaction journal");
+                        __dataFile__.close ();
+                        #ifdef __USE_KEY_VALUE_DATABASE_EXCEPTIONS__
+                            throw e;
+                        #endif
+                        __errorFlags__ |= e;
+                        Unlock (); 
+                        return e;
+                    }
+                }
+                #ifdef __KEY_VALUE_DATABASE_SEGMENT_SIZE__
+                    if (__dataFileSegment__ != 0 && !__openSegment__ (0)) { // the journal may have changed other segment files
+                        // log_e ("error opening the data file: err_file_io");
+                        #ifdef __USE_KEY_VALUE_DATABASE_EXCEPTIONS__
+                            throw err_file_io;
+                        #endif
+                        __errorFlags__ |= err_file_io;
+                        Unlock (); 
+                        return err_file_io;
+                    }
+                #endif
+
+                // check the data file header (write it to a new data file, upgrade a data file without it)
+                {
+                    signed char e = __checkFileHeader__ ();
+                    if (e) { // != OK
+                        // log_e ("data file format doesn't match or it can't be upgraded");
+                        __dataFile__.close ();
+                        #ifdef __USE_KEY_VALUE_DATABASE_EXCEPTIONS__
+                            throw e;
+                        #endif
+                        __errorFlags__ |= e;
+                        Unlock (); 
+                        return e;
+                    }
+                }
+
+                #ifdef __KEY_VALUE_DATABASE_SEGMENT_SIZE__
+                    // scan all the segment files, one after another, segment 0 is already opened
+                    while (true) {
+                        uint32_t segmentSize = __dataFile__.size ();
+                        __lastSegment__ = __dataFileSegment__;
+                        __lastSegmentSize__ = segmentSize;
+                        __dataFileSize__ += segmentSize;
+
+                        uint32_t segmentOffset = __dataFileSegment__ == 0 ? __fileHeaderSize__ : 0; // only the first segment file has the header
+                        while (segmentOffset < segmentSize) {
+                            blockOffsetType blockOffset = ((blockOffsetType) __dataFileSegment__ << 32) | segmentOffset;
+                #else
+                        __dataFileSize__ = __dataFile__.size ();         
+                        blockOffsetType blockOffset = __fileHeaderSize__;
+
+                        while (blockOffset < __dataFileSize__) {
+                #endif
 
-                while (blockOffset < __dataFileSize__ &&  blockOffset <= 0xFFFFFFFF) { // max uint32_t
                     int16_t blockSize;
                     keyType key;
                     valueType value;
 
-                    signed char e = __readBlock__ (blockSize, key, value, (uint32_t) blockOffset, true);
+                    signed char e = __readBlock__ (blockSize, key, value, blockOffset, __secondaryIndexes__ == NULL); // the values are only needed for secondary indexes
                     if (e) { // != OK
                         // log_e ("error reading the data block: err_file_io");
                         __dataFile__.close ();
                         Unlock (); 
                         return e;
                     }
-                    if (blockSize > 0) { // block containining the data -> insert into Map
-                        signed char e = Map<keyType, uint32_t>::insert (key, (uint32_t) blockOffset);
+                    if (blockSize > 0) { // block containining the data -> insert into the index
+                        #ifndef __KEY_VALUE_DATABASE_KEYS_ON_DISK__
+                            signed char e;
+                            if (keysAreSorted && (sortedPairs.size () == 0 || sortedPairs.back ().first < key) && 
+                                (sortedPairs.size () < sortedPairs.capacity () || sortedPairs.reserve (sortedPairs.capacity () + sortedPairs.capacity () / 2 + 16) == err_ok)) { // make room first, so the key doesn't get lost if this fails
+                                e = sortedPairs.push_back ( {(keyType&&) key, blockOffset} ); // doesn't fail, there is enough capacity
+                            } else {
+                                e = err_ok;
+                                if (keysAreSorted) { // build the Map from the pairs collected so far and continue inserting keys one by one
+                                    keysAreSorted = false;
+                                    e = Map<keyType, blockOffsetType>::build_from_sorted (sortedPairs.begin (), sortedPairs.end ());
+                                    sortedPairs.clear ();
+                                }
+                                if (!e)
+                                    e = Map<keyType, blockOffsetType>::insert (key, blockOffset);
+                            }
+                        #else
+                            // append the fingerprint, the index is sorted only once, when all the blocks are read
+                            uint32_t fingerprint;
+                            signed char e = __fingerprint__ (key, fingerprint) && __fingerprintIndexInsert__ (__fingerprintIndexSize__, fingerprint, blockOffset) ? err_ok : err_bad_alloc;
+                        #endif
+                        if (!e)
+                            e = __secondaryIndexesInsert__ (value, blockOffset);
+                        #ifdef __KEY_VALUE_DATABASE_TTL__
+                            if (__lastExpires__)
+                                __expiryHeapPush__ (__lastExpires__, blockOffset);
+                        #endif
                         if (e) { // != OK
                             // log_e ("keyValuePairs.insert failed failed");
                             __dataFile__.close ();
-                            __errorFlags__ |= Map<keyType, uint32_t>::errorFlags ();
+                            __errorFlags__ |= e;
                             Unlock (); 
                             return e;
                         }
                     } else { // free block -> insert into __freeBlockList__
                         blockSize = (int16_t) -blockSize;
-                        signed char e = __freeBlocksList__.push_back ( {(uint32_t) blockOffset, blockSize} );
+                        signed char e = __freeBlocksList__.push_back ( {blockOffset, blockSize} );
                         if (e) { // != OK
                             // log_e ("freeeBlockList.push_back failed failed");
                             __dataFile__.close ();
@@ -193,9 +444,56 @@
                         }
                     } 
 
-                    blockOffset += blockSize;
-                }
+                #ifdef __KEY_VALUE_DATABASE_SEGMENT_SIZE__
+                            segmentOffset += blockSize;
+                        }
+                        if (segmentOffset > segmentSize) { // the free space at the end of the last block may not be written yet, new blocks must go after it
+                            __lastSegmentSize__ = segmentOffset;
+                            __dataFileSize__ += segmentOffset - segmentSize;
+                        }
+
+                        // continue with the next segment file if it exists
+                        if (!fileSystem.exists (__segmentFileName__ (__dataFileSegment__ + 1)))
+                            break;
+                        if (!__openSegment__ (__dataFileSegment__ + 1)) {
+                            // log_e ("error opening the segment file: err_file_io");
+                            #ifdef __USE_KEY_VALUE_DATABASE_EXCEPTIONS__
+                                throw err_file_io;
+                            #endif
+                            __errorFlags__ |= err_file_io;
+                            Unlock (); 
+                            return err_file_io;
+                        }
+                    }
+                #else
+                        blockOffset += blockSize;
+                    }
+                    if (blockOffset > __dataFileSize__) // the free space at the end of the last block may not be written yet, new blocks must go after it
+                        __dataFileSize__ = blockOffset;
+                #endif
 
+                #ifdef __KEY_VALUE_DATABASE_KEYS_ON_DISK__
+                    if (__fingerprintIndexSize__ > 1)
+                        qsort (__fingerprintIndex__, __fingerprintIndexSize__, sizeof (__fingerprintIndexEntry__), __compareFingerprints__);
+                #else
+                    if (keysAreSorted && sortedPairs.size ()) {
+                        signed char e = Map<keyType, blockOffsetType>::build_from_sorted (sortedPairs.begin (), sortedPairs.end ());
+                        if (e) { // != OK
+                            // log_e ("keyValuePairs.build_from_sorted failed");
+                            __dataFile__.close ();
+                            __errorFlags__ |= e;
+                            Unlock (); 
+                            return e;
+                        }
+                    }
+                #endif
+                #ifdef __KEY_VALUE_DATABASE_BLOOM_FILTER_BITS_PER_KEY__
+                    __bloomFilterRebuild__ ();
+                #endif
+
+                #ifdef __KEY_VALUE_DATABASE_STATISTICS__
+                    __statistics__.openMillis = millis () - openStarted;
+                #endif
                 Unlock (); 
                 // log_i ("OK");
                 return err_ok;
@@ -224,24 +522,44 @@
 
 
            /*
-            * Returns the lenght of a data file.
+            * Returns the lenght of a data file (the sum of all segment files' lengths if the data is split into more segments).
             */
 
-            unsigned long dataFileSize () { return __dataFileSize__; } 
+            #ifdef __KEY_VALUE_DATABASE_SEGMENT_SIZE__
+                uint64_t dataFileSize () { return __dataFileSize__; } 
+            #else
+                unsigned long dataFileSize () { return __dataFileSize__; } 
+            #endif
 
 
            /*
             * Returns the number of key-value pairs.
             */
 
-            int size () { return Map<keyType, uint32_t>::size (); }
+            #ifndef __KEY_VALUE_DATABASE_KEYS_ON_DISK__
+                int size () { return Map<keyType, blockOffsetType>::size (); }
+            #else
+                int size () { return __fingerprintIndexSize__; }
+            #endif
 
 
            /*
-            *  Inserts a new key-value pair, returns OK or one of the error codes.
+            *  Inserts a new key-value pair, returns OK or one of the error codes. If __KEY_VALUE_DATABASE_TTL__ is #defined the key expires after ttl seconds (0 = never).
             */
 
-            signed char Insert (keyType key, valueType value) {
+            #ifdef __KEY_VALUE_DATABASE_TTL__
+                signed char Insert (const keyType& key, const valueType& value, uint32_t ttl = 0) { __operationTimer__ timer (this, traceInsert); return timer.stop (__insert__ (key, value, ttl)); }
+            #else
+                signed char Insert (const keyType& key, const valueType& value) { __operationTimer__ timer (this, traceInsert); return timer.stop (__insert__ (key, value)); }
+            #endif
+
+        private:
+
+            #ifdef __KEY_VALUE_DATABASE_TTL__
+                signed char __insert__ (const keyType& key, const valueType& value, uint32_t ttl = 0) {
+            #else
+                signed char __insert__ (const keyType& key, const valueType& value) {
+            #endif
                 // log_i ("(key, value)");
                 if (!__dataFile__) { 
                     // log_e ("error, data file not opened: err_file_io");
@@ -252,15 +570,14 @@
                     return err_file_io; 
                 }
 
-                if (is_same<keyType, String>::value)                                                                          // if key is of type String ... (if anyone knows hot to do this in compile-time a feedback is welcome)
-                    if (!*(String *) &key) {                                                                                   // ... check if parameter construction is valid
-                        // log_e ("String key construction error: err_bad_alloc");
-                        #ifdef __USE_KEY_VALUE_DATABASE_EXCEPTIONS__
-                            throw err_bad_alloc;
-                        #endif
-                        __errorFlags__ |= err_bad_alloc;
-                        return err_bad_alloc;
-                    }
+                if (!__isKeyValid__ (key)) {                                                                                   // check if String key parameter construction is valid
+                    // log_e ("String key construction error: err_bad_alloc");
+                    #ifdef __USE_KEY_VALUE_DATABASE_EXCEPTIONS__
+                        throw err_bad_alloc;
+                    #endif
+                    __errorFlags__ |= err_bad_alloc;
+                    return err_bad_alloc;
+                }
 
                 if (is_same<valueType, String>::value)                                                                        // if key is of type String ... (if anyone knows hot to do this in compile-time a feedback is welcome)
                     if (!*(String *) &value) {                                                                                 // ... check if parameter construction is valid
@@ -284,24 +601,33 @@
                     return err_cant_do_it_now;
                 }
 
+                if (__inTransaction__) { // only stage the insert until Commit
+                    #ifdef __KEY_VALUE_DATABASE_TTL__
+                        signed char e = __stage__ (__stageInsert__, key, &value, ttl ? __now__ () + ttl : 0);
+                    #else
+                        signed char e = __stage__ (__stageInsert__, key, &value, 0);
+                    #endif
+                    Unlock (); 
+                    return e;
+                }
+
+                #ifdef __KEY_VALUE_DATABASE_TTL__
+                    uint32_t expires = ttl ? __now__ () + ttl : 0;
+                    // an expired key can be inserted again, the old one is deleted first then
+                    {
+                        signed char e = __deleteIfExpired__ (key);
+                        if (e) { // != OK
+                            Unlock (); 
+                            return e;
+                        }
+                    }
+                #endif
+
                 // 1. get ready for writting into __dataFile__
                 // log_i ("step 1: calculate block size");
-                size_t dataSize = sizeof (int16_t); // block size information
-                size_t blockSize = dataSize;
-                if (is_same<keyType, String>::value) { // if value is of type String ... (if anyone knows hot to do this in compile-time a feedback is welcome)
-                    dataSize += (((String *) &key)->length () + 1); // add 1 for closing 0
-                    blockSize += (((String *) &key)->length () + 1) + (((String *) &key)->length () + 1) * __KEY_VALUE_DATABASE_PCT_FREE__ + 0.5; // add PCT_FREE for Strings
-                } else { // fixed size key
-                    dataSize += sizeof (keyType);
-                    blockSize += sizeof (keyType);
-                }                
-                if (is_same<valueType, String>::value) { // if value is of type String ... (if anyone knows hot to do this in compile-time a feedback is welcome)
-                    dataSize += (((String *) &value)->length () + 1); // add 1 for closing 0
-                    blockSize += (((String *) &value)->length () + 1) + (((String *) &value)->length () + 1) * __KEY_VALUE_DATABASE_PCT_FREE__ + 0.5; // add PCT_FREE for Strings
-                } else { // fixed size value
-                    dataSize += sizeof (valueType);
-                    blockSize += sizeof (valueType);
-                }
+                size_t dataSize;
+                size_t blockSize;
+                __blockSizes__ (key, value, dataSize, blockSize);
                 if (blockSize > 32768) {
                     // log_e ("block size > 32768, error: err_bad_alloc");
                     #ifdef __USE_KEY_VALUE_DATABASE_EXCEPTIONS__
@@ -317,7 +643,7 @@
                 int freeBlockIndex = -1;
                 uint32_t minWaste = 0xFFFFFFFF;
                 for (int i = 0; i < __freeBlocksList__.size (); i ++) {
-                    if (__freeBlocksList__ [i].blockSize >= dataSize && __freeBlocksList__ [i].blockSize - dataSize < minWaste) {
+                    if ((size_t) __freeBlocksList__ [i].blockSize >= dataSize && __freeBlocksList__ [i].blockSize - dataSize < minWaste) {
                         freeBlockIndex = i;
                         minWaste = __freeBlocksList__ [i].blockSize - dataSize;
                     }
@@ -325,44 +651,48 @@
 
                 // 3. reposition __dataFile__ pointer
                 // log_i ("step 3: reposition data file pointer");
-                uint32_t blockOffset;                
+                blockOffsetType blockOffset;                
                 if (freeBlockIndex == -1) { // append data to the end of __dataFile__
                     // log_i ("step 3a: appending new block at the end of data file");
-                    blockOffset = __dataFileSize__;
+                    blockOffset = __appendBlockOffset__ (blockSize);
                 } else { // writte data to free block in __dataFile__
                     // log_i ("step 3b: writing new data to exiisting free block");
-                    blockOffset = __freeBlocksList__ [freeBlockIndex].blockOffset;
-                    blockSize = __freeBlocksList__ [freeBlockIndex].blockSize;
-                }
-                if (!__dataFile__.seek (blockOffset, SeekSet)) {
-                    // log_e ("seek error err_file_io");
-                    #ifdef __USE_KEY_VALUE_DATABASE_EXCEPTIONS__
-                        throw err_file_io;
-                    #endif
-                    __errorFlags__ |= err_file_io;
-                    Unlock (); 
-                    return err_file_io;
+                    blockOffset = __freeBlocksList__ [freeBlockIndex].blockOffset; // the free block is split only when the key is known to be inserted
                 }
 
-                // 4. update (memory) Map structure 
-                // log_i ("step 4: insert (key, blockOffset) into Map");
-                signed char e = Map<keyType, uint32_t>::insert (key, blockOffset);
+                // 4. update (memory) index structure (this may read the data file, so the file pointer is positioned only in step 6)
+                // log_i ("step 4: insert (key, blockOffset) into the index");
+                signed char e = __indexInsert__ (key, blockOffset);
                 if (e) { // != OK
                     // log_e ("keyValuePairs.insert failed failed");
                     __errorFlags__ |= e;
                     Unlock (); 
                     return e;
                 }
+                e = __secondaryIndexesInsert__ (value, blockOffset);
+                if (e) { // != OK
+                    // log_e ("secondary index insert failed");
+                    if (__indexErase__ (key, blockOffset)) { // != OK
+                        // log_e ("index erase failed, can't roll-back, critical error, closing data file");
+                        __dataFile__.close (); // memory key value pairs and disk data file are synchronized any more - it is better to clost he file, this would cause all disk related operations from now on to fail
+                    }
+                    __errorFlags__ |= e;
+                    Unlock (); 
+                    return e;
+                }
+                if (freeBlockIndex != -1)
+                    blockSize = __splitFreeBlock__ (freeBlockIndex, blockSize); // the rest of a larger free block stays free
 
                 // 5. construct the block to be written
                 // log_i ("step 5: construct data block");
-                byte *block = (byte *) malloc (blockSize);
+                byte *block = (byte *) calloc (blockSize, 1); // the free space at the end of the block doesn't get any leftovers from the heap then
                 if (!block) {
                     // log_e ("malloc error, out of memory");
 
                     // 7. (try to) roll-back
                     // log_i ("step 7: try to roll-back");
-                    signed char e = Map<keyType, uint32_t>::erase (key);
+                    __secondaryIndexesErase__ (value, blockOffset);
+                    signed char e = __indexErase__ (key, blockOffset);
                     if (e) { // != OK
                         // log_e ("keyValuePairs.erase failed failed, can't roll-back, critical error, closing data file");
                         __dataFile__.close (); // memory key value pairs and disk data file are synchronized any more - it is better to clost he file, this would cause all disk related operations from now on to fail
@@ -380,33 +710,43 @@
                     return err_bad_alloc;
                 }
 
-                int16_t i = 0;
-                int16_t bs = (int16_t) blockSize;
-                memcpy (block + i, &bs, sizeof (bs)); i += sizeof (bs);
-                if (is_same<keyType, String>::value) { // if value is of type String ... (if anyone knows hot to do this in compile-time a feedback is welcome)
-                    size_t l = ((String *) &key)->length () + 1; // add 1 for closing 0
-                    memcpy (block + i, ((String *) &key)->c_str (), l); i += l;
-                } else { // fixed size key
-                    memcpy (block + i, &key, sizeof (key)); i += sizeof (key);
-                }       
-                if (is_same<valueType, String>::value) { // if value is of type String ... (if anyone knows hot to do this in compile-time a feedback is welcome)
-                    size_t l = ((String *) &value)->length () + 1; // add 1 for closing 0
-                    memcpy (block + i, ((String *) &value)->c_str (), l); i += l;
-                } else { // fixed size value
-                    memcpy (block + i, &value, sizeof (value)); i += sizeof (value);
-                }
+                __buildBlock__ (block, (int16_t) blockSize, key, value);
+                #ifdef __KEY_VALUE_DATABASE_TTL__
+                    memcpy (block + sizeof (int16_t), &expires, sizeof (expires));
+                #endif
+                #ifdef __KEY_VALUE_DATABASE_CHECKSUM__
+                    __setBlockChecksum__ (block, dataSize);
+                #endif
 
                 // 6. write block to __dataFile__
                 // log_i ("step 6: write block to data file");
-                if (__dataFile__.write (block, blockSize) != blockSize) {
+                if (!__seek__ (blockOffset)) {
+                    // log_e ("seek error err_file_io");
+                    free (block);
+
+                    // 7. (try to) roll-back
+                    // log_i ("step 7: try to roll-back");
+                    __secondaryIndexesErase__ (value, blockOffset);
+                    if (__indexErase__ (key, blockOffset)) { // != OK
+                        // log_e ("index erase failed, can't roll-back, critical error, closing data file");
+                        __dataFile__.close (); // memory key value pairs and disk data file are synchronized any more - it is better to clost he file, this would cause all disk related operations from now on to fail
+                    }
+                    #ifdef __USE_KEY_VALUE_DATABASE_EXCEPTIONS__
+                        throw err_file_io;
+                    #endif
+                    __errorFlags__ |= err_file_io;
+                    Unlock (); 
+                    return err_file_io;
+                }
+                if (__write__ (block, blockSize) != blockSize) {
                     // log_e ("write failed");
                     free (block);
 
                     // 9. (try to) roll-back
                     // log_i ("step 9: try to roll-back");
-                    if (__dataFile__.seek (blockOffset, SeekSet)) {
+                    if (__seek__ (blockOffset)) {
                         blockSize = (int16_t) -blockSize;
-                        if (__dataFile__.write ((byte *) &blockSize, sizeof (blockSize)) != sizeof (blockSize)) { // can't roll-back
+                        if (__write__ ((byte *) &blockSize, sizeof (blockSize)) != sizeof (blockSize)) { // can't roll-back
 
                             // log_e ("write error, can't roll-back, critical error, closing data file");
                             __dataFile__.close (); // memory key value pairs and disk data file are synchronized any more - it is better to clost he file, this would cause all disk related operations from now on to fail
@@ -415,13 +755,14 @@
                         // log_e ("seek error, can't roll-back, critical error, closing data file");
                         __dataFile__.close (); // memory key value pairs and disk data file are synchronized any more - it is better to clost he file, this would cause all disk related operations from now on to fail
                     }
-                    __dataFile__.flush ();
+                    __flush__ ();
 
-                    signed char e = Map<keyType, uint32_t>::erase (key);
+                    __secondaryIndexesErase__ (value, blockOffset);
+                    signed char e = __indexErase__ (key, blockOffset);
                     if (e) { // != OK
                         // log_e ("keyValuePairs.erase failed failed, can't roll-back, critical error, closing data file");
                         __dataFile__.close (); // memory key value pairs and disk data file are synchronized any more - it is better to clost he file, this would cause all disk related operations from now on to fail
-                        __errorFlags__ |= Map<keyType, uint32_t>::errorFlags ();
+                        __errorFlags__ |= e;
                         Unlock (); 
                         return e;
                     }
@@ -436,67 +777,124 @@
                 }
 
                 // write succeeded
-                __dataFile__.flush ();
+                __flush__ ();
                 free (block);
 
                 // 8. roll-out
                 // log_i ("step 8: roll_out");
                 if (freeBlockIndex == -1) { // data appended to the end of __dataFile__
-                    __dataFileSize__ += blockSize;       
+                    __blockAppended__ (blockSize);       
                 } else { // data written to free block in __dataFile__
-                    __freeBlocksList__.erase (__freeBlocksList__.begin () + freeBlockIndex); // doesn't fail
+                    __freeBlocksList__.erase_unordered (__freeBlocksList__.begin () + freeBlockIndex); // doesn't fail, the order of free blocks doesn't matter
                 }
+                #ifdef __KEY_VALUE_DATABASE_BLOOM_FILTER_BITS_PER_KEY__
+                    __bloomFilterInsert__ (key);
+                #endif
+                #ifdef __KEY_VALUE_DATABASE_TTL__
+                    if (expires)
+                        __expiryHeapPush__ (expires, blockOffset);
+                #endif
+                #ifdef __KEY_VALUE_DATABASE_STATISTICS__
+                    __statistics__.inserts ++;
+                #endif
                 
                 // log_i ("OK");
                 Unlock (); 
                 return err_ok;
             }
 
+        public:
+
 
            /*
-            *  Retrieve blockOffset from (memory) Map, so it is fast.
+            *  Retrieve blockOffset from (memory) Map, so it is fast (with __KEY_VALUE_DATABASE_KEYS_ON_DISK__ the block also has to be read from disk to verify the key).
+            *
+            *  String keys may also be given as characters, like FindBlockOffset ("SSID", blockOffset), so no temporary String needs to be constructed.
             */
 
-            signed char FindBlockOffset (keyType key, uint32_t& blockOffset) {
+            signed char FindBlockOffset (const keyType& key, blockOffsetType& blockOffset) { return __findBlockOffset__ (key, blockOffset); }
+
+            template <class K = keyType>
+            typename __charKeysOnly__<K, signed char>::type FindBlockOffset (const char *key, blockOffsetType& blockOffset) { return __findBlockOffset__ (key, blockOffset); }
+
+        private:
+
+            template <class K>
+            signed char __findBlockOffset__ (const K& key, blockOffsetType& blockOffset, bool countLookup = true) { // internal callers, like Delete, pass countLookup = false to keep Stats to what the user asked for
                 // log_i ("(key, block offset)");
-                if (is_same<keyType, String>::value)                                                                          // if key is of type String ... (if anyone knows hot to do this in compile-time a feedback is welcome)
-                    if (!*(String *) &key) {                                                                                   // ... check if parameter construction is valid
-                        // log_e ("String key construction error: err_bad_alloc");
-                        #ifdef __USE_KEY_VALUE_DATABASE_EXCEPTIONS__
-                            throw err_bad_alloc;
-                        #endif
-                        __errorFlags__ |= err_bad_alloc;
-                        return err_bad_alloc;
-                    }
+                if (!__isKeyValid__ (key)) {                                                                                   // check if String key parameter construction is valid
+                    // log_e ("String key construction error: err_bad_alloc");
+                    #ifdef __USE_KEY_VALUE_DATABASE_EXCEPTIONS__
+                        throw err_bad_alloc;
+                    #endif
+                    __errorFlags__ |= err_bad_alloc;
+                    return err_bad_alloc;
+                }
 
                 Lock ();
-                Map<keyType, uint32_t>::clearErrorFlags ();
-                auto p = Map<keyType, uint32_t>::find (key);
-                if (p != Map<keyType, uint32_t>::end ()) { // if found
-                    blockOffset = p->second;
-                    Unlock ();  
-                    // log_i ("OK");
-                    return err_ok;
-                } else { // not found or error
-                    signed char e = Map<keyType, uint32_t>::errorFlags ();
-                    if (e) { // error
-                        __errorFlags__ |= e;
+                #ifdef __KEY_VALUE_DATABASE_BLOOM_FILTER_BITS_PER_KEY__
+                    if (!__bloomFilterMayContain__ (key)) {
+                        if (countLookup) __countLookup__ (err_not_found);
                         Unlock ();  
-                        return e;
-                    } else {
-                        // __errorFlags__ |= err_not_found; // do not flag this error, just return err_not_found
+                        return err_not_found;
+                    }
+                #endif
+                #ifndef __KEY_VALUE_DATABASE_KEYS_ON_DISK__
+                    Map<keyType, blockOffsetType>::clearErrorFlags ();
+                    blockOffsetType *p = Map<keyType, blockOffsetType>::find_value (key);
+                    if (p) { // if found
+                        blockOffset = *p;
+                        if (countLookup) __countLookup__ (err_ok);
                         Unlock ();  
-                        return err_not_found;                      
+                        // log_i ("OK");
+                        return err_ok;
+                    } else { // not found or error
+                        signed char e = Map<keyType, blockOffsetType>::errorFlags ();
+                        if (e) { // error
+                            __errorFlags__ |= e;
+                            if (countLookup) __countLookup__ (e);
+                            Unlock ();  
+                            return e;
+                        } else {
+                            // __errorFlags__ |= err_not_found; // do not flag this error, just return err_not_found
+                            if (countLookup) __countLookup__ (err_not_found);
+                            Unlock ();  
+                            return err_not_found;                      
+                        }
                     }
-                }
+                #else
+                    // only key's fingerprint is kept in memory, the block has to be read to make sure it belongs to the key
+                    blockOffsetType *pBlockOffset;
+                    int16_t blockSize;
+                    const char *data;
+                    size_t length;
+                    signed char e = __findBlockValue__ (key, pBlockOffset, blockSize, data, length); // err_not_found is not flagged, just returned
+                    if (!e) // found
+                        blockOffset = *pBlockOffset;
+                    if (countLookup) __countLookup__ (e);
+                    Unlock ();  
+                    return e;
+                #endif
             }
 
+        public:
+
 
            /*
             *  Read the value from (disk) __dataFile__, so it is slow. 
+            *
+            *  String keys may also be given as characters, like FindValue ("SSID", &value), so no temporary String needs to be constructed.
             */
 
-            signed char FindValue (keyType key, valueType *value, uint32_t blockOffset = 0xFFFFFFFF) { 
+            signed char FindValue (const keyType& key, valueType *value, blockOffsetType blockOffset = (blockOffsetType) -1) { __operationTimer__ timer (this, traceFindValue); return timer.stop (__findValue__ (key, value, blockOffset)); }
+
+            template <class K = keyType>
+            typename __charKeysOnly__<K, signed char>::type FindValue (const char *key, valueType *value, blockOffsetType blockOffset = (blockOffsetType) -1) { __operationTimer__ timer (this, traceFindValue); return timer.stop (__findValue__ (key, value, blockOffset)); }
+
+        private:
+
+            template <class K>
+            signed char __findValue__ (const K& key, valueType *value, blockOffsetType blockOffset) { 
                 // log_i ("(key, *value, block offset)");
                 if (!__dataFile__) { 
                     // log_e ("error, data file not opened: err_file_io");
@@ -507,70 +905,212 @@
                     return err_file_io; 
                 }
 
-                if (is_same<keyType, String>::value)                                                                          // if key is of type String ... (if anyone knows hot to do this in compile-time a feedback is welcome)
-                    if (!*(String *) &key) {                                                                                   // ... check if parameter construction is valid
-                        // log_e ("String key construction error: err_bad_alloc");
-                        #ifdef __USE_KEY_VALUE_DATABASE_EXCEPTIONS__
-                            throw err_bad_alloc;
-                        #endif
-                        __errorFlags__ |= err_bad_alloc;
-                        return err_bad_alloc;
-                    }
-
-                keyType storedKey = {};
+                if (!__isKeyValid__ (key)) {                                                                                   // check if String key parameter construction is valid
+                    // log_e ("String key construction error: err_bad_alloc");
+                    #ifdef __USE_KEY_VALUE_DATABASE_EXCEPTIONS__
+                        throw err_bad_alloc;
+                    #endif
+                    __errorFlags__ |= err_bad_alloc;
+                    return err_bad_alloc;
+                }
 
                 Lock (); 
 
-                if (blockOffset == 0xFFFFFFFF) { // if block offset was not specified find it from Map
-                    Map<keyType, uint32_t>::clearErrorFlags ();
-                    auto p = Map<keyType, uint32_t>::find (key); 
-                    if (p == Map<keyType, uint32_t>::end ()) { // if not found or error
-                        signed char e = Map<keyType, uint32_t>::errorFlags ();
-                        if (e) { // error
-                            __errorFlags__ |= e;
-                            Unlock ();  
-                            return e;
-                        } else {
-                            // __errorFlags__ |= err_not_found; // do not flag tis error, just return err_not_found
-                            Unlock ();
-                            return err_not_found;
-                        }
-                    }
-                    blockOffset = p->second;
+                int16_t blockSize;
+                const char *data;
+                size_t length;
+                signed char e;
+                if (blockOffset == (blockOffsetType) -1) { // if block offset was not specified find it in the index first
+                    blockOffsetType *pBlockOffset;
+                    e = __findBlockValue__ (key, pBlockOffset, blockSize, data, length); // err_not_found is not flagged, just returned
+                } else {
+                    e = __readBlockValue__ (key, blockOffset, blockSize, data, length);
+                }
+                #ifdef __KEY_VALUE_DATABASE_TTL__
+                    if (!e && __isExpired__ ()) // expired keys are not found any more, although they are kept until ExpireStep deletes them
+                        e = err_not_found;
+                #endif
+                __countLookup__ (e);
+                if (e) { // != OK
+                    Unlock ();  
+                    return e;
                 }
 
-                int16_t blockSize;
-                if (!__readBlock__ (blockSize, storedKey, *value, blockOffset)) {
-                    if (blockSize > 0 && storedKey == key) {
-                        // log_i ("OK");
-                        Unlock ();  
-                        return err_ok; // success  
-                    } else {
-                        // log_e ("error that shouldn't happen: err_data_changed");
+                if (is_same<valueType, String>::value) { // if value is of type String ... (if anyone knows hot to do this in compile-time a feedback is welcome)
+                    *(String *) value = data; // a single allocation at most, value's buffer gets reused if it is already large enough
+                    if (!*(String *) value) {
+                        // log_e ("String value construction error err_bad_alloc");
                         #ifdef __USE_KEY_VALUE_DATABASE_EXCEPTIONS__
-                            throw err_data_changed;
+                            throw err_bad_alloc;
                         #endif
-                        __errorFlags__ |= err_data_changed;
+                        __errorFlags__ |= err_bad_alloc;
                         Unlock ();  
-                        return err_data_changed; // shouldn't happen, but check anyway ...
+                        return err_bad_alloc;     
                     }
-                } else {
-                    // log_e ("error reading data block: err_file_io");
+                } else { // fixed size value
+                    memcpy ((void *) value, data, length);
+                }
+                // log_i ("OK");
+                Unlock ();  
+                return err_ok; // success  
+            }
+
+        public:
+
+
+           /*
+            *  Find the neighbour of the key and read its value from (disk) __dataFile__ (not available with __KEY_VALUE_DATABASE_KEYS_ON_DISK__, since keys are
+            *  not kept in order then):
+            *
+            *    - FindLowerBound or FindCeiling finds the first key >= key
+            *    - FindUpperBound finds the first key > key
+            *    - FindFloor finds the last key <= key
+            *
+            *  The key found is stored into foundKey, its value into value and its block offset into blockOffset, each if it is not NULL, like:
+            *
+            *    unsigned long timestamp;
+            *    float temperature;
+            *    if (readings.FindUpperBound (lastTimestamp, &timestamp, &temperature) == err_ok) // the next reading after lastTimestamp
+            *        ...
+            *
+            *  Returns OK, err_not_found if there is no such key or one of the error codes.
+            */
+
+          #ifndef __KEY_VALUE_DATABASE_KEYS_ON_DISK__
+
+            signed char FindLowerBound (const keyType& key, keyType *foundKey, valueType *value = NULL, blockOffsetType *blockOffset = NULL) { return __findBound__ (key, true, true, foundKey, value, blockOffset); }
+
+            signed char FindUpperBound (const keyType& key, keyType *foundKey, valueType *value = NULL, blockOffsetType *blockOffset = NULL) { return __findBound__ (key, true, false, foundKey, value, blockOffset); }
+
+            signed char FindFloor (const keyType& key, keyType *foundKey, valueType *value = NULL, blockOffsetType *blockOffset = NULL) { return __findBound__ (key, false, true, foundKey, value, blockOffset); }
+
+            signed char FindCeiling (const keyType& key, keyType *foundKey, valueType *value = NULL, blockOffsetType *blockOffset = NULL) { return __findBound__ (key, true, true, foundKey, value, blockOffset); }
+
+        private:
+
+            signed char __findBound__ (const keyType& key, bool forward, bool orEqual, keyType *foundKey, valueType *value, blockOffsetType *blockOffset) {
+                if (!__isKeyValid__ (key)) {                                                                                   // check if String key parameter construction is valid
+                    // log_e ("String key construction error: err_bad_alloc");
+                    #ifdef __USE_KEY_VALUE_DATABASE_EXCEPTIONS__
+                        throw err_bad_alloc;
+                    #endif
+                    __errorFlags__ |= err_bad_alloc;
+                    return err_bad_alloc;
+                }
+
+                Lock (); 
+                auto p = forward ? (orEqual ? Map<keyType, blockOffsetType>::lower_bound (key) : Map<keyType, blockOffsetType>::upper_bound (key)) : Map<keyType, blockOffsetType>::floor (key);
+                if (p == Map<keyType, blockOffsetType>::end ()) {
+                    // __errorFlags__ |= err_not_found; // do not flag this error, just return err_not_found
+                    Unlock ();  
+                    return err_not_found;
+                }
+
+                signed char e = err_ok;
+                if (value) 
+                    e = __findValue__ (p->first, value, p->second); // errors are already flagged there
+                if (!e) {
+                    if (foundKey) {
+                        *foundKey = p->first;
+                        if (!__isKeyValid__ (*foundKey)) {
+                            // log_e ("String key construction error: err_bad_alloc");
+                            #ifdef __USE_KEY_VALUE_DATABASE_EXCEPTIONS__
+                                throw err_bad_alloc;
+                            #endif
+                            __errorFlags__ |= err_bad_alloc;
+                            e = err_bad_alloc;
+                        }
+                    }
+                    if (blockOffset) 
+                        *blockOffset = p->second;
+                }
+                Unlock ();  
+                return e;
+            }
+
+          #endif
+
+        public:
+
+
+           /*
+            *  Reads the value from (disk) __dataFile__ into internal read buffer and passes it to callback function without copying it, like:
+            *
+            *    settings.WithValue ("SSID", [] (const char *data, size_t length) { Serial.write (data, length); });
+            *
+            *  String values are passed as (0 terminated) characters, fixed size values as their bytes, which may not be aligned, so use memcpy to get them.
+            *  The data is only valid during the callback, which is called while the database is locked. The read buffer is reused by the following calls
+            *  so no heap allocation is needed once it is large enough.
+            */
+
+            signed char WithValue (const keyType& key, void (*valueCallback) (const char *data, size_t length), blockOffsetType blockOffset = (blockOffsetType) -1) { return __withValue__ (key, valueCallback, blockOffset); }
+
+            template <class K = keyType>
+            typename __charKeysOnly__<K, signed char>::type WithValue (const char *key, void (*valueCallback) (const char *data, size_t length), blockOffsetType blockOffset = (blockOffsetType) -1) { return __withValue__ (key, valueCallback, blockOffset); }
+
+        private:
+
+            template <class K>
+            signed char __withValue__ (const K& key, void (*valueCallback) (const char *data, size_t length), blockOffsetType blockOffset) { 
+                // log_i ("(key, callback, block offset)");
+                if (!__dataFile__) { 
+                    // log_e ("error, data file not opened: err_file_io");
                     #ifdef __USE_KEY_VALUE_DATABASE_EXCEPTIONS__
                         throw err_file_io;
                     #endif
                     __errorFlags__ |= err_file_io;
-                    Unlock ();  
                     return err_file_io; 
-                } 
+                }
+
+                if (!__isKeyValid__ (key)) {                                                                                   // check if String key parameter construction is valid
+                    // log_e ("String key construction error: err_bad_alloc");
+                    #ifdef __USE_KEY_VALUE_DATABASE_EXCEPTIONS__
+                        throw err_bad_alloc;
+                    #endif
+                    __errorFlags__ |= err_bad_alloc;
+                    return err_bad_alloc;
+                }
+
+                Lock (); 
+
+                int16_t blockSize;
+                const char *data;
+                size_t length;
+                signed char e;
+                if (blockOffset == (blockOffsetType) -1) { // if block offset was not specified find it in the index first
+                    blockOffsetType *pBlockOffset;
+                    e = __findBlockValue__ (key, pBlockOffset, blockSize, data, length); // err_not_found is not flagged, just returned
+                } else {
+                    e = __readBlockValue__ (key, blockOffset, blockSize, data, length);
+                }
+                #ifdef __KEY_VALUE_DATABASE_TTL__
+                    if (!e && __isExpired__ ()) // expired keys are not found any more, although they are kept until ExpireStep deletes them
+                        e = err_not_found;
+                #endif
+                __countLookup__ (e);
+                if (e) { // != OK
+                    Unlock ();  
+                    return e;
+                }
+
+                valueCallback (data, length);
+                // log_i ("OK");
+                Unlock ();  
+                return err_ok;
             }
 
+        public:
+
 
            /*
             *  Updates the value associated with the key
             */
 
-            signed char Update (keyType key, valueType newValue, uint32_t *pBlockOffset = NULL) {
+            signed char Update (const keyType& key, const valueType& newValue, blockOffsetType *pBlockOffset = NULL) { __operationTimer__ timer (this, traceUpdate); return timer.stop (__update__ (key, newValue, pBlockOffset)); }
+
+        private:
+
+            signed char __update__ (const keyType& key, const valueType& newValue, blockOffsetType *pBlockOffset) {
                 // log_i ("(key, value)");
                 if (!__dataFile__) { 
                     // log_e ("error, data file not opened: err_file_io");
@@ -581,15 +1121,14 @@
                     return err_file_io; 
                 }
 
-                if (is_same<keyType, String>::value)                                                                          // if key is of type String ... (if anyone knows hot to do this in compile-time a feedback is welcome)
-                    if (!*(String *) &key) {                                                                                   // ... check if parameter construction is valid
-                        // log_e ("String key construction error: err_bad_alloc");
-                        #ifdef __USE_KEY_VALUE_DATABASE_EXCEPTIONS__
-                            throw err_bad_alloc;
-                        #endif
-                        __errorFlags__ |= err_bad_alloc;
-                        return err_bad_alloc;
-                    }
+                if (!__isKeyValid__ (key)) {                                                                                   // check if String key parameter construction is valid
+                    // log_e ("String key construction error: err_bad_alloc");
+                    #ifdef __USE_KEY_VALUE_DATABASE_EXCEPTIONS__
+                        throw err_bad_alloc;
+                    #endif
+                    __errorFlags__ |= err_bad_alloc;
+                    return err_bad_alloc;
+                }
 
                 if (is_same<valueType, String>::value)                                                                        // if key is of type String ... (if anyone knows hot to do this in compile-time a feedback is welcome)
                     if (!*(String *) &newValue) {                                                                              // ... check if parameter construction is valid
@@ -603,69 +1142,56 @@
 
                 Lock (); 
 
-                // 1. get blockOffset
-                if (!pBlockOffset) { // find block offset if not provided by the calling program
-      
-                    // log_i ("step 1: looking for block offset in Map");
-                    Map<keyType, uint32_t>::clearErrorFlags ();
-                    auto p = Map<keyType, uint32_t>::find (key);
-                    if (p == Map<keyType, uint32_t>::end ()) { // if not found
-                        signed char e = Map<keyType, uint32_t>::errorFlags ();
-                        if (e) { // error
-                            __errorFlags__ |= e;
-                            Unlock ();  
-                            return e;
-                        } else {
-                            __errorFlags__ |= err_not_found;
-                            Unlock ();
-                            return err_not_found;
-                        }
-                    }
-                    pBlockOffset = &(p->second);
-                } else {
-                    // log_i ("step 1: block offset already profided by the calling program");
+                if (__inTransaction__) { // only stage the update until Commit
+                    signed char e = __stage__ (__stageUpdate__, key, &newValue, 0);
+                    Unlock ();  
+                    return e;
                 }
 
-                // 2. read the block size and stored key
-                // log_i ("step 2: reading block size from data file");
+                // 1. get blockOffset and 2. read the block size and stored key
                 int16_t blockSize;
                 size_t newBlockSize;
-                keyType storedKey;
-                valueType storedValue;
+                const char *data;
+                size_t length;
 
-                signed char e  = __readBlock__ (blockSize, storedKey, storedValue, *pBlockOffset, true);
+                signed char e;
+                if (!pBlockOffset) { // find block offset if not provided by the calling program
+                    // log_i ("step 1: looking for block offset in the index");
+                    e = __findBlockValue__ (key, pBlockOffset, blockSize, data, length);
+                    if (e == err_not_found)
+                        __errorFlags__ |= err_not_found;
+                } else {
+                    // log_i ("step 1: block offset already profided by the calling program");
+                    // log_i ("step 2: reading block size from data file");
+                    e = __readBlockValue__ (key, *pBlockOffset, blockSize, data, length);
+                }
+                #ifdef __KEY_VALUE_DATABASE_TTL__
+                    if (!e && __isExpired__ ()) { // expired keys are not found any more, although they are kept until ExpireStep deletes them
+                        __errorFlags__ |= err_not_found;
+                        e = err_not_found;
+                    }
+                    uint32_t expires = __lastExpires__; // a new block keeps the expiry time
+                #endif
                 if (e) { // != OK
                     // log_e ("read block error");
                     Unlock ();  
-                    return err_file_io;
-                } 
-                if (blockSize <= 0 || storedKey != key) {
-                    // log_e ("error that shouldn't happen: err_data_changed");
-                    #ifdef __USE_KEY_VALUE_DATABASE_EXCEPTIONS__
-                        throw err_data_changed;
-                    #endif
-                    __errorFlags__ |= err_data_changed;
-                    Unlock ();  
-                    return err_data_changed; // shouldn't happen, but check anyway ...
+                    return e;
+                }
+                // the old value is needed to find its secondary index entries (data only points into the read buffer, which gets reused)
+                valueType oldValue;
+                if (__secondaryIndexes__) {
+                    e = __valueFromData__ (oldValue, data, length);
+                    if (e) { // != OK
+                        // log_e ("String value construction error err_bad_alloc");
+                        __errorFlags__ |= e;
+                        Unlock ();  
+                        return e;
+                    }
                 }
                 // 3. calculate new block and data size
                 // log_i ("step 3: calculate block size");
-                size_t dataSize = sizeof (int16_t); // block size information
-                newBlockSize = dataSize;
-                if (is_same<keyType, String>::value) { // if value is of type String ... (if anyone knows hot to do this in compile-time a feedback is welcome)
-                    dataSize += (((String *) &key)->length () + 1); // add 1 for closing 0
-                    newBlockSize += (((String *) &key)->length () + 1) + (((String *) &key)->length () + 1) * __KEY_VALUE_DATABASE_PCT_FREE__ + 0.5; // add PCT_FREE for Strings
-                } else { // fixed size key
-                    dataSize += sizeof (keyType);
-                    newBlockSize += sizeof (keyType);
-                }                
-                if (is_same<valueType, String>::value) { // if value is of type String ... (if anyone knows hot to do this in compile-time a feedback is welcome)
-                    dataSize += (((String *) &newValue)->length () + 1); // add 1 for closing 0
-                    newBlockSize += (((String *) &newValue)->length () + 1) + (((String *) &newValue)->length () + 1) * __KEY_VALUE_DATABASE_PCT_FREE__ + 0.5; // add PCT_FREE for Strings
-                } else { // fixed size value
-                    dataSize += sizeof (valueType);
-                    newBlockSize += sizeof (valueType);
-                }
+                size_t dataSize;
+                __blockSizes__ (key, newValue, dataSize, newBlockSize);
                 if (newBlockSize > 32768) {
                     // log_e ("block size > 32768, error: err_bad_alloc");
                     #ifdef __USE_KEY_VALUE_DATABASE_EXCEPTIONS__
@@ -675,22 +1201,57 @@
                     Unlock ();
                     return err_bad_alloc;
                 }
+                if (is_same<valueType, String>::value) // if value is of type String ... (if anyone knows hot to do this in compile-time a feedback is welcome)
+                    __observeGrowth__ (length, ((String *) &newValue)->length ());
 
                 // 4. decide where to write the new value: existing block or a new one
                 // log_i ("step 4: decide where to writte the new value: same or new block?");
-                if (dataSize <= blockSize) { // there is enough space for new data in the existing block - easier case
+                if (dataSize <= (size_t) blockSize) { // there is enough space for new data in the existing block - easier case
                     // log_i ("reuse the same block");
-                    uint32_t dataFileOffset = *pBlockOffset + sizeof (int16_t); // skip block size information
-                    if (is_same<keyType, String>::value) { // if key is of type String ... (if anyone knows hot to do this in compile-time a feedback is welcome)
-                        dataFileOffset += (((String *) &key)->length () + 1); // add 1 for closing 0
+                    blockOffsetType dataFileOffset = *pBlockOffset + __blockHeaderSize__; // skip block size (and expiry time) information
+                    if (is_string<keyType>::value) { // if key is of type String ... (if anyone knows hot to do this in compile-time a feedback is welcome)
+                        dataFileOffset += (__stringLength__ (key) + 1); // add 1 for closing 0
                     } else { // fixed size key
                         dataFileOffset += sizeof (keyType);
                     }                
 
-                    // 5. write new value to __dataFile__
+                    // 5. write new value to __dataFile__ (the secondary index entries of the new value are inserted first, the ones that don't change are kept)
                     // log_i ("step 5: write new value");
-                    if (!__dataFile__.seek (dataFileOffset, SeekSet)) {
+                    e = __secondaryIndexesInsert__ (newValue, *pBlockOffset, &oldValue, *pBlockOffset);
+                    if (e) { // != OK
+                        // log_e ("secondary index insert failed");
+                        __errorFlags__ |= e;
+                        Unlock ();  
+                        return e;
+                    }
+                    #if defined (__KEY_VALUE_DATABASE_CHECKSUM__) || defined (__KEY_VALUE_DATABASE_COMPRESSION__)
+                        // the checksum changes with the value and the value may be (de)compressed, so the block is rewritten from its beginning (without the free space at its end)
+                        byte *block = (byte *) malloc (dataSize);
+                        if (!block) {
+                            // log_e ("malloc error, out of memory");
+                            __secondaryIndexesErase__ (newValue, *pBlockOffset, &oldValue, *pBlockOffset);
+                            #ifdef __USE_KEY_VALUE_DATABASE_EXCEPTIONS__
+                                throw err_bad_alloc;
+                            #endif
+                            __errorFlags__ |= err_bad_alloc;
+                            Unlock ();  
+                            return err_bad_alloc;
+                        }
+                        __buildBlock__ (block, blockSize, key, newValue);
+                        #ifdef __KEY_VALUE_DATABASE_TTL__
+                            memcpy (block + sizeof (int16_t), &expires, sizeof (expires));
+                        #endif
+                        #ifdef __KEY_VALUE_DATABASE_CHECKSUM__
+                            __setBlockChecksum__ (block, dataSize);
+                        #endif
+                        dataFileOffset = *pBlockOffset;
+                    #endif
+                    if (!__seek__ (dataFileOffset)) {
                         // log_e ("seek error: err_file_io");
+                        #if defined (__KEY_VALUE_DATABASE_CHECKSUM__) || defined (__KEY_VALUE_DATABASE_COMPRESSION__)
+                            free (block);
+                        #endif
+                        __secondaryIndexesErase__ (newValue, *pBlockOffset, &oldValue, *pBlockOffset);
                         #ifdef __USE_KEY_VALUE_DATABASE_EXCEPTIONS__
                             throw err_file_io;
                         #endif
@@ -700,16 +1261,23 @@
                     }
                     int bytesToWrite;
                     int bytesWritten;
-                    if (is_same<valueType, String>::value) { // if value is of type String ... (if anyone knows hot to do this in compile-time a feedback is welcome)
-                        bytesToWrite = (((String *) &newValue)->length () + 1);
-                        bytesWritten = __dataFile__.write ((byte *) ((String *) &newValue)->c_str () , bytesToWrite);
-                    } else {
-                        bytesToWrite = sizeof (newValue);
-                        bytesWritten = __dataFile__.write ((byte *) &newValue , bytesToWrite);
-                    }
+                    #if defined (__KEY_VALUE_DATABASE_CHECKSUM__) || defined (__KEY_VALUE_DATABASE_COMPRESSION__)
+                        bytesToWrite = dataSize;
+                        bytesWritten = __write__ (block, bytesToWrite);
+                        free (block);
+                    #else
+                        if (is_same<valueType, String>::value) { // if value is of type String ... (if anyone knows hot to do this in compile-time a feedback is welcome)
+                            bytesToWrite = (((String *) &newValue)->length () + 1);
+                            bytesWritten = __write__ ((byte *) ((String *) &newValue)->c_str () , bytesToWrite);
+                        } else {
+                            bytesToWrite = sizeof (newValue);
+                            bytesWritten = __write__ ((byte *) &newValue , bytesToWrite);
+                        }
+                    #endif
                     if (bytesWritten != bytesToWrite) { // file IO error, it is highly unlikely that rolling-back to the old value would succeed
                         // log_e ("write failed failed, can't roll-back, critical error, closing data file");
                         __dataFile__.close (); // memory key value pairs and disk data file are synchronized any more - it is better to clost he file, this would cause all disk related operations from now on to fail
+                        __secondaryIndexesErase__ (newValue, *pBlockOffset, &oldValue, *pBlockOffset);
                         #ifdef __USE_KEY_VALUE_DATABASE_EXCEPTIONS__
                             throw err_file_io;
                         #endif
@@ -719,7 +1287,9 @@
                     }
 
                     // success
-                    __dataFile__.flush ();
+                    __flush__ ();
+                    __secondaryIndexesErase__ (oldValue, *pBlockOffset, &newValue, *pBlockOffset);
+                    __inPlaceUpdates__ ++;
                     Unlock ();  
                     // log_i ("OK");
                     return err_ok;
@@ -727,30 +1297,43 @@
                 } else { // existing block is not big eneugh, we'll need a new block - more difficult case
                     // log_i ("new block is needed");
 
+                    // the value has outgrown its block, so the new block grows geometrically, then the values that keep growing move less and less often
+                    if (newBlockSize < (size_t) blockSize + blockSize / 2)
+                        newBlockSize = min ((size_t) blockSize + blockSize / 2, (size_t) 32767);
+
                     // 6. search __freeBlocksList__ for most suitable free block, if it exists
                     // log_i ("step 6: searching for the best block on free block list");
                     int freeBlockIndex = -1;
                     uint32_t minWaste = 0xFFFFFFFF;
                     for (int i = 0; i < __freeBlocksList__.size (); i ++) {
-                        if (__freeBlocksList__ [i].blockSize >= dataSize && __freeBlocksList__ [i].blockSize - dataSize < minWaste) {
+                        if ((size_t) __freeBlocksList__ [i].blockSize >= newBlockSize && __freeBlocksList__ [i].blockSize - newBlockSize < minWaste) {
                             freeBlockIndex = i;
-                            minWaste = __freeBlocksList__ [i].blockSize - dataSize;
+                            minWaste = __freeBlocksList__ [i].blockSize - newBlockSize;
                         }
                     }
 
                     // 7. reposition __dataFile__ pointer
                     // log_i ("step 7: reposition data file pointer");
-                    uint32_t newBlockOffset;          
+                    blockOffsetType newBlockOffset;          
                     if (freeBlockIndex == -1) { // append data to the end of __dataFile__
                         // log_i ("append data to the end of data file");
-                        newBlockOffset = __dataFileSize__;
+                        newBlockOffset = __appendBlockOffset__ (newBlockSize);
                     } else { // writte data to free block in __dataFile__
                         // log_i ("found suitabel free data block");
-                        newBlockOffset = __freeBlocksList__ [freeBlockIndex].blockOffset;
-                        newBlockSize = __freeBlocksList__ [freeBlockIndex].blockSize;
+                        newBlockOffset = __freeBlocksList__ [freeBlockIndex].blockOffset; // the free block is split only when the secondary indexes accept the new value
                     }
-                    if (!__dataFile__.seek (newBlockOffset, SeekSet)) {
+                    e = __secondaryIndexesInsert__ (newValue, newBlockOffset);
+                    if (e) { // != OK
+                        // log_e ("secondary index insert failed");
+                        __errorFlags__ |= e;
+                        Unlock (); 
+                        return e;
+                    }
+                    if (freeBlockIndex != -1)
+                        newBlockSize = __splitFreeBlock__ (freeBlockIndex, newBlockSize); // the rest of a larger free block stays free
+                    if (!__seek__ (newBlockOffset)) {
                         // log_e ("seek error err_file_io");
+                        __secondaryIndexesErase__ (newValue, newBlockOffset);
                         #ifdef __USE_KEY_VALUE_DATABASE_EXCEPTIONS__
                             throw err_file_io;
                         #endif
@@ -764,6 +1347,7 @@
                     byte *block = (byte *) malloc (newBlockSize);
                     if (!block) {
                         // log_e ("malloc error, out of memory");
+                        __secondaryIndexesErase__ (newValue, newBlockOffset);
                         #ifdef __USE_KEY_VALUE_DATABASE_EXCEPTIONS__
                             throw err_bad_alloc;
                         #endif
@@ -772,39 +1356,32 @@
                         return err_bad_alloc;
                     }
 
-                    int16_t i = 0;
-                    int16_t bs = (int16_t) newBlockSize;
-                    memcpy (block + i, &bs, sizeof (bs)); i += sizeof (bs);
-                    if (is_same<keyType, String>::value) { // if value is of type String ... (if anyone knows hot to do this in compile-time a feedback is welcome)
-                        size_t l = ((String *) &key)->length () + 1; // add 1 for closing 0
-                        memcpy (block + i, ((String *) &key)->c_str (), l); i += l;
-                    } else { // fixed size key
-                        memcpy (block + i, &key, sizeof (key)); i += sizeof (key);
-                    }       
-                    if (is_same<valueType, String>::value) { // if value is of type String ... (if anyone knows hot to do this in compile-time a feedback is welcome)
-                        size_t l = ((String *) &newValue)->length () + 1; // add 1 for closing 0
-                        memcpy (block + i, ((String *) &newValue)->c_str (), l); i += l;
-                    } else { // fixed size value
-                        memcpy (block + i, &newValue, sizeof (newValue)); i += sizeof (newValue);
-                    }
+                    __buildBlock__ (block, (int16_t) newBlockSize, key, newValue);
+                    #ifdef __KEY_VALUE_DATABASE_TTL__
+                        memcpy (block + sizeof (int16_t), &expires, sizeof (expires));
+                    #endif
+                    #ifdef __KEY_VALUE_DATABASE_CHECKSUM__
+                        __setBlockChecksum__ (block, dataSize);
+                    #endif
 
                     // 9. write new block to __dataFile__
                     // log_i ("step 9: write new block to data file");
-                    if (__dataFile__.write (block, dataSize) != dataSize) {
+                    if (__write__ (block, dataSize) != dataSize) {
                         // log_e ("write failed");
                         free (block);
 
                         // 10. (try to) roll-back
                         // log_i ("step 10: try to roll-back");
-                        if (__dataFile__.seek (newBlockOffset, SeekSet)) {
+                        if (__seek__ (newBlockOffset)) {
                             newBlockSize = (int16_t) -newBlockSize;
-                            if (__dataFile__.write ((byte *) &newBlockSize, sizeof (newBlockSize)) != sizeof (newBlockSize)) { // can't roll-back         
+                            if (__write__ ((byte *) &newBlockSize, sizeof (newBlockSize)) != sizeof (newBlockSize)) { // can't roll-back         
                                 __dataFile__.close (); // memory key value pairs and disk data file are synchronized any more - it is better to clost he file, this would cause all disk related operations from now on to fail
                             }
                         } else { // can't roll-back 
                             // log_e ("seek failed failed, can't roll-back, critical error, closing data file");
                             __dataFile__.close (); // memory key value pairs and disk data file are synchronized any more - it is better to clost he file, this would cause all disk related operations from now on to fail
                         }
+                        __secondaryIndexesErase__ (newValue, newBlockOffset);
                         // log_e ("error err_file_io");
                         #ifdef __USE_KEY_VALUE_DATABASE_EXCEPTIONS__
                             throw err_file_io;
@@ -814,17 +1391,18 @@
                         return err_file_io;
                     }
                     free (block);
-                    __dataFile__.flush ();
+                    __flush__ ();
 
                     // 11. roll-out
                     // log_i ("step 11: roll-out");
+                    __secondaryIndexesErase__ (oldValue, *pBlockOffset);
                     if (freeBlockIndex == -1) { // data appended to the end of __dataFile__
-                        __dataFileSize__ += newBlockSize;
+                        __blockAppended__ (newBlockSize);
                     } else { // data written to free block in __dataFile__
-                        __freeBlocksList__.erase (__freeBlocksList__.begin () + freeBlockIndex); // doesn't fail
+                        __freeBlocksList__.erase_unordered (__freeBlocksList__.begin () + freeBlockIndex); // doesn't fail, the order of free blocks doesn't matter
                     }
                     // mark old block as free
-                    if (!__dataFile__.seek (*pBlockOffset, SeekSet)) {
+                    if (!__seek__ (*pBlockOffset)) {
                         // log_e ("seek error: err_file_io");
                         __dataFile__.close (); // data file is corrupt (it contains two entries with the same key) and it is not likely we can roll it back
                         #ifdef __USE_KEY_VALUE_DATABASE_EXCEPTIONS__
@@ -835,7 +1413,7 @@
                         return err_file_io;
                     }
                     blockSize = (int16_t) -blockSize;
-                    if (__dataFile__.write ((byte *) &blockSize, sizeof (blockSize)) != sizeof (blockSize)) {
+                    if (__write__ ((byte *) &blockSize, sizeof (blockSize)) != sizeof (blockSize)) {
                         // log_e ("write error: err_file_io");
                         __dataFile__.close (); // data file is corrupt (it contains two entries with the same key) and it si not likely we can roll it back
                         #ifdef __USE_KEY_VALUE_DATABASE_EXCEPTIONS__
@@ -845,14 +1423,22 @@
                         Unlock (); 
                         return err_file_io;
                     }
-                    __dataFile__.flush ();
+                    __flush__ ();
                     // update __freeBlocklist__
                     // log_i ("roll-out");
                     if (__freeBlocksList__.push_back ( {*pBlockOffset, (int16_t) -blockSize} )) { // != OK
                         // log_i ("free block list push_back failed, continuing anyway");
                     }
-                    // update Map information
-                    *pBlockOffset = newBlockOffset; // there is no reason this would fail
+                    // update the index, pBlockOffset may only point to a copy (like the one obtained while iterating), so the index entry is looked up anyway
+                    blockOffsetType oldBlockOffset = *pBlockOffset;
+                    *pBlockOffset = newBlockOffset;
+                    __indexRelocate__ (key, oldBlockOffset, newBlockOffset); // there is no reason this would fail
+                    #ifdef __KEY_VALUE_DATABASE_TTL__
+                        if (expires)
+                            __expiryHeapPush__ (expires, newBlockOffset);
+                    #endif
+                    __relocations__ ++;
+                    __autoMaintenance__ ();
                     Unlock ();  
                     // log_i ("OK");
                     return err_ok;
@@ -862,12 +1448,18 @@
                 // return err_ok;
             }
 
+        public:
+
 
            /*
             *  Updates the value associated with the key throught callback function (usefull for counting, etc, when all the calculation should be done while locking is in place)
             */
 
-            signed char Update (keyType key, void (*updateCallback) (valueType &value), uint32_t *pBlockOffset = NULL) {
+            signed char Update (const keyType& key, void (*updateCallback) (valueType &value), blockOffsetType *pBlockOffset = NULL) { __operationTimer__ timer (this, traceUpdate); return timer.stop (__update__ (key, updateCallback, pBlockOffset)); }
+
+        private:
+
+            signed char __update__ (const keyType& key, void (*updateCallback) (valueType &value), blockOffsetType *pBlockOffset) {
                 // log_i ("(key, value)");
                 if (!__dataFile__) { 
                     // log_e ("error, data file not opened: err_file_io");
@@ -878,20 +1470,19 @@
                     return err_file_io; 
                 }
 
-                if (is_same<keyType, String>::value)                                                                          // if key is of type String ... (if anyone knows hot to do this in compile-time a feedback is welcome)
-                    if (!*(String *) &key) {                                                                                   // ... check if parameter construction is valid
-                        // log_e ("String key construction error: err_bad_alloc");
-                        #ifdef __USE_KEY_VALUE_DATABASE_EXCEPTIONS__
-                            throw err_bad_alloc;
-                        #endif
-                        __errorFlags__ |= err_bad_alloc;
-                        return err_bad_alloc;
-                    }
+                if (!__isKeyValid__ (key)) {                                                                                   // check if String key parameter construction is valid
+                    // log_e ("String key construction error: err_bad_alloc");
+                    #ifdef __USE_KEY_VALUE_DATABASE_EXCEPTIONS__
+                        throw err_bad_alloc;
+                    #endif
+                    __errorFlags__ |= err_bad_alloc;
+                    return err_bad_alloc;
+                }
 
                 Lock (); 
 
                 valueType value;
-                signed char e = FindValue (key, &value); 
+                signed char e = __findValue__ (key, &value, (blockOffsetType) -1); 
                 if (e) {
                     // log_e ("FindValue error");
                     __errorFlags__ |= e;
@@ -901,7 +1492,7 @@
 
                 updateCallback (value);
 
-                e = Update (key, value, pBlockOffset); 
+                e = __update__ (key, value, pBlockOffset); 
                 if (e) {
                     // log_e ("Update error");
                     __errorFlags__ |= e;
@@ -913,12 +1504,18 @@
                 return err_ok;
             }
 
+        public:
+
 
            /*
-            *  Updates or inserts key-value pair
+            *  Updates or inserts key-value pair. The Upserts are timed (and traced) as Inserts or Updates, depending on what they do.
             */
 
-            signed char Upsert (keyType key, valueType newValue) {
+            signed char Upsert (const keyType& key, const valueType& newValue) { __operationTimer__ timer (this, traceInsert); bool updated = false; signed char e = __upsert__ (key, newValue, updated); return timer.stop (e, updated ? traceUpdate : traceInsert); }
+
+        private:
+
+            signed char __upsert__ (const keyType& key, const valueType& newValue, bool& updated) {
                 // log_i ("(key, value)");
                 if (!__dataFile__) { 
                     // log_e ("error, data file not opened: err_file_io");
@@ -929,15 +1526,14 @@
                     return err_file_io; 
                 }
 
-                if (is_same<keyType, String>::value)                                                                          // if key is of type String ... (if anyone knows hot to do this in compile-time a feedback is welcome)
-                    if (!*(String *) &key) {                                                                                   // ... check if parameter construction is valid
-                        // log_e ("String key construction error: err_bad_alloc");
-                        #ifdef __USE_KEY_VALUE_DATABASE_EXCEPTIONS__
-                            throw err_bad_alloc;
-                        #endif
-                        __errorFlags__ |= err_bad_alloc;
-                        return err_bad_alloc;
-                    }
+                if (!__isKeyValid__ (key)) {                                                                                   // check if String key parameter construction is valid
+                    // log_e ("String key construction error: err_bad_alloc");
+                    #ifdef __USE_KEY_VALUE_DATABASE_EXCEPTIONS__
+                        throw err_bad_alloc;
+                    #endif
+                    __errorFlags__ |= err_bad_alloc;
+                    return err_bad_alloc;
+                }
 
                 if (is_same<valueType, String>::value)                                                                        // if key is of type String ... (if anyone knows hot to do this in compile-time a feedback is welcome)
                     if (!*(String *) &newValue) {                                                                              // ... check if parameter construction is valid
@@ -951,10 +1547,11 @@
 
                 Lock ();
                 signed char e;
-                e = Insert (key, newValue);
+                e = __insert__ (key, newValue);
                 if (e == err_not_unique) {
                     // DEBUG: Serial.print ("   Upsert ("); Serial.print (key); Serial.print (", "); Serial.print (newValue); Serial.print (" Insert error "); Serial.println (e);
-                    e = Update (key, newValue, NULL);
+                    updated = true;
+                    e = __update__ (key, newValue, NULL);
                 }
                 if (e) { // != OK
                     // log_e ("Update or Insert error");
@@ -967,11 +1564,17 @@
                 return e; 
             }
 
+        public:
+
            /*
             *  Updates or inserts the value associated with the key throught callback function (usefull for counting, etc, when all the calculation should be done while locking is in place)
             */
 
-            signed char Upsert (keyType key, void (*updateCallback) (valueType &value), valueType defaultValue) {
+            signed char Upsert (const keyType& key, void (*updateCallback) (valueType &value), const valueType& defaultValue) { __operationTimer__ timer (this, traceInsert); bool updated = false; signed char e = __upsert__ (key, updateCallback, defaultValue, updated); return timer.stop (e, updated ? traceUpdate : traceInsert); }
+
+        private:
+
+            signed char __upsert__ (const keyType& key, void (*updateCallback) (valueType &value), const valueType& defaultValue, bool& updated) {
                 // log_i ("(key, value)");
                 if (!__dataFile__) { 
                     // log_e ("error, data file not opened: err_file_io");
@@ -982,15 +1585,14 @@
                     return err_file_io; 
                 }
 
-                if (is_same<keyType, String>::value)                                                                          // if key is of type String ... (if anyone knows hot to do this in compile-time a feedback is welcome)
-                    if (!*(String *) &key) {                                                                                   // ... check if parameter construction is valid
-                        // log_e ("String key construction error: err_bad_alloc");
-                        #ifdef __USE_KEY_VALUE_DATABASE_EXCEPTIONS__
-                            throw err_bad_alloc;
-                        #endif
-                        __errorFlags__ |= err_bad_alloc;
-                        return err_bad_alloc;
-                    }
+                if (!__isKeyValid__ (key)) {                                                                                   // check if String key parameter construction is valid
+                    // log_e ("String key construction error: err_bad_alloc");
+                    #ifdef __USE_KEY_VALUE_DATABASE_EXCEPTIONS__
+                        throw err_bad_alloc;
+                    #endif
+                    __errorFlags__ |= err_bad_alloc;
+                    return err_bad_alloc;
+                }
 
                 if (is_same<valueType, String>::value)                                                                        // if key is of type String ... (if anyone knows hot to do this in compile-time a feedback is welcome)
                     if (!*(String *) &defaultValue) {                                                                          // ... check if parameter construction is valid
@@ -1004,9 +1606,11 @@
 
                 Lock (); 
                 signed char e;
-                e = Insert (key, defaultValue);
-                if (e) // != OK
-                    e = Update (key, updateCallback);
+                e = __insert__ (key, defaultValue);
+                if (e) { // != OK
+                    updated = true;
+                    e = __update__ (key, updateCallback, NULL);
+                }
                 if (e) { // != OK
                     // log_e ("Update or Insert error");
                     __errorFlags__ |= e;
@@ -1017,11 +1621,17 @@
                 return e; 
             }
 
+        public:
+
            /*
             *  Updates or inserts the value associated with the key throught callback function (usefull for counting, etc, when all the calculation should be done while locking is in place)
             */
 
-            signed char Upsert (keyType key, void (*upsertCallback) (valueType &value), uint32_t *pBlockOffset = NULL) {
+            signed char Upsert (const keyType& key, void (*upsertCallback) (valueType &value), blockOffsetType *pBlockOffset = NULL) { __operationTimer__ timer (this, traceInsert); bool updated = false; signed char e = __upsert__ (key, upsertCallback, pBlockOffset, updated); return timer.stop (e, updated ? traceUpdate : traceInsert); }
+
+        private:
+
+            signed char __upsert__ (const keyType& key, void (*upsertCallback) (valueType &value), blockOffsetType *pBlockOffset, bool& updated) {
                 // log_i ("(key, value)");
                 if (!__dataFile__) { 
                     // log_e ("error, data file not opened: err_file_io");
@@ -1032,28 +1642,28 @@
                     return err_file_io; 
                 }
 
-                if (is_same<keyType, String>::value)                                                                          // if key is of type String ... (if anyone knows hot to do this in compile-time a feedback is welcome)
-                    if (!*(String *) &key) {                                                                                  // ... check if parameter construction is valid
-                        // log_e ("String key construction error: err_bad_alloc");
-                        #ifdef __USE_KEY_VALUE_DATABASE_EXCEPTIONS__
-                            throw err_bad_alloc;
-                        #endif
-                        __errorFlags__ |= err_bad_alloc;
-                        return err_bad_alloc;
-                    }
+                if (!__isKeyValid__ (key)) {                                                                                  // check if String key parameter construction is valid
+                    // log_e ("String key construction error: err_bad_alloc");
+                    #ifdef __USE_KEY_VALUE_DATABASE_EXCEPTIONS__
+                        throw err_bad_alloc;
+                    #endif
+                    __errorFlags__ |= err_bad_alloc;
+                    return err_bad_alloc;
+                }
 
                 Lock (); 
 
                 valueType value = {};
-                signed char e = FindValue (key, &value); 
+                signed char e = __findValue__ (key, &value, (blockOffsetType) -1); 
                 switch (e) {
                     case err_ok:        // found
                                         upsertCallback (value);
-                                        e = Update (key, value, pBlockOffset);
+                                        updated = true;
+                                        e = __update__ (key, value, pBlockOffset);
                                         break;
                     case err_not_found: // not found
                                         upsertCallback (value);
-                                        e = Insert (key, value);
+                                        e = __insert__ (key, value);
                                         break;
                     default:            // errror
                                         __errorFlags__ |= e;
@@ -1072,12 +1682,18 @@
                 return err_ok;
             }
 
+        public:
+
 
            /*
             *  Deletes key-value pair, returns OK or one of the error codes.
             */
 
-            signed char Delete (keyType key) {
+            signed char Delete (const keyType& key) { __operationTimer__ timer (this, traceDelete); return timer.stop (__delete__ (key)); }
+
+        private:
+
+            signed char __delete__ (const keyType& key) {
                 // log_i ("(key, value)");
                 if (!__dataFile__) { 
                     // log_e ("error, data file not opened: err_file_io");
@@ -1088,15 +1704,14 @@
                     return err_file_io; 
                 }
 
-                if (is_same<keyType, String>::value)                                                                          // if key is of type String ... (if anyone knows hot to do this in compile-time a feedback is welcome)
-                    if (!*(String *) &key) {                                                                                   // ... check if parameter construction is valid
-                        // log_e ("String key construction error: err_bad_alloc");
-                        #ifdef __USE_KEY_VALUE_DATABASE_EXCEPTIONS__
-                            throw err_bad_alloc;
-                        #endif
-                        __errorFlags__ |= err_bad_alloc;
-                        return err_bad_alloc;
-                    }
+                if (!__isKeyValid__ (key)) {                                                                                   // check if String key parameter construction is valid
+                    // log_e ("String key construction error: err_bad_alloc");
+                    #ifdef __USE_KEY_VALUE_DATABASE_EXCEPTIONS__
+                        throw err_bad_alloc;
+                    #endif
+                    __errorFlags__ |= err_bad_alloc;
+                    return err_bad_alloc;
+                }
 
                 Lock (); 
 
@@ -1110,19 +1725,41 @@
                     return err_cant_do_it_now;
                 }
 
+                if (__inTransaction__) { // only stage the delete until Commit
+                    signed char e = __stage__ (__stageDelete__, key, NULL, 0);
+                    Unlock (); 
+                    return e;
+                }
+
                 // 1. get blockOffset
                 // log_i ("step 1: get block offset");
-                uint32_t blockOffset;
-                signed char e = FindBlockOffset (key, blockOffset);
+                blockOffsetType blockOffset;
+                signed char e = __findBlockOffset__ (key, blockOffset, false); // not counted as a lookup
                 if (e) { // != OK
                     // log_e ("FindBlockOffset failed");
                     Unlock (); 
                     return e;
                 }
+                // the value is needed to find its secondary index entries (it is read directly, since expired keys are not found by FindValue)
+                valueType oldValue;
+                if (__secondaryIndexes__) {
+                    int16_t bs;
+                    const char *data;
+                    size_t length;
+                    e = __readBlockValue__ (key, blockOffset, bs, data, length);
+                    if (!e)
+                        e = __valueFromData__ (oldValue, data, length);
+                    if (e) { // != OK
+                        // log_e ("reading the value failed");
+                        __errorFlags__ |= e;
+                        Unlock (); 
+                        return e;
+                    }
+                }
 
                 // 2. read the block size
                 // log_i ("step 2: reading block size from data file");
-                if (!__dataFile__.seek (blockOffset, SeekSet)) {
+                if (!__seek__ (blockOffset)) {
                     // log_e ("seek failed, error err_file_io");
                     #ifdef __USE_KEY_VALUE_DATABASE_EXCEPTIONS__
                         throw err_file_io;
@@ -1132,7 +1769,7 @@
                     return err_file_io;
                 }
                 int16_t blockSize;
-                if (__dataFile__.read ((uint8_t *) &blockSize, sizeof (int16_t)) != sizeof (blockSize)) {
+                if (__read__ ((uint8_t *) &blockSize, sizeof (int16_t)) != sizeof (blockSize)) {
                     // log_e ("read failed, error err_file_io");
                     #ifdef __USE_KEY_VALUE_DATABASE_EXCEPTIONS__
                         throw err_file_io;
@@ -1151,9 +1788,9 @@
                     return err_data_changed; // shouldn't happen, but check anyway ...
                 }
 
-                // 3. erase the key from Map
-                // log_i ("step 3: erase key from Map");
-                e = Map<keyType, uint32_t>::erase (key);
+                // 3. erase the key from the index
+                // log_i ("step 3: erase key from the index");
+                e = __indexErase__ (key, blockOffset);
                 if (e) { // != OK
                     // log_e ("Map::erase failed");
                     __errorFlags__ |= e;
@@ -1164,12 +1801,12 @@
                 // 4. write back negative block size designating a free block
                 // log_i ("step 4: mark bloc as free");
                 blockSize = (int16_t) -blockSize;
-                if (!__dataFile__.seek (blockOffset, SeekSet)) {
+                if (!__seek__ (blockOffset)) {
                   // log_e ("seek failed, error err_file_io");
 
                     // 5. (try to) roll-back
                     // log_i ("step 5: try to roll-back");
-                    if (Map<keyType, uint32_t>::insert (key, (uint32_t) blockOffset)) { // != OK
+                    if (__indexInsert__ (key, blockOffset, false)) { // != OK
                         // log_e ("Map::insert failed failed, can't roll-back, critical error, closing data file");
                         __dataFile__.close (); // memory key value pairs and disk data file are synchronized any more - it is better to clost the file, this would cause all disk related operations from now on to fail
                     }
@@ -1181,10 +1818,10 @@
                     Unlock (); 
                     return err_file_io;
                 }
-                if (__dataFile__.write ((byte *) &blockSize, sizeof (blockSize)) != sizeof (blockSize)) {
+                if (__write__ ((byte *) &blockSize, sizeof (blockSize)) != sizeof (blockSize)) {
                     // log_e ("write failed, try to roll-back");
                      // 5. (try to) roll-back
-                    if (Map<keyType, uint32_t>::insert (key, (uint32_t) blockOffset)) { // != OK
+                    if (__indexInsert__ (key, blockOffset, false)) { // != OK
                         // log_e ("Map::insert failed failed, can't roll-back, critical error, closing data file");
                         __dataFile__.close (); // memory key value pairs and disk data file are synchronized any more - it is better to clost he file, this would cause all disk related operations from now on to fail
                     }
@@ -1196,21 +1833,28 @@
                     Unlock (); 
                     return err_file_io;
                 }
-                __dataFile__.flush ();
+                __flush__ ();
 
                 // 5. roll-out
                 // log_i ("step 5: roll-out");
+                __secondaryIndexesErase__ (oldValue, blockOffset);
                 // add the block to __freeBlockList__
                 blockSize = (int16_t) -blockSize;
-                if (__freeBlocksList__.push_back ( {(uint32_t) blockOffset, blockSize} )) { // != OK
+                if (__freeBlocksList__.push_back ( {blockOffset, blockSize} )) { // != OK
                     // log_i ("free block list push_back failed, continuing anyway");
                     // it is not really important to return with an error here, keyValueDatabase can continue working with this error
                 }
+                #ifdef __KEY_VALUE_DATABASE_STATISTICS__
+                    __statistics__.deletes ++;
+                #endif
+                __autoMaintenance__ ();
                 // log_i ("OK");
                 Unlock ();  
                 return err_ok;
             }
 
+        public:
+
 
            /*
             *  [] operator enables key-valu database elements to be conveniently addressed by their keys like:
@@ -1225,21 +1869,69 @@
 
                 private:
                     keyValueDatabase *__parent__;
+                    // Proxy keeps a copy of the key, so it can outlive the key it has been given, like auto p = kvp [String ("key")]; p = value;
                     keyType __key__;
+                    // a String key given as characters is kept as characters (short ones without heap allocation), it is only converted to keyType if the value is written
+                    inlineString<> __charKey__;
+                    bool __byChars__ = false;
+                    bool __badKey__ = false; // NULL characters given as the key (or out of memory while copying them)
+
+                    signed char __findValue__ (valueType *value) const {
+                        if (__badKey__)
+                            return err_bad_alloc;
+                        if (__byChars__)
+                            return __findValue__ (value, __boolTag__<is_string<keyType>::value> ());
+                        return __parent__->FindValue (__key__, value);
+                    }
+
+                    signed char __upsert__ (const valueType& value) {
+                        if (__badKey__)
+                            return err_bad_alloc;
+                        if (__byChars__)
+                            return __upsert__ (value, __boolTag__<is_string<keyType>::value> ());
+                        return __parent__->Upsert (__key__, value);
+                    }
+
+                    // only String (or inlineString, prefixString) keys can be given as characters, the other keys never get here
+                    signed char __findValue__ (valueType *value, __boolTag__<true>) const { return __parent__->FindValue (__charKey__.c_str (), value); }
+                    signed char __findValue__ (valueType *, __boolTag__<false>) const { return err_bad_alloc; }
+
+                    signed char __upsert__ (const valueType& value, __boolTag__<true>) {
+                        keyType key;
+                        __stringAssign__ (key, __charKey__.c_str ());
+                        return __parent__->Upsert (key, value);
+                    }
+                    signed char __upsert__ (const valueType&, __boolTag__<false>) { return err_bad_alloc; }
 
                 public:
-                    Proxy (keyValueDatabase *parent, keyType *key) {
+                    Proxy (const char *key, keyValueDatabase *parent) { // only String keys can be given as characters (parameters are in reverse order so the constructor is different from the one below)
+                        __parent__ = parent;
+
+                        __charKey__ = inlineString<> (key); // NULL characters make it invalid
+                        __byChars__ = true;
+                        __badKey__ = !__charKey__;
+                        if (__badKey__) {
+                            // log_e ("String key construction error: err_bad_alloc");
+                            #ifdef __USE_KEY_VALUE_DATABASE_EXCEPTIONS__
+                                throw err_bad_alloc;
+                            #endif
+                            __parent__->__errorFlags__ |= err_bad_alloc;
+                        }
+
+                        __parent__->Lock ();
+                    }
+
+                    Proxy (keyValueDatabase *parent, const keyType *key) {
                         __parent__ = parent;
                         __key__ = *key;
 
-                        if (is_same<keyType, String>::value)                                                                          // if key is of type String ... (if anyone knows hot to do this in compile-time a feedback is welcome)
-                            if (!*(String *) &__key__) {                                                                               // ... check if parameter construction is valid
-                                // log_e ("String key construction error: err_bad_alloc");
-                                #ifdef __USE_KEY_VALUE_DATABASE_EXCEPTIONS__
-                                    throw err_bad_alloc;
-                                #endif
-                                __parent__->__errorFlags__ |= err_bad_alloc;
-                            }
+                        if (!__isKeyValid__ (__key__)) {                                                                               // check if String key parameter construction is valid
+                            // log_e ("String key construction error: err_bad_alloc");
+                            #ifdef __USE_KEY_VALUE_DATABASE_EXCEPTIONS__
+                                throw err_bad_alloc;
+                            #endif
+                            __parent__->__errorFlags__ |= err_bad_alloc;
+                        }
 
                         __parent__->Lock ();
                     }
@@ -1251,7 +1943,7 @@
                     // conversion operator to support reading
                     operator valueType () const {                
                         valueType value = {};
-                        signed char e = __parent__->FindValue (__key__, &value);
+                        signed char e = __findValue__ (&value);
                         if (e == err_not_found) // flag err_not_found
                             __parent__->__errorFlags__ |= err_not_found;
                         // DEBUG: Serial.print ("   find ["); Serial.print (__key__); Serial.print ("] = "); Serial.println (value);
@@ -1260,7 +1952,7 @@
                     }
 
                     // assignment operator to support writing
-                    Proxy& operator = (valueType value) {
+                    Proxy& operator = (const valueType& value) {
 
                         if (is_same<valueType, String>::value)                                                                        // if key is of type String ... (if anyone knows hot to do this in compile-time a feedback is welcome)
                             if (!*(String *) &value) {                                                                                 // ... check if parameter construction is valid
@@ -1273,14 +1965,14 @@
                             }
                             // DEBUG: Serial.print ("   assign ["); Serial.print (__key__); Serial.print ("] = "); Serial.println (value);
 
-                        __parent__->Upsert (__key__, value);
+                        __upsert__ (value);
                         return *this;
                     }
 
                     // prefix ++ operator
                     Proxy& operator ++ () {
                         valueType value = {};
-                        __parent__->FindValue (__key__, &value); // if error or not found we start with 0
+                        __findValue__ (&value); // if error or not found we start with 0
                         ++ value;
 
                         return operator = (value);
@@ -1296,7 +1988,7 @@
                     // prefix -- operator
                     Proxy& operator -- () {
                         valueType value = {};
-                        __parent__->FindValue (__key__, &value); // if error or not found we start with 0
+                        __findValue__ (&value); // if error or not found we start with 0
                         -- value;
 
                         return operator = (value);
@@ -1312,7 +2004,7 @@
                     template<typename T>
                     Proxy& operator += (T other) {
                         valueType value = {};
-                        if (__parent__->FindValue (__key__, &value)) // error or not found
+                        if (__findValue__ (&value)) // error or not found
                             return *this;
 
                         if (is_same<valueType, String>::value) {                                                                      // if key is of type String ... (if anyone knows hot to do this in compile-time a feedback is welcome)
@@ -1338,7 +2030,7 @@
                     template<typename T>
                     Proxy& operator -= (T other) {
                         valueType value = {};
-                        if (__parent__->FindValue (__key__, &value)) // error or not found
+                        if (__findValue__ (&value)) // error or not found
                             return *this;
 
                         value -= other;
@@ -1349,7 +2041,7 @@
                     template<typename T>
                     Proxy& operator *= (T other) {
                         valueType value = {};
-                        if (__parent__->FindValue (__key__, &value)) // error or not found
+                        if (__findValue__ (&value)) // error or not found
                             return *this;
 
                         value *= other;
@@ -1360,7 +2052,7 @@
                     template<typename T>
                     Proxy& operator /= (T other) {
                         valueType value = {};
-                        if (__parent__->FindValue (__key__, &value)) // error or not found
+                        if (__findValue__ (&value)) // error or not found
                             return *this;
 
                         value /= other;
@@ -1370,10 +2062,15 @@
             };
 
             // Implementation of operator []
-            Proxy operator [] (keyType key) {
+            Proxy operator [] (const keyType& key) {
                 return Proxy (this, &key);
             }
 
+            template <class K = keyType>
+            typename __charKeysOnly__<K, Proxy>::type operator [] (const char *key) {
+                return Proxy (key, this);
+            }
+
 
            /*
             *  Truncates key-value pairs, returns OK or one of the error codes.
@@ -1383,8 +2080,8 @@
                 // log_i ("()");
                 
                 Lock (); 
-                    if (__inIteration__) {
-                      // log_e ("not while iterating, error: err_cant_do_it_now");
+                    if (__inIteration__ || __inTransaction__) {
+                      // log_e ("not while iterating or in a transaction, error: err_cant_do_it_now");
                         #ifdef __USE_KEY_VALUE_DATABASE_EXCEPTIONS__
                             throw err_cant_do_it_now;
                         #endif
@@ -1395,6 +2092,15 @@
 
                     if (__dataFile__) __dataFile__.close (); 
 
+                    #ifdef __KEY_VALUE_DATABASE_SEGMENT_SIZE__
+                        // remove all the segment files but the first one, which will be truncated
+                        for (uint32_t segment = 1; fileSystem.exists (__segmentFileName__ (segment)); segment ++)
+                            fileSystem.remove (__segmentFileName__ (segment));
+                        __dataFileSegment__ = 0;
+                        __lastSegment__ = 0;
+                        __lastSegmentSize__ = 0;
+                    #endif
+
                     __dataFile__ = fileSystem.open (__dataFileName__, "w"); // , true);
                     if (__dataFile__) {
                         __dataFile__.close (); 
@@ -1409,8 +2115,9 @@
                     }
 
                     __dataFile__ = fileSystem.open (__dataFileName__, "r+"); // , false);
-                    if (!__dataFile__) {
+                    if (!__dataFile__ || !__writeFileHeader__ ()) {
                         // log_e ("data file open failed, error err_file_io");
+                        __dataFile__.close ();
                         #ifdef __USE_KEY_VALUE_DATABASE_EXCEPTIONS__
                             throw err_file_io;
                         #endif
@@ -1419,9 +2126,24 @@
                         return err_file_io;
                     }
 
-                    __dataFileSize__ = 0; 
-                    Map<keyType, uint32_t>::clear ();
+                    __dataFileSize__ = __fileHeaderSize__; 
+                    #ifdef __KEY_VALUE_DATABASE_SEGMENT_SIZE__
+                        __lastSegmentSize__ = __fileHeaderSize__;
+                    #endif
+                    #ifndef __KEY_VALUE_DATABASE_KEYS_ON_DISK__
+                        Map<keyType, blockOffsetType>::clear ();
+                    #else
+                        __fingerprintIndexSize__ = 0;
+                    #endif
+                    #ifdef __KEY_VALUE_DATABASE_BLOOM_FILTER_BITS_PER_KEY__
+                        __bloomFilterRebuild__ ();
+                    #endif
                     __freeBlocksList__.clear ();
+                    __maintenanceOffset__ = __fileHeaderSize__;
+                    __secondaryIndexesClear__ ();
+                    #ifdef __KEY_VALUE_DATABASE_TTL__
+                        __expiryHeap__.clear ();
+                    #endif
                 // log_i ("OK");
                 Unlock ();  
                 return err_ok;
@@ -1429,229 +2151,3346 @@
 
 
            /*
-            *  The following iterator overloading is needed so that the calling program can iterate with key-blockOffset pair instead of key-value (value holding the blockOffset) pair.
-            *  
-            *  Unfortunately iterator's * oprator returns a pointer reather than the reference so the calling program should use "->key" instead of ".key" when
-            *  refering to key (and blockOffset):
-            *
-            *      for (auto p: pkvpA) {
-            *          // keys are always kept in memory and are obtained fast
-            *          Serial.print (p->key); Serial.print (", "); Serial.print (p->blockOffset); Serial.print (" -> "); 
-            *          
-            *          // values are read from disk, obtaining a value may be much slower
-            *          String value;
-            *          keyValueDatabase<int, String>::errorCode e = pkvpA.FindValue (p->key, &value, p->blockOffset);
-            *          if (e == pkvpA.OK) 
-            *              Serial.println (value);
-            *          else
-            *              Serial.printf ("Error: %s\n", pkvpA.errorCodeText (e));
-            *      }
+            *  Checks the blocks of a data file that is not opened (before Open or after Close) and with repair marks the bad ones as free, so that Open
+            *  can load the rest of the key-value pairs (the ones in bad blocks are lost). A block is bad if its size doesn't make sense, if its key
+            *  and value don't fit into it or, with __KEY_VALUE_DATABASE_CHECKSUM__, if its checksum is wrong. Returns OK if no bad blocks are found
+            *  (or they have been repaired), err_data_changed if they haven't been repaired or one of the other error codes. badBlocks, if given,
+            *  gets the number of bad places found.
             */
 
-            struct keyBlockOffsetPair {
-                keyType key;          // key
-                uint32_t blockOffset; // __dataFile__ offset of block containing both: key-value pair
-            };        
+            signed char Verify (const char *dataFileName, bool repair = false, uint32_t *badBlocks = NULL) {
+                // log_i ("(dataFileName, repair)");
+                Lock ();
+                if (__dataFile__) {
+                    // log_e ("data file is opened error: err_cant_do_it_now");
+                    #ifdef __USE_KEY_VALUE_DATABASE_EXCEPTIONS__
+                        throw err_cant_do_it_now;
+                    #endif
+                    __errorFlags__ |= err_cant_do_it_now;
+                    Unlock (); 
+                    return err_cant_do_it_now;
+                }
 
-            class iterator : public Map<keyType, uint32_t>::iterator {
-                public:
-            
-                    // there are 2 cases when constructor gets called: begin (pointToFirstPair = true) and end (pointToFirstPair = false) 
-                    iterator (keyValueDatabase* pkvp, bool pointToFirstPair) : Map<keyType, uint32_t>::iterator (pkvp, pointToFirstPair) {
-                        __pkvp__ = pkvp;
+                uint32_t bad = 0;
+                signed char e = err_ok;
+                strcpy (__dataFileName__, dataFileName);
+                #ifdef __KEY_VALUE_DATABASE_SEGMENT_SIZE__
+                    for (uint32_t segment = 0; !e && fileSystem.exists (__segmentFileName__ (segment)); segment ++) {
+                        if (!__openSegment__ (segment))
+                            e = err_file_io;
+                        else if (segment > 0)
+                            e = __verifyFile__ (0, repair, bad);
+                        else if (!(e = __verifyFileHeader__ ()))
+                            e = __verifyFile__ (__hasFileHeader__ () ? __fileHeaderSize__ : 0, repair, bad); // a data file without the header (not upgraded yet) has blocks from the start
                     }
-
-                    ~iterator () {
-                        if (__pkvp__) {
-                            __pkvp__->__inIteration__ --;
-                            // DEBUG: Serial.print ("   stopped itetating, count = "); Serial.println (__pkvp__->__inIteration__);
-                            __pkvp__->Unlock (); 
-                        }
+                #else
+                    if (fileSystem.exists (dataFileName)) {
+                        __dataFile__ = fileSystem.open (dataFileName, "r+");
+                        if (!__dataFile__)
+                            e = err_file_io;
+                        else if (!(e = __verifyFileHeader__ ()))
+                            e = __verifyFile__ (__hasFileHeader__ () ? __fileHeaderSize__ : 0, repair, bad); // a data file without the header (not upgraded yet) has blocks from the start
                     }
+                #endif
+                __dataFile__.close ();
 
-                    keyBlockOffsetPair& operator * () { return (keyBlockOffsetPair&) Map<keyType, uint32_t>::iterator::operator *(); }
-
-                    // this will tell if iterator is valid (if there are not elements the iterator can not be valid)
-                    operator bool () const { return __pkvp__->size () > 0; }
+                if (badBlocks) 
+                    *badBlocks = bad;
+                if (!e && bad && !repair)
+                    e = err_data_changed;
+                if (e) { // != OK
+                    // log_e ("verify error");
+                    #ifdef __USE_KEY_VALUE_DATABASE_EXCEPTIONS__
+                        throw e;
+                    #endif
+                    __errorFlags__ |= e;
+                }
+                Unlock (); 
+                return e;
+            }
 
 
-                private:
-          
-                    keyValueDatabase* __pkvp__ = NULL;
+           /*
+            *  Shows how the slack in the blocks of String values works: how many updates (since Open) fitted into their blocks and how many needed a new one,
+            *  the slack the new blocks get now and how many bytes of the used blocks are slack. The last two numbers are counted by reading all the blocks.
+            */
 
+            struct slackStatistics {
+                uint32_t inPlaceUpdates;    // updates that fitted into their blocks
+                uint32_t relocations;       // updates that needed a new block
+                float pctFree;              // the slack new blocks of String values get now (the share of the value size)
+                uint32_t usedBytes;         // the size of all used blocks
+                uint32_t slackBytes;        // the free space at the end of the used blocks
             };
 
-            iterator begin () { // since only the begin () instance is neede for iteration we'll do the locking here
-                Lock (); // Unlock () will be called in instance destructor
-                __inIteration__ ++; // -- will be called in instance destructor
-                // DEBUG: Serial.print ("   startted itetating (begin), count = "); Serial.println (__inIteration__);
-                return iterator (this, true); 
-            } 
+            signed char SlackStatistics (slackStatistics& statistics) {
+                // log_i ("(statistics)");
+                if (!__dataFile__) { 
+                    // log_e ("error, data file not opened: err_file_io");
+                    #ifdef __USE_KEY_VALUE_DATABASE_EXCEPTIONS__
+                        throw err_file_io;
+                    #endif
+                    __errorFlags__ |= err_file_io;
+                    return err_file_io; 
+                }
 
-            iterator end () { 
-                Lock (); // Unlock () will be called in instance destructor
-                __inIteration__ ++; // -- will be called in instance destructor
-                // DEBUG: Serial.print ("   startted itetating (end), count = "); Serial.println (__inIteration__);
-                return iterator (this, false); 
-            } 
+                Lock (); 
+                uint64_t usedBytes;
+                uint64_t slackBytes;
+                signed char e = __scanBlocks__ (usedBytes, slackBytes);
+                statistics = { __inPlaceUpdates__, __relocations__, __pctFree__, (uint32_t) usedBytes, (uint32_t) slackBytes };
+                Unlock (); 
+                return e;
+            }
 
 
            /*
-            *  Finds min and max keys in keyValueDatabase.
+            *  Shows how the data file is used, like:
             *
-            *  Example:
-            *  
-            *    auto firstElement = pkvpA.first_element ();
-            *    if (firstElement) // check if first element is found (if pkvpA is not empty)
-            *        Serial.printf ("first element (min key) of pkvpA = %i\n", (*firstElement)->key);
+            *    keyValueDatabase<int, String>::spaceReport r;
+            *    if (settings.SpaceReport (r) == err_ok)
+            *        Serial.printf ("%.2f times the live data, %lu bytes in %lu free blocks\n", r.amplification, (unsigned long) r.freeBytes, (unsigned long) r.freeBlocks);
+            *
+            *  The live bytes and the slack are counted by reading all the blocks, the rest is taken from memory. The append rates are the bytes of the blocks added at the
+            *  end of the data file per second, which shows how soon the flash disk will be full if the free blocks can't take the new data.
             */
 
-          iterator first_element () { 
-              Lock (); // Unlock () will be called in instance destructor
-              __inIteration__ ++; // -- will be called in instance destructor
-              return iterator (this, this->height ());  // call the 'begin' constructor
-          }
+            struct spaceReport {
+                uint64_t fileBytes;             // the size of the data file (all the segment files together), with its header
+                uint64_t liveBytes;             // the used blocks without their slack
+                uint64_t slackBytes;            // the free space at the end of the used blocks (see __KEY_VALUE_DATABASE_PCT_FREE__)
+                uint64_t freeBytes;             // the size of the free blocks
+                uint32_t freeBlocks;
+                uint32_t largestFreeBlock;
+                uint32_t freeBlockSizes [16];   // [i] counts the free blocks from 2^i to 2^(i+1) - 1 bytes
+                float amplification;            // fileBytes / liveBytes
+                float appendRate;               // bytes appended per second since the previous SpaceReport (or Open)
+                float averageAppendRate;        // bytes appended per second since Open
+            };
 
-          iterator last_element () {
-              Lock (); // Unlock () will be called in instance destructor
-              __inIteration__ ++; // -- will be called in instance destructor
-              return iterator (this->height (), this);  // call the 'end' constructor
-          }
+            signed char SpaceReport (spaceReport& report) {
+                // log_i ("(report)");
+                if (!__dataFile__) { 
+                    // log_e ("error, data file not opened: err_file_io");
+                    #ifdef __USE_KEY_VALUE_DATABASE_EXCEPTIONS__
+                        throw err_file_io;
+                    #endif
+                    __errorFlags__ |= err_file_io;
+                    return err_file_io; 
+                }
+
+                Lock (); 
+                report = {};
+                uint64_t usedBytes;
+                signed char e = __scanBlocks__ (usedBytes, report.slackBytes);
+                if (e) { // != OK
+                    Unlock (); 
+                    return e;
+                }
+                report.fileBytes = __dataFileSize__;
+                report.liveBytes = usedBytes - report.slackBytes;
+                for (auto& f: __freeBlocksList__) {
+                    report.freeBytes += f.blockSize;
+                    report.freeBlocks ++;
+                    if ((uint32_t) f.blockSize > report.largestFreeBlock)
+                        report.largestFreeBlock = f.blockSize;
+                    int i = 0;
+                    while (i < 15 && (f.blockSize >> (i + 1)))
+                        i ++;
+                    report.freeBlockSizes [i] ++;
+                }
+                report.amplification = report.liveBytes ? (float) report.fileBytes / report.liveBytes : 0;
+                unsigned long now = millis ();
+                if (now != __lastSpaceReportMillis__)
+                    report.appendRate = (float) (__appendedBytes__ - __lastSpaceReportAppendedBytes__) * 1000 / (now - __lastSpaceReportMillis__);
+                if (now != __openedMillis__)
+                    report.averageAppendRate = (float) __appendedBytes__ * 1000 / (now - __openedMillis__);
+                __lastSpaceReportMillis__ = now;
+                __lastSpaceReportAppendedBytes__ = __appendedBytes__;
+                Unlock (); 
+                return err_ok;
+            }
 
 
            /*
-            * Locking mechanism
+            *  Does the next slice of the maintenance pass through the data file, it examines at most maxBlocks blocks from where the previous step stopped:
+            *
+            *    - it merges the neighbouring free blocks into a single one (up to the maximum block size),
+            *    - if compact, it also moves a used block that follows the free space into it, if it fits, so that the free space moves on towards the end of the data file.
+            *      A block is moved by copying it into the free space (still marked as free) and then swapping the block sizes through the transaction journal,
+            *      so a reset in the middle leaves either the old or the new block used. The block offsets obtained before the step may not be valid any more.
+            *
+            *  passCompleted, if given, is set when the step has reached the end of the data file (the next step starts from the beginning again).
+            *  The step can't be done while iterating or in a transaction (err_cant_do_it_now).
             */
 
-            void Lock () { 
-                #ifdef SEMAPHORE_H // RTOS is running beneath Arduino sketch, multitasking (and semaphores) is supported
-                    xSemaphoreTakeRecursive (__semaphore__, portMAX_DELAY); 
-                #endif
-            } 
+            signed char MaintenanceStep (int maxBlocks, bool compact = false, bool *passCompleted = NULL) {
+                // log_i ("(maxBlocks, compact, passCompleted)");
+                if (!__dataFile__) { 
+                    // log_e ("error, data file not opened: err_file_io");
+                    #ifdef __USE_KEY_VALUE_DATABASE_EXCEPTIONS__
+                        throw err_file_io;
+                    #endif
+                    __errorFlags__ |= err_file_io;
+                    return err_file_io; 
+                }
 
-            void Unlock () { 
-                #ifdef SEMAPHORE_H // RTOS is running beneath Arduino sketch, multitasking (and semaphores) is supported
-                    xSemaphoreGiveRecursive (__semaphore__); 
-                #endif
+                Lock (); 
+                if (__inIteration__ || __inTransaction__ || __inIndexSearch__) {
+                    // log_e ("not while iterating or in a transaction, error: err_cant_do_it_now");
+                    #ifdef __USE_KEY_VALUE_DATABASE_EXCEPTIONS__
+                        throw err_cant_do_it_now;
+                    #endif
+                    __errorFlags__ |= err_cant_do_it_now;
+                    Unlock (); 
+                    return err_cant_do_it_now;
+                }
+                signed char e = __maintenanceStep__ (maxBlocks, compact, passCompleted);
+                if (e) { // != OK
+                    // log_e ("maintenance step error");
+                    #ifdef __USE_KEY_VALUE_DATABASE_EXCEPTIONS__
+                        throw e;
+                    #endif
+                    __errorFlags__ |= e;
+                }
+                Unlock (); 
+                return e;
             }
 
 
-        private:
-
-            char __dataFileName__ [255] = "";
-            File __dataFile__;
-            unsigned long __dataFileSize__ = 0;
+           /*
+            *  Lets Delete, the Updates that move the value into a new block and Commit do a MaintenanceStep by themselves, when the data file gets too large for the
+            *  blocks it contains, like:
+            *
+            *    settings.SetMaintenancePolicy ( {1.5, 2.0, 16, 8} ); // check after every 8 of them, merge free blocks above 1.5 and compact above 2 times
+            *
+            *  The amplification checked is the size of the data file divided by the size of its used blocks (with their slack), which is known without reading the disk.
+            *  Each step examines at most blocksPerStep blocks, so the operation that does it doesn't take much longer. Errors of these steps are only set in errorFlags.
+            */
 
-            struct freeBlockType {
-                uint32_t blockOffset;
-                int16_t blockSize;
+            struct maintenancePolicy {
+                float coalesceAbove;    // merge the neighbouring free blocks above this amplification, 0 = never
+                float compactAbove;     // also move the used blocks into the free space before them above this amplification, 0 = never
+                uint16_t blocksPerStep; // at most this many blocks are examined by a step
+                uint16_t checkEvery;    // the amplification is checked after every checkEvery Deletes, moving Updates and Commits
             };
-            vector<freeBlockType> __freeBlocksList__;
 
-            #ifdef SEMAPHORE_H // RTOS is running beneath Arduino sketch, multitasking (and semaphores) is supported
-                SemaphoreHandle_t __semaphore__ = xSemaphoreCreateRecursiveMutex (); 
-            #endif
-            int __inIteration__ = 0;
+            void SetMaintenancePolicy (const maintenancePolicy& policy) {
+                Lock (); 
+                __maintenancePolicy__ = policy;
+                __maintenanceChecks__ = 0;
+                Unlock (); 
+            }
 
-            // som boards do no thave is_same implemented, so we have to imelement it ourselves: https://stackoverflow.com/questions/15200516/compare-typedef-is-same-type
-            template<typename T, typename U> struct is_same { static const bool value = false; };
-            template<typename T> struct is_same<T, T> { static const bool value = true; };
 
-            
            /*
-            *  Reads the value from __dataFile__.
-            *  
-            *  Returns success, in case of error it also sets lastErrorCode.
+            *  Returns what the database has done since Open, if __KEY_VALUE_DATABASE_STATISTICS__ is #defined, like:
             *
-            *  This function does not handle the __semaphore__.
+            *    auto stats = settings.Stats ();
+            *    Serial.printf ("%lu bytes written in %lu flushes\n", (unsigned long) stats.bytesWritten, (unsigned long) stats.flushes);
+            *
+            *  Lookups are counted by FindBlockOffset, FindValue and WithValue, also when the Update and Upsert with callback functions and the [] operator
+            *  call them. Inserts, updates and deletes of a transaction are counted when it is committed, its updates always need new blocks.
             */
 
+          #ifdef __KEY_VALUE_DATABASE_STATISTICS__
+
+            struct statistics {
+                uint32_t lookups;
+                uint32_t hits;                  // lookups that found the key
+                uint32_t misses;                // lookups that returned err_not_found
+                uint32_t inserts;
+                uint32_t inPlaceUpdates;        // updates that fitted into their blocks
+                uint32_t relocatingUpdates;     // updates that needed a new block
+                uint32_t deletes;
+                uint32_t flushes;
+                uint64_t bytesRead;             // from the data file
+                uint64_t bytesWritten;          // to the data file and the transaction journal
+                uint32_t freeBlocks;            // the length of the free block list
+                uint32_t freeBytes;             // the size of all free blocks
+                float fragmentation;            // the share of the data file taken by free blocks
+                uint64_t lockWaitMicros;        // how long the tasks have waited for the lock, all together
+                uint32_t maxLockHoldMicros;     // the longest time the lock has been held
+                uint32_t openMillis;            // how long Open took
+            };
 
-            signed char __readBlock__ (int16_t& blockSize, keyType& key, valueType& value, uint32_t blockOffset, bool skipReadingValue = false) {
-                // reposition file pointer to the beginning of a block
-                if (!__dataFile__.seek (blockOffset, SeekSet)) {
-                    // log_e ("seek error err_file_io");
-                    #ifdef __USE_KEY_VALUE_DATABASE_EXCEPTIONS__
-                        throw err_file_io;
-                    #endif
-                    __errorFlags__ |= err_file_io;
-                    return err_file_io;
+            statistics Stats () {
+                Lock ();
+                statistics stats = __statistics__;
+                stats.inPlaceUpdates = __inPlaceUpdates__;
+                stats.relocatingUpdates = __relocations__;
+                stats.freeBlocks = __freeBlocksList__.size ();
+                for (auto& f: __freeBlocksList__)
+                    stats.freeBytes += f.blockSize;
+                stats.fragmentation = __dataFileSize__ ? (float) stats.freeBytes / __dataFileSize__ : 0;
+                Unlock ();
+                return stats;
+            }
+
+          #endif
+
+
+           /*
+            *  The operations that are timed: FindValue, Insert, Update and Delete, each from the call until the return, including the wait for the lock, and the
+            *  wait for the lock itself (only the outermost Lock of a task is timed). Each call is timed once: Update with a callback function is timed as an Update
+            *  (with the lookup it does), Upsert as an Insert or an Update, depending on what it has done.
+            */
+
+            enum traceOperation { traceFindValue, traceInsert, traceUpdate, traceDelete, traceLockWait, traceOperations };
+
+
+           /*
+            *  If __KEY_VALUE_DATABASE_LATENCY_HISTOGRAMS__ is #defined each operation has a histogram of its latencies since Open (or ClearLatencyHistograms),
+            *  with log2 sized buckets, so it takes a fixed amount of memory and recording a latency doesn't allocate anything. The flash erase stalls that the
+            *  averages would hide show up in the upper buckets, like:
+            *
+            *    auto h = settings.LatencyHistogram (settings.traceUpdate);
+            *    Serial.printf ("99 %% of Updates take less than %lu us, the longest one took %lu us\n", (unsigned long) h.percentile (0.99), (unsigned long) h.maxMicros);
+            *
+            *  LatencyReport writes all the histograms as text or JSON into the buffer (for a debug web page for example) and returns the number of characters
+            *  written (without closing 0). The report is cut off if the buffer is too small, about 200 bytes per operation are always enough.
+            */
+
+          #ifdef __KEY_VALUE_DATABASE_LATENCY_HISTOGRAMS__
+
+            struct latencyHistogram {
+                uint32_t count;
+                uint32_t maxMicros;
+                uint32_t buckets [__KEY_VALUE_DATABASE_LATENCY_BUCKETS__]; // bucket i counts the latencies < 2^(i+1) us (and >= 2^i, except for bucket 0), the last one also all the longer ones
+
+                void record (uint32_t latency) {
+                    int i = 0;
+                    for (uint32_t m = latency >> 1; m && i < __KEY_VALUE_DATABASE_LATENCY_BUCKETS__ - 1; m >>= 1)
+                        i ++;
+                    buckets [i] ++;
+                    count ++;
+                    if (latency > maxMicros)
+                        maxMicros = latency;
                 }
 
-                // read block size
-                if (__dataFile__.read ((uint8_t *) &blockSize, sizeof (int16_t)) != sizeof (blockSize)) {
-                    // log_e ("read block size error err_file_io");
-                    #ifdef __USE_KEY_VALUE_DATABASE_EXCEPTIONS__
-                        throw err_file_io;
-                    #endif
-                    __errorFlags__ |= err_file_io;                    
-                    return err_file_io;
+                // returns the upper bound of the bucket in which the fraction (0.5 for median, 0.99, ...) of the latencies is reached (or maxMicros, if it is smaller)
+                uint32_t percentile (float fraction) const {
+                    uint32_t reached = 0;
+                    for (int i = 0; i < __KEY_VALUE_DATABASE_LATENCY_BUCKETS__; i ++) {
+                        reached += buckets [i];
+                        if (reached && reached >= fraction * count)
+                            return i < __KEY_VALUE_DATABASE_LATENCY_BUCKETS__ - 1 && ((uint32_t) 2 << i) < maxMicros ? (uint32_t) 2 << i : maxMicros;
+                    }
+                    return maxMicros;
                 }
-                // if block is free the reading is already done
-                if (blockSize < 0) { 
-                    // log_i ("OK");
+            };
+
+            latencyHistogram LatencyHistogram (traceOperation operation) {
+                Lock ();
+                latencyHistogram histogram = __latencyHistograms__ [operation];
+                Unlock ();
+                return histogram;
+            }
+
+            void ClearLatencyHistograms () {
+                Lock ();
+                memset (__latencyHistograms__, 0, sizeof (__latencyHistograms__));
+                Unlock ();
+            }
+
+            size_t LatencyReport (char *buffer, size_t size, bool json = false) {
+                static const char *operationName [traceOperations] = { "FindValue", "Insert", "Update", "Delete", "LockWait" };
+                if (!size)
+                    return 0;
+                buffer [0] = 0;
+                size_t length = 0;
+                Lock ();
+                if (json)
+                    __reportAppend__ (buffer, size, length, "{");
+                for (int o = 0; o < traceOperations; o ++) {
+                    const latencyHistogram& h = __latencyHistograms__ [o];
+                    if (json) {
+                        __reportAppend__ (buffer, size, length, "%s\"%s\":{\"count\":%lu,\"maxMicros\":%lu,\"p50\":%lu,\"p99\":%lu,\"buckets\":[", o ? "," : "", operationName [o], 
+                                          (unsigned long) h.count, (unsigned long) h.maxMicros, (unsigned long) h.percentile (0.5), (unsigned long) h.percentile (0.99));
+                        for (int i = 0; i < __KEY_VALUE_DATABASE_LATENCY_BUCKETS__; i ++)
+                            __reportAppend__ (buffer, size, length, i ? ",%lu" : "%lu", (unsigned long) h.buckets [i]);
+                        __reportAppend__ (buffer, size, length, "]}");
+                    } else {
+                        __reportAppend__ (buffer, size, length, "%s: %lu, max %lu us, 50 %% < %lu us, 99 %% < %lu us\r\n", operationName [o], 
+                                          (unsigned long) h.count, (unsigned long) h.maxMicros, (unsigned long) h.percentile (0.5), (unsigned long) h.percentile (0.99));
+                        for (int i = 0; i < __KEY_VALUE_DATABASE_LATENCY_BUCKETS__; i ++)
+                            if (h.buckets [i]) {
+                                if (i < __KEY_VALUE_DATABASE_LATENCY_BUCKETS__ - 1)
+                                    __reportAppend__ (buffer, size, length, "   < %lu us: %lu\r\n", (unsigned long) 2 << i, (unsigned long) h.buckets [i]);
+                                else
+                                    __reportAppend__ (buffer, size, length, "   >= %lu us: %lu\r\n", (unsigned long) 1 << i, (unsigned long) h.buckets [i]);
+                            }
+                    }
+                }
+                if (json)
+                    __reportAppend__ (buffer, size, length, "}");
+                Unlock ();
+                return length;
+            }
+
+          #endif
+
+
+           /*
+            *  If __KEY_VALUE_DATABASE_TRACE__ is #defined the trace callback function (if it is set, NULL clears it) is called after each operation with
+            *  the operation, its latency and the error code it has returned, like:
+            *
+            *    void traceSlow (keyValueDatabase<String, String>::traceOperation operation, uint32_t micros, signed char e) { if (micros > 100000) Serial.printf ("slow operation %i: %lu us\n", operation, (unsigned long) micros); }
+            *    ...
+            *    settings.SetTraceCallback (traceSlow);
+            *
+            *  The callback is called while the database is still locked, so it should be short and it must not use the database.
+            */
+
+          #ifdef __KEY_VALUE_DATABASE_TRACE__
+
+            void SetTraceCallback (void (*traceCallback) (traceOperation operation, uint32_t micros, signed char e)) {
+                Lock ();
+                __traceCallback__ = traceCallback;
+                Unlock ();
+            }
+
+          #endif
+
+
+          #ifdef __KEY_VALUE_DATABASE_TTL__
+
+           /*
+            *  Sets the time-to-live of the key to ttl seconds from now (0 = never expires), returns OK or one of the error codes. Only the expiry time in the
+            *  key's block gets written, so refreshing session tokens, for example, is cheap.
+            */
+
+            signed char SetTTL (const keyType& key, uint32_t ttl) {
+                // log_i ("(key, ttl)");
+                if (!__dataFile__) { 
+                    // log_e ("error, data file not opened: err_file_io");
+                    #ifdef __USE_KEY_VALUE_DATABASE_EXCEPTIONS__
+                        throw err_file_io;
+                    #endif
+                    __errorFlags__ |= err_file_io;
+                    return err_file_io; 
+                }
+
+                if (!__isKeyValid__ (key)) {                                                                                   // check if String key parameter construction is valid
+                    // log_e ("String key construction error: err_bad_alloc");
+                    #ifdef __USE_KEY_VALUE_DATABASE_EXCEPTIONS__
+                        throw err_bad_alloc;
+                    #endif
+                    __errorFlags__ |= err_bad_alloc;
+                    return err_bad_alloc;
+                }
+
+                Lock (); 
+                if (__inTransaction__) {
+                    // log_e ("not in a transaction, error: err_cant_do_it_now");
+                    #ifdef __USE_KEY_VALUE_DATABASE_EXCEPTIONS__
+                        throw err_cant_do_it_now;
+                    #endif
+                    __errorFlags__ |= err_cant_do_it_now;
+                    Unlock (); 
+                    return err_cant_do_it_now;
+                }
+
+                blockOffsetType *pBlockOffset;
+                int16_t blockSize;
+                const char *data;
+                size_t length;
+                signed char e = __findBlockValue__ (key, pBlockOffset, blockSize, data, length); // err_not_found is not flagged, just returned
+                if (!e && __isExpired__ ())
+                    e = err_not_found;
+                if (e) { // != OK
+                    Unlock ();  
+                    return e;
+                }
+
+                uint32_t expires = ttl ? __now__ () + ttl : 0;
+                #ifdef __KEY_VALUE_DATABASE_CHECKSUM__
+                    // the checksum follows the expiry time, so they are written together, the key and the value are still in __readBuffer__
+                    size_t dataLength;
+                    __storedDataLength__ (blockSize - __blockHeaderSize__, dataLength); // the block has just been read, so it fits
+                    uint32_t header [2] = { expires, __blockChecksum__ (blockSize, expires, __readBuffer__, dataLength) };
+                #else
+                    uint32_t header [1] = { expires };
+                #endif
+                if (!__seek__ (*pBlockOffset + sizeof (int16_t)) || __write__ ((byte *) header, sizeof (header)) != sizeof (header)) {
+                    // log_e ("seek or write error: err_file_io");
+                    #ifdef __USE_KEY_VALUE_DATABASE_EXCEPTIONS__
+                        throw err_file_io;
+                    #endif
+                    __errorFlags__ |= err_file_io;
+                    Unlock ();  
+                    return err_file_io;
+                }
+                __flush__ ();
+                if (expires)
+                    __expiryHeapPush__ (expires, *pBlockOffset); // the previous entry (if there is one) no longer matches the block's expiry time, so it will be skipped
+                Unlock ();  
+                return err_ok;
+            }
+
+
+           /*
+            *  Deletes expired keys, at most maxKeys of expiry heap entries are processed, so the database is only locked for a short time. It can be called
+            *  periodically, from loop () for example. The number of keys deleted is stored into expiredKeys, if it is not NULL. Returns OK or one of the error codes.
+            */
+
+            signed char ExpireStep (int maxKeys, int *expiredKeys = NULL) {
+                // log_i ("(maxKeys)");
+                if (expiredKeys)
+                    *expiredKeys = 0;
+                if (!__dataFile__) { 
+                    // log_e ("error, data file not opened: err_file_io");
+                    #ifdef __USE_KEY_VALUE_DATABASE_EXCEPTIONS__
+                        throw err_file_io;
+                    #endif
+                    __errorFlags__ |= err_file_io;
+                    return err_file_io; 
+                }
+
+                Lock (); 
+                if (__inIteration__ || __inTransaction__) {
+                    // log_e ("not while iterating or in a transaction, error: err_cant_do_it_now");
+                    #ifdef __USE_KEY_VALUE_DATABASE_EXCEPTIONS__
+                        throw err_cant_do_it_now;
+                    #endif
+                    __errorFlags__ |= err_cant_do_it_now;
+                    Unlock (); 
+                    return err_cant_do_it_now;
+                }
+
+                uint32_t now = __now__ ();
+                for (int i = 0; i < maxKeys && __expiryHeap__.size () && __expiryHeap__ [0].expires <= now; i ++) {
+                    __expiryEntry__ entry = __expiryHeap__ [0];
+                    __expiryHeapPop__ ();
+
+                    // the entry is stale if the block has been freed (or reused) or its expiry time has changed since
+                    int16_t blockSize;
+                    keyType key;
+                    valueType value;
+                    signed char e = __readBlock__ (blockSize, key, value, entry.blockOffset, true);
+                    if (e) { // != OK
+                        Unlock (); 
+                        return e;
+                    }
+                    if (blockSize > 0 && __lastExpires__ == entry.expires) {
+                        e = __delete__ (key); // not timed or traced, the application hasn't called Delete
+                        if (e) { // != OK
+                            Unlock (); 
+                            return e;
+                        }
+                        if (expiredKeys)
+                            (*expiredKeys) ++;
+                    }
+                }
+
+                Unlock (); 
+                return err_ok;
+            }
+
+          #endif
+
+
+           /*
+            *  Transactions make more changes atomic, even if the controller resets in the middle of writing them, like:
+            *
+            *    settings.Begin ();
+            *    settings.Update ("SSID", newSSID);
+            *    settings.Update ("password", newPassword);
+            *    if (settings.Commit () != err_ok) ... // either both or none of them are changed
+            *
+            *  Begin locks the database until Commit or Rollback, which have to be called by the same task. Insert, Update and Delete in between are checked
+            *  and staged in memory, then Commit writes them all with a constant number of flushes, regardless of the number of keys. Reading functions still
+            *  return the committed values until then. Truncate, SetTTL and ExpireStep can't be used in a transaction. All return OK or one of the error codes.
+            */
+
+            signed char Begin () {
+                // log_i ("()");
+                if (!__dataFile__) { 
+                    // log_e ("error, data file not opened: err_file_io");
+                    #ifdef __USE_KEY_VALUE_DATABASE_EXCEPTIONS__
+                        throw err_file_io;
+                    #endif
+                    __errorFlags__ |= err_file_io;
+                    return err_file_io; 
+                }
+
+                Lock (); // the lock is kept until Commit or Rollback
+                if (__inTransaction__ || __inIteration__) {
+                    // log_e ("already in a transaction or iterating, error: err_cant_do_it_now");
+                    #ifdef __USE_KEY_VALUE_DATABASE_EXCEPTIONS__
+                        throw err_cant_do_it_now;
+                    #endif
+                    __errorFlags__ |= err_cant_do_it_now;
+                    Unlock (); 
+                    return err_cant_do_it_now;
+                }
+                __inTransaction__ = true;
+                return err_ok;
+            }
+
+            signed char Commit () {
+                // log_i ("()");
+                Lock (); 
+                if (!__inTransaction__) {
+                    // log_e ("not in a transaction, error: err_cant_do_it_now");
+                    #ifdef __USE_KEY_VALUE_DATABASE_EXCEPTIONS__
+                        throw err_cant_do_it_now;
+                    #endif
+                    __errorFlags__ |= err_cant_do_it_now;
+                    Unlock (); 
+                    return err_cant_do_it_now;
+                }
+                signed char e = __commit__ ();
+                __transaction__.clear ();
+                __inTransaction__ = false;
+                if (!e)
+                    __autoMaintenance__ ();
+                Unlock (); // Begin's lock
+                Unlock (); 
+                return e;
+            }
+
+            signed char Rollback () {
+                // log_i ("()");
+                Lock (); 
+                if (!__inTransaction__) {
+                    // log_e ("not in a transaction, error: err_cant_do_it_now");
+                    #ifdef __USE_KEY_VALUE_DATABASE_EXCEPTIONS__
+                        throw err_cant_do_it_now;
+                    #endif
+                    __errorFlags__ |= err_cant_do_it_now;
+                    Unlock (); 
+                    return err_cant_do_it_now;
+                }
+                __transaction__.clear ();
+                __inTransaction__ = false;
+                Unlock (); // Begin's lock
+                Unlock (); 
+                return err_ok;
+            }
+
+
+           /*
+            *  The following iterator overloading is needed so that the calling program can iterate with key-blockOffset pair instead of key-value (value holding the blockOffset) pair.
+            *  
+            *  Unfortunately iterator's * oprator returns a pointer reather than the reference so the calling program should use "->key" instead of ".key" when
+            *  refering to key (and blockOffset):
+            *
+            *      for (auto p: pkvpA) {
+            *          // keys are always kept in memory and are obtained fast
+            *          Serial.print (p->key); Serial.print (", "); Serial.print (p->blockOffset); Serial.print (" -> "); 
+            *          
+            *          // values are read from disk, obtaining a value may be much slower
+            *          String value;
+            *          keyValueDatabase<int, String>::errorCode e = pkvpA.FindValue (p->key, &value, p->blockOffset);
+            *          if (e == pkvpA.OK) 
+            *              Serial.println (value);
+            *          else
+            *              Serial.printf ("Error: %s\n", pkvpA.errorCodeText (e));
+            *      }
+            */
+
+            struct keyBlockOffsetPair {
+                keyType key;          // key
+                blockOffsetType blockOffset; // __dataFile__ offset of block containing both: key-value pair
+            };        
+
+            #ifndef __KEY_VALUE_DATABASE_KEYS_ON_DISK__
+
+                class iterator : public Map<keyType, blockOffsetType>::iterator {
+                    public:
+                
+                        // there are 2 cases when constructor gets called: begin (pointToFirstPair = true) and end (pointToFirstPair = false) 
+                        iterator (keyValueDatabase* pkvp, bool pointToFirstPair) : Map<keyType, blockOffsetType>::iterator (pkvp, pointToFirstPair) {
+                            __pkvp__ = pkvp;
+                        }
+
+                        // positioned by lower_bound, upper_bound, floor or ceiling
+                        iterator (keyValueDatabase* pkvp, const typename Map<keyType, blockOffsetType>::iterator& it) : Map<keyType, blockOffsetType>::iterator (it) {
+                            __pkvp__ = pkvp;
+                        }
+
+                        ~iterator () {
+                            if (__pkvp__) {
+                                __pkvp__->__inIteration__ --;
+                                // DEBUG: Serial.print ("   stopped itetating, count = "); Serial.println (__pkvp__->__inIteration__);
+                                __pkvp__->Unlock (); 
+                            }
+                        }
+
+                        keyBlockOffsetPair& operator * () { return (keyBlockOffsetPair&) Map<keyType, blockOffsetType>::iterator::operator *(); }
+
+                        // this will tell if iterator is valid (if there are not elements the iterator can not be valid)
+                        operator bool () const { return __pkvp__->size () > 0; }
+
+
+                    private:
+              
+                        keyValueDatabase* __pkvp__ = NULL;
+
+                };
+
+            #else
+
+               /*
+                *  With keys on disk the iterator goes through the fingerprint index and reads each key from its block, so keys are not obtained fast
+                *  and they do not come in key order.
+                */
+
+                class iterator {
+                    public:
+
+                        iterator (keyValueDatabase* pkvp, int position) {
+                            __pkvp__ = pkvp;
+                            __position__ = position;
+                        }
+
+                        ~iterator () {
+                            if (__pkvp__) {
+                                __pkvp__->__inIteration__ --;
+                                __pkvp__->Unlock (); 
+                            }
+                        }
+
+                        keyBlockOffsetPair& operator * () {
+                            __pair__.blockOffset = __pkvp__->__fingerprintIndex__ [__position__].blockOffset;
+                            int16_t blockSize;
+                            keyType key;
+                            valueType value;
+                            __pkvp__->__readBlock__ (blockSize, key, value, __pair__.blockOffset, true); // the error, if it happens, is flagged in __pkvp__->errorFlags ()
+                            __pair__.key = (keyType&&) key;
+                            return __pair__;
+                        }
+
+                        iterator& operator ++ () { __position__ ++; return *this; }
+
+                        friend bool operator != (const iterator& a, const iterator& b) { return a.__position__ != b.__position__; }
+
+                        // this will tell if iterator is valid (if there are not elements the iterator can not be valid)
+                        operator bool () const { return __pkvp__->size () > 0; }
+
+
+                    private:
+
+                        keyValueDatabase* __pkvp__ = NULL;
+                        int __position__;
+                        keyBlockOffsetPair __pair__ = {};
+
+                };
+
+            #endif
+
+            iterator begin () { // since only the begin () instance is neede for iteration we'll do the locking here
+                Lock (); // Unlock () will be called in instance destructor
+                __inIteration__ ++; // -- will be called in instance destructor
+                // DEBUG: Serial.print ("   startted itetating (begin), count = "); Serial.println (__inIteration__);
+                #ifndef __KEY_VALUE_DATABASE_KEYS_ON_DISK__
+                    return iterator (this, true); 
+                #else
+                    return iterator (this, 0);
+                #endif
+            } 
+
+            iterator end () { 
+                Lock (); // Unlock () will be called in instance destructor
+                __inIteration__ ++; // -- will be called in instance destructor
+                // DEBUG: Serial.print ("   startted itetating (end), count = "); Serial.println (__inIteration__);
+                #ifndef __KEY_VALUE_DATABASE_KEYS_ON_DISK__
+                    return iterator (this, false); 
+                #else
+                    return iterator (this, __fingerprintIndexSize__);
+                #endif
+            } 
+
+
+           /*
+            *  Return iterators to the neighbours of the key in O (log n), or end () if there is no such key (not available with __KEY_VALUE_DATABASE_KEYS_ON_DISK__,
+            *  since keys are not kept in order then):
+            *
+            *    - lower_bound (key) or ceiling (key) to the first key >= key
+            *    - upper_bound (key) to the first key > key
+            *    - floor (key) to the last key <= key
+            *
+            *  Like with begin (), the database stays locked while the iterator exists, so it is suitable for range scans, like:
+            *
+            *    for (auto p = pkvpA.lower_bound (from); p != pkvpA.end () && (*p).key < to; ++ p)
+            *        Serial.println ((*p).key);
+            */
+
+          #ifndef __KEY_VALUE_DATABASE_KEYS_ON_DISK__
+
+            iterator lower_bound (const keyType& key) { 
+                Lock (); // Unlock () will be called in instance destructor
+                __inIteration__ ++; // -- will be called in instance destructor
+                return iterator (this, Map<keyType, blockOffsetType>::lower_bound (key));
+            }
+
+            iterator upper_bound (const keyType& key) { 
+                Lock (); // Unlock () will be called in instance destructor
+                __inIteration__ ++; // -- will be called in instance destructor
+                return iterator (this, Map<keyType, blockOffsetType>::upper_bound (key));
+            }
+
+            iterator floor (const keyType& key) { 
+                Lock (); // Unlock () will be called in instance destructor
+                __inIteration__ ++; // -- will be called in instance destructor
+                return iterator (this, Map<keyType, blockOffsetType>::floor (key));
+            }
+
+            iterator ceiling (const keyType& key) { return lower_bound (key); }
+
+          #endif
+
+
+           /*
+            *  Order statistics, if __MAP_ORDER_STATISTICS__ is #defined (not available with __KEY_VALUE_DATABASE_KEYS_ON_DISK__), all in O (log n):
+            *
+            *    - select (i) returns an iterator to the i-th key in key order (counting from 0) or end () if there is no such key
+            *    - rank (key) returns the number of keys < key
+            *    - count (from, to) returns the number of keys with from <= keys < to, by two rank lookups (so not in constant time)
+            *
+            *  So a page of keys can be listed without iterating from begin (), like:
+            *
+            *    int i = 0;
+            *    for (auto p = urlCounters.select (37 * 20); p != urlCounters.end () && i < 20; ++ p, i ++)
+            *        Serial.println ((*p).key);
+            */
+
+          #if defined (__MAP_ORDER_STATISTICS__) && !defined (__KEY_VALUE_DATABASE_KEYS_ON_DISK__)
+
+            iterator select (int i) { 
+                Lock (); // Unlock () will be called in instance destructor
+                __inIteration__ ++; // -- will be called in instance destructor
+                return iterator (this, Map<keyType, blockOffsetType>::select (i));
+            }
+
+            int rank (const keyType& key) {
+                Lock ();
+                int r = Map<keyType, blockOffsetType>::rank (key);
+                Unlock ();
+                return r;
+            }
+
+            int count (const keyType& from, const keyType& to) {
+                Lock ();
+                int c = Map<keyType, blockOffsetType>::count (from, to);
+                Unlock ();
+                return c;
+            }
+
+          #endif
+
+
+           /*
+            *  Finds min and max keys in keyValueDatabase (not available with __KEY_VALUE_DATABASE_KEYS_ON_DISK__, since keys are not kept in order then).
+            *
+            *  Example:
+            *  
+            *    auto firstElement = pkvpA.first_element ();
+            *    if (firstElement) // check if first element is found (if pkvpA is not empty)
+            *        Serial.printf ("first element (min key) of pkvpA = %i\n", (*firstElement)->key);
+            */
+
+          #ifndef __KEY_VALUE_DATABASE_KEYS_ON_DISK__
+
+          iterator first_element () { 
+              Lock (); // Unlock () will be called in instance destructor
+              __inIteration__ ++; // -- will be called in instance destructor
+              return iterator (this, this->height ());  // call the 'begin' constructor
+          }
+
+          iterator last_element () {
+              Lock (); // Unlock () will be called in instance destructor
+              __inIteration__ ++; // -- will be called in instance destructor
+              return iterator (this->height (), this);  // call the 'end' constructor
+          }
+
+          #endif
+
+
+        private:
+
+            // the part of a secondary index that keyValueDatabase needs to maintain it, regardless of the type of its index keys
+            class __secondaryIndexBase__ {
+                public:
+                    virtual signed char __insert__ (const valueType& value, blockOffsetType blockOffset) = 0;
+                    virtual void __erase__ (const valueType& value, blockOffsetType blockOffset) = 0;
+                    virtual bool __sameIndexKey__ (const valueType& value1, const valueType& value2) = 0;
+                    virtual void __clear__ () = 0;
+
+                    __secondaryIndexBase__ *__next__ = NULL; // the list of the database's secondary indexes
+            };
+
+        public:
+
+           /*
+            *  Secondary indexes find key-value pairs by a field of their values instead of by their keys. A secondary index is defined by an extractor function
+            *  that returns the index key from the value, and kept in memory as an ordered Map of (index key, block offset) entries. Insert, Update and Delete
+            *  keep the secondary indexes up to date (if an index can't be updated, the operation is rolled back) and Open rebuilds them while reading the data
+            *  file (it reads the values as well then, so it is slower). Secondary indexes must be added before Open and must live as long as the database:
+            *
+            *    struct reading { uint8_t status; float temperature; };
+            *    uint8_t statusOf (const reading& r) { return r.status; }
+            *
+            *    keyValueDatabase<unsigned long, reading> readings;
+            *    keyValueDatabase<unsigned long, reading>::secondaryIndex<uint8_t> byStatus (statusOf);
+            *
+            *    readings.AddIndex (byStatus);
+            *    readings.Open ("/readings.kvdb");
+            *    ...
+            *    byStatus.Find (STATUS_ALARM, [] (const unsigned long& key, const reading& value, blockOffsetType blockOffset) { 
+            *        Serial.println (key); 
+            *    });
+            *
+            *  Find (index key, callback) calls the callback for each key-value pair with the index key and FindRange (from, to, callback) for each one with
+            *  from <= index key < to, in index key order. The database can't be changed from the callback. Both return OK, err_not_found if there is no
+            *  such key-value pair or one of the error codes.
+            */
+
+            template <class indexKeyType> class secondaryIndex : public __secondaryIndexBase__ {
+
+                friend class keyValueDatabase;
+
+                public:
+
+                    secondaryIndex (indexKeyType (*extractor) (const valueType& value)) : __extractor__ (extractor) {}
+
+                    signed char Find (const indexKeyType& indexKey, void (*callback) (const keyType& key, const valueType& value, blockOffsetType blockOffset)) { return __find__ (indexKey, indexKey, true, callback); }
+
+                    signed char FindRange (const indexKeyType& from, const indexKeyType& to, void (*callback) (const keyType& key, const valueType& value, blockOffsetType blockOffset)) { return __find__ (from, to, false, callback); }
+
+                    // the number of entries in the index
+                    int size () { return __entries__.size (); }
+
+                private:
+
+                    struct __indexEntry__ {
+                        indexKeyType indexKey;
+                        blockOffsetType blockOffset; // entries with equal index keys are ordered by their block offsets
+
+                        bool operator < (const __indexEntry__& other) const { return indexKey < other.indexKey || (!(other.indexKey < indexKey) && blockOffset < other.blockOffset); }
+                        bool operator > (const __indexEntry__& other) const { return other < *this; }
+                    };
+
+                    indexKeyType (*__extractor__) (const valueType& value);
+                    Map<__indexEntry__, char> __entries__;
+                    keyValueDatabase *__kvdb__ = NULL;
+
+                    signed char __insert__ (const valueType& value, blockOffsetType blockOffset) {
+                        __indexEntry__ entry = { __extractor__ (value), blockOffset };
+                        if (!__isKeyValid__ (entry.indexKey)) // check if String index key construction is valid
+                            return err_bad_alloc;
+                        return __entries__.insert (entry, 0);
+                    }
+
+                    void __erase__ (const valueType& value, blockOffsetType blockOffset) { __entries__.erase ( { __extractor__ (value), blockOffset } ); }
+
+                    bool __sameIndexKey__ (const valueType& value1, const valueType& value2) {
+                        indexKeyType indexKey1 = __extractor__ (value1);
+                        indexKeyType indexKey2 = __extractor__ (value2);
+                        return !(indexKey1 < indexKey2) && !(indexKey2 < indexKey1);
+                    }
+
+                    void __clear__ () { __entries__.clear (); }
+
+                    signed char __find__ (const indexKeyType& from, const indexKeyType& to, bool equal, void (*callback) (const keyType& key, const valueType& value, blockOffsetType blockOffset)) {
+                        if (!__kvdb__) {
+                            // log_e ("the index hasn't been added to the database: err_cant_do_it_now");
+                            #ifdef __USE_KEY_VALUE_DATABASE_EXCEPTIONS__
+                                throw err_cant_do_it_now;
+                            #endif
+                            return err_cant_do_it_now;
+                        }
+                        if (!__isKeyValid__ (from) || !__isKeyValid__ (to)) { // check if String index key parameter construction is valid
+                            // log_e ("String index key construction error: err_bad_alloc");
+                            #ifdef __USE_KEY_VALUE_DATABASE_EXCEPTIONS__
+                                throw err_bad_alloc;
+                            #endif
+                            __kvdb__->__errorFlags__ |= err_bad_alloc;
+                            return err_bad_alloc;
+                        }
+
+                        __kvdb__->Lock ();
+                        if (!__kvdb__->__dataFile__) { 
+                            // log_e ("error, data file not opened: err_file_io");
+                            #ifdef __USE_KEY_VALUE_DATABASE_EXCEPTIONS__
+                                throw err_file_io;
+                            #endif
+                            __kvdb__->__errorFlags__ |= err_file_io;
+                            __kvdb__->Unlock ();
+                            return err_file_io; 
+                        }
+                        __kvdb__->__inIteration__ ++; // the index must not change while it is being iterated through
+                        __kvdb__->__inIndexSearch__ ++;
+
+                        signed char e = err_not_found; // until the first key-value pair is found
+                        for (auto it = __entries__.lower_bound ( { from, 0 } ); it != __entries__.end (); ++ it) {
+                            if (equal ? from < it->first.indexKey : !(it->first.indexKey < to))
+                                break;
+                            int16_t blockSize;
+                            keyType key;
+                            valueType value;
+                            e = __kvdb__->__readBlock__ (blockSize, key, value, it->first.blockOffset);
+                            if (e) // != OK
+                                break;
+                            callback (key, value, it->first.blockOffset);
+                        }
+
+                        __kvdb__->__inIndexSearch__ --;
+                        __kvdb__->__inIteration__ --;
+                        __kvdb__->Unlock ();
+                        return e;
+                    }
+            };
+
+
+           /*
+            *  Adds a secondary index to the database, returns OK or one of the error codes. It can only be done before Open.
+            */
+
+            template <class indexKeyType>
+            signed char AddIndex (secondaryIndex<indexKeyType>& index) {
+                Lock ();
+                if (__dataFile__ || index.__kvdb__) {
+                    // log_e ("the data is already loaded or the index already added: err_cant_do_it_now");
+                    #ifdef __USE_KEY_VALUE_DATABASE_EXCEPTIONS__
+                        throw err_cant_do_it_now;
+                    #endif
+                    __errorFlags__ |= err_cant_do_it_now;
+                    Unlock (); 
+                    return err_cant_do_it_now;
+                }
+                index.__kvdb__ = this;
+                index.__next__ = __secondaryIndexes__;
+                __secondaryIndexes__ = &index;
+                Unlock (); 
+                return err_ok;
+            }
+
+
+           /*
+            * Locking mechanism
+            */
+
+            void Lock () { 
+                #if defined (__KEY_VALUE_DATABASE_STATISTICS__) || defined (__KEY_VALUE_DATABASE_LATENCY_HISTOGRAMS__) || defined (__KEY_VALUE_DATABASE_TRACE__)
+                    unsigned long waitStarted = micros ();
+                #endif
+                #ifdef SEMAPHORE_H // RTOS is running beneath Arduino sketch, multitasking (and semaphores) is supported
+                    xSemaphoreTakeRecursive (__semaphore__, portMAX_DELAY); 
+                #endif
+                #if defined (__KEY_VALUE_DATABASE_STATISTICS__) || defined (__KEY_VALUE_DATABASE_LATENCY_HISTOGRAMS__) || defined (__KEY_VALUE_DATABASE_TRACE__)
+                    if (!__lockDepth__ ++) { // only the outermost Lock of the recursive semaphore waits for it
+                        __lockedAt__ = micros ();
+                        #ifdef __KEY_VALUE_DATABASE_STATISTICS__
+                            __statistics__.lockWaitMicros += __lockedAt__ - waitStarted;
+                        #endif
+                        __operationDone__ (traceLockWait, __lockedAt__ - waitStarted, err_ok);
+                    }
+                #endif
+            } 
+
+            void Unlock () { 
+                #if defined (__KEY_VALUE_DATABASE_STATISTICS__) || defined (__KEY_VALUE_DATABASE_LATENCY_HISTOGRAMS__) || defined (__KEY_VALUE_DATABASE_TRACE__)
+                    if (__lockDepth__ && !-- __lockDepth__) { // the outermost Unlock releases the semaphore
+                        #ifdef __KEY_VALUE_DATABASE_STATISTICS__
+                            uint32_t held = micros () - __lockedAt__;
+                            if (held > __statistics__.maxLockHoldMicros)
+                                __statistics__.maxLockHoldMicros = held;
+                        #endif
+                    }
+                #endif
+                #ifdef SEMAPHORE_H // RTOS is running beneath Arduino sketch, multitasking (and semaphores) is supported
+                    xSemaphoreGiveRecursive (__semaphore__); 
+                #endif
+            }
+
+
+        private:
+
+            char __dataFileName__ [255] = "";
+            File __dataFile__;
+            #ifdef __KEY_VALUE_DATABASE_SEGMENT_SIZE__
+                uint64_t __dataFileSize__ = 0;          // the sum of all segment files' sizes
+                uint32_t __dataFileSegment__ = 0;       // the segment file currently opened as __dataFile__
+                uint32_t __lastSegment__ = 0;           // the segment file new blocks get appended to
+                uint32_t __lastSegmentSize__ = 0;
+                char __segmentFileNameBuffer__ [255 + 11];
+            #else
+                unsigned long __dataFileSize__ = 0;
+            #endif
+
+            struct freeBlockType {
+                blockOffsetType blockOffset;
+                int16_t blockSize;
+            };
+            vector<freeBlockType> __freeBlocksList__;
+
+            #ifdef SEMAPHORE_H // RTOS is running beneath Arduino sketch, multitasking (and semaphores) is supported
+                SemaphoreHandle_t __semaphore__ = xSemaphoreCreateRecursiveMutex (); 
+            #endif
+            int __inIteration__ = 0;
+
+            __secondaryIndexBase__ *__secondaryIndexes__ = NULL;
+
+            // staged writes of the transaction, by keys
+            struct __stagedWrite__ {
+                valueType value;
+                bool deleted;
+                uint32_t expires;                   // only used with __KEY_VALUE_DATABASE_TTL__
+
+                // filled in by Commit
+                bool hasOldBlock;
+                blockOffsetType oldBlockOffset;
+                int16_t oldBlockSize;
+                valueType oldValue;                 // only read if there are secondary indexes
+                bool hasNewBlock;
+                blockOffsetType newBlockOffset;
+                int16_t newBlockSize;
+                bool appended;
+            };
+            Map<keyType, __stagedWrite__> __transaction__;
+            bool __inTransaction__ = false;
+            enum { __stageInsert__, __stageUpdate__, __stageDelete__ };
+            char __sideFileNameBuffer__ [255 + 4]; // journal (dataFileName.tx) or upgrade (dataFileName.upg) file name
+
+            #ifdef __KEY_VALUE_DATABASE_CHECKSUM__
+                enum { __blockChecksumSize__ = sizeof (uint32_t) }; // the checksum is the last field of the block header
+            #else
+                enum { __blockChecksumSize__ = 0 };
+            #endif
+            #ifdef __KEY_VALUE_DATABASE_TTL__
+                enum { __blockHeaderSize__ = sizeof (int16_t) + sizeof (uint32_t) + __blockChecksumSize__ }; // block size, expiry time (and checksum)
+
+                uint32_t __lastExpires__ = 0;   // the expiry time of the last block read
+
+                struct __expiryEntry__ {
+                    uint32_t expires;
+                    blockOffsetType blockOffset;
+                };
+                vector<__expiryEntry__> __expiryHeap__; // min-heap by expiry time, entries of deleted, moved or refreshed blocks are skipped when they come to the top
+            #else
+                enum { __blockHeaderSize__ = sizeof (int16_t) + __blockChecksumSize__ }; // block size (and checksum)
+            #endif
+            int __inIndexSearch__ = 0;                      // secondary indexes are being searched, so they can't change
+
+            float __pctFree__ = __KEY_VALUE_DATABASE_PCT_FREE__; // the slack new blocks of String values get, it follows how much the values grow when they are updated
+            uint32_t __inPlaceUpdates__ = 0;
+            uint32_t __relocations__ = 0;
+
+            maintenancePolicy __maintenancePolicy__ = { 0, 0, 16, 16 };     // no automatic maintenance
+            blockOffsetType __maintenanceOffset__ = __fileHeaderSize__;     // where the next MaintenanceStep starts
+            uint16_t __maintenanceChecks__ = 0;                             // Deletes, moving Updates and Commits since the amplification has been checked
+            uint64_t __appendedBytes__ = 0;                                 // the size of the blocks appended since Open
+            uint64_t __lastSpaceReportAppendedBytes__ = 0;
+            unsigned long __openedMillis__ = 0;
+            unsigned long __lastSpaceReportMillis__ = 0;
+
+            #ifdef __KEY_VALUE_DATABASE_STATISTICS__
+                statistics __statistics__ = {};
+            #endif
+            #ifdef __KEY_VALUE_DATABASE_LATENCY_HISTOGRAMS__
+                latencyHistogram __latencyHistograms__ [traceOperations] = {};
+            #endif
+            #ifdef __KEY_VALUE_DATABASE_TRACE__
+                void (*__traceCallback__) (traceOperation operation, uint32_t micros, signed char e) = NULL;
+            #endif
+            #if defined (__KEY_VALUE_DATABASE_STATISTICS__) || defined (__KEY_VALUE_DATABASE_LATENCY_HISTOGRAMS__) || defined (__KEY_VALUE_DATABASE_TRACE__)
+                int __lockDepth__ = 0;                  // the semaphore is recursive, only the outermost Lock and Unlock are timed
+                unsigned long __lockedAt__ = 0;
+            #endif
+
+            char *__readBuffer__ = NULL;    // reusable buffer the whole blocks are read into
+            size_t __readBufferSize__ = 0;
+
+            #ifdef __KEY_VALUE_DATABASE_KEYS_ON_DISK__
+                struct __fingerprintIndexEntry__ {
+                    uint32_t fingerprint;
+                    blockOffsetType blockOffset;
+                };
+                __fingerprintIndexEntry__ *__fingerprintIndex__ = NULL; // sorted by fingerprint, used instead of Map
+                int __fingerprintIndexSize__ = 0;
+                int __fingerprintIndexCapacity__ = 0;
+            #endif
+
+            #ifdef __KEY_VALUE_DATABASE_BLOOM_FILTER_BITS_PER_KEY__
+                uint8_t *__bloomFilter__ = NULL;
+                uint32_t __bloomFilterBits__ = 0;
+                int __bloomFilterCapacity__ = 0;    // the number of keys the filter has been sized for
+                int __bloomFilterAdded__ = 0;       // the number of keys added to the filter since it has been built (the deleted ones included)
+            #endif
+
+            // som boards do no thave is_same implemented, so we have to imelement it ourselves: https://stackoverflow.com/questions/15200516/compare-typedef-is-same-type
+            template<typename T, typename U> struct is_same { static const bool value = false; };
+            template<typename T> struct is_same<T, T> { static const bool value = true; };
+
+            
+           /*
+            *  Transactions. __stage__ checks the write against the staged and the committed key-value pairs the same way Insert, Update and Delete do
+            *  and stages it. __commit__ writes the staged key-value pairs, __recoverJournal__ finishes the commit if the controller reset in the middle
+            *  of it.
+            *
+            *  These functions do not handle the __semaphore__.
+            */
+
+            signed char __stage__ (char operation, const keyType& key, const valueType *value, uint32_t expires) {
+                __stagedWrite__ *p = __transaction__.find_value (key);
+                bool exists;
+                if (p) {
+                    exists = !p->deleted;
+                    expires = operation == __stageUpdate__ ? p->expires : expires;
+                } else {
+                    blockOffsetType *pBlockOffset;
+                    int16_t blockSize;
+                    const char *data;
+                    size_t length;
+                    signed char e = __findBlockValue__ (key, pBlockOffset, blockSize, data, length);
+                    if (e && e != err_not_found) 
+                        return e;
+                    exists = !e;
+                    #ifdef __KEY_VALUE_DATABASE_TTL__
+                        if (exists && __isExpired__ ())
+                            exists = false;
+                        if (operation == __stageUpdate__)
+                            expires = __lastExpires__; // update keeps the expiry time
+                    #endif
+                }
+                if (operation == __stageInsert__ ? exists : !exists) {
+                    signed char e = exists ? err_not_unique : err_not_found;
+                    if (operation != __stageDelete__) 
+                        __errorFlags__ |= e;
+                    return e;
+                }
+
+                __stagedWrite__ w = { value ? *value : valueType (), operation == __stageDelete__, expires, false, 0, 0, valueType (), false, 0, 0, false };
+                if (is_same<valueType, String>::value && !*(String *) &w.value) {
+                    // log_e ("String value construction error: err_bad_alloc");
+                    __errorFlags__ |= err_bad_alloc;
+                    return err_bad_alloc;
+                }
+                if (p) {
+                    *p = (__stagedWrite__&&) w;
+                    return err_ok;
+                }
+                signed char e = __transaction__.insert (key, w);
+                if (e) // != OK
+                    __errorFlags__ |= e;
+                return e;
+            }
+
+            const char *__journalFileName__ () {
+                snprintf (__sideFileNameBuffer__, sizeof (__sideFileNameBuffer__), "%s.tx", __dataFileName__);
+                return __sideFileNameBuffer__;
+            }
+
+            // journal: (block offset, block size) entries followed by a commit record: the number of entries, their checksum and a magic number
+            enum { __journalEntrySize__ = sizeof (blockOffsetType) + sizeof (int16_t), __journalCommitRecordSize__ = 3 * sizeof (uint32_t), __journalMagic__ = 0x4B565458 }; // magic = "KVTX"
+
+            static void __putJournalEntry__ (byte *journal, int i, blockOffsetType blockOffset, int16_t blockSize) {
+                memcpy (journal + i * __journalEntrySize__, &blockOffset, sizeof (blockOffset));
+                memcpy (journal + i * __journalEntrySize__ + sizeof (blockOffset), &blockSize, sizeof (blockSize));
+            }
+
+            // adds the commit record behind count entries (the journal has to have space for it) and writes the journal file
+            bool __writeJournal__ (byte *journal, uint32_t count) {
+                size_t journalSize = count * __journalEntrySize__ + __journalCommitRecordSize__;
+                uint32_t record [3] = { count, 0, (uint32_t) __journalMagic__ };
+                memcpy (journal + journalSize - __journalCommitRecordSize__, record, sizeof (record));
+                record [1] = __fnv1a__ (journal, journalSize - sizeof (uint32_t) * 2);
+                memcpy (journal + journalSize - __journalCommitRecordSize__, record, sizeof (record));
+
+                File f = fileSystem.open (__journalFileName__ (), "w");
+                if (!f || f.write (journal, journalSize) != journalSize) {
+                    if (f) 
+                        f.close ();
+                    fileSystem.remove (__journalFileName__ ());
+                    return false;
+                }
+                f.flush ();
+                f.close ();
+                #ifdef __KEY_VALUE_DATABASE_STATISTICS__
+                    __statistics__.bytesWritten += journalSize;
+                    __statistics__.flushes ++;
+                #endif
+                return true;
+            }
+
+            // sets the block sizes listed in the journal
+            bool __applyJournal__ (const byte *journal, uint32_t count) {
+                for (uint32_t i = 0; i < count; i ++) {
+                    blockOffsetType blockOffset;
+                    int16_t blockSize;
+                    memcpy (&blockOffset, journal + i * __journalEntrySize__, sizeof (blockOffset));
+                    memcpy (&blockSize, journal + i * __journalEntrySize__ + sizeof (blockOffset), sizeof (blockSize));
+                    if (!__seek__ (blockOffset) || __write__ ((byte *) &blockSize, sizeof (blockSize)) != sizeof (blockSize))
+                        return false;
+                }
+                __flush__ ();
+                return true;
+            }
+
+            signed char __recoverJournal__ () {
+                const char *journalFileName = __journalFileName__ ();
+                if (!fileSystem.exists (journalFileName))
+                    return err_ok;
+                File f = fileSystem.open (journalFileName, "r");
+                if (!f)
+                    return err_file_io;
+                size_t size = f.size ();
+                byte *journal = size ? (byte *) malloc (size) : NULL;
+                if (size && !journal) {
+                    f.close ();
+                    return err_bad_alloc;
+                }
+                bool ok = size >= __journalCommitRecordSize__ && f.read (journal, size) == size;
+                f.close ();
+                if (ok) { // check the commit record, if it is not complete the transaction hasn't been committed and the data file hasn't been changed
+                    uint32_t record [3];
+                    memcpy (record, journal + size - __journalCommitRecordSize__, sizeof (record));
+                    ok = record [2] == (uint32_t) __journalMagic__ && record [0] * __journalEntrySize__ + __journalCommitRecordSize__ == size && record [1] == __fnv1a__ (journal, size - sizeof (uint32_t) * 2);
+                    if (ok && !__applyJournal__ (journal, record [0])) {
+                        free (journal);
+                        return err_file_io;
+                    }
+                }
+                if (journal) 
+                    free (journal);
+                fileSystem.remove (journalFileName);
+                return err_ok;
+            }
+
+            signed char __commit__ () {
+                int count = __transaction__.size ();
+                if (!count)
+                    return err_ok;
+                if (!__dataFile__) { 
+                    // log_e ("error, data file not opened: err_file_io");
+                    __errorFlags__ |= err_file_io;
+                    return err_file_io; 
+                }
+
+                // 1. write the new blocks into free space, still marked as free
+                signed char e = err_ok;
+                int journalEntries = 0;
+                for (auto it = __transaction__.begin (); it != __transaction__.end () && !e; ++ it) {
+                    const keyType& key = it->first;
+                    __stagedWrite__& w = it->second;
+                    w.hasNewBlock = w.appended = false;
+
+                    // the old block, if there is one, will become free
+                    blockOffsetType *pBlockOffset;
+                    int16_t blockSize;
+                    const char *data;
+                    size_t length;
+                    e = __findBlockValue__ (key, pBlockOffset, blockSize, data, length);
+                    w.hasOldBlock = !e;
+                    if (!e) {
+                        w.oldBlockOffset = *pBlockOffset;
+                        w.oldBlockSize = blockSize;
+                        journalEntries ++;
+                        if (__secondaryIndexes__)
+                            e = __valueFromData__ (w.oldValue, data, length);
+                    } else if (e == err_not_found) {
+                        e = err_ok;
+                    }
+                    if (e || w.deleted) 
+                        continue;
+
+                    size_t dataSize;
+                    size_t newBlockSize;
+                    __blockSizes__ (key, w.value, dataSize, newBlockSize);
+                    if (newBlockSize > 32768) {
+                        e = err_bad_alloc;
+                        continue;
+                    }
+                    int freeBlockIndex = -1;
+                    uint32_t minWaste = 0xFFFFFFFF;
+                    for (int i = 0; i < __freeBlocksList__.size (); i ++) {
+                        if ((size_t) __freeBlocksList__ [i].blockSize >= dataSize && __freeBlocksList__ [i].blockSize - dataSize < minWaste) {
+                            freeBlockIndex = i;
+                            minWaste = __freeBlocksList__ [i].blockSize - dataSize;
+                        }
+                    }
+                    if (freeBlockIndex == -1) { // append data to the end of __dataFile__
+                        w.newBlockOffset = __appendBlockOffset__ (newBlockSize);
+                        w.appended = true;
+                    } else { // write data to free block in __dataFile__, it is not free any more (but it will be returned to __freeBlocksList__ if commit fails)
+                        w.newBlockOffset = __freeBlocksList__ [freeBlockIndex].blockOffset;
+                        newBlockSize = __splitFreeBlock__ (freeBlockIndex, newBlockSize); // the rest of a larger free block stays free
+                        __freeBlocksList__.erase_unordered (__freeBlocksList__.begin () + freeBlockIndex);
+                    }
+                    w.newBlockSize = (int16_t) newBlockSize;
+
+                    byte *block = (byte *) calloc (newBlockSize, 1); // the whole block is written, so that the data file doesn't end in the middle of it
+                    if (!block) {
+                        if (!w.appended)
+                            __freeBlocksList__.push_back ( {w.newBlockOffset, w.newBlockSize} );
+                        e = err_bad_alloc;
+                        continue;
+                    }
+                    __buildBlock__ (block, (int16_t) -w.newBlockSize, key, w.value);
+                    #ifdef __KEY_VALUE_DATABASE_TTL__
+                        memcpy (block + sizeof (int16_t), &w.expires, sizeof (w.expires));
+                    #endif
+                    #ifdef __KEY_VALUE_DATABASE_CHECKSUM__
+                        __setBlockChecksum__ (block, dataSize);
+                    #endif
+                    bool written = __seek__ (w.newBlockOffset) && __write__ (block, newBlockSize) == newBlockSize;
+                    free (block);
+                    if (!written) { // the block is still marked as free, if it was written at all
+                        if (!w.appended)
+                            __freeBlocksList__.push_back ( {w.newBlockOffset, w.newBlockSize} );
+                        e = err_file_io;
+                        continue;
+                    }
+                    if (w.appended)
+                        __blockAppended__ (newBlockSize);
+                    w.hasNewBlock = true;
+                    journalEntries ++;
+
+                    // the secondary index entries of the new values can be inserted already, they are erased if commit fails
+                    e = __secondaryIndexesInsert__ (w.value, w.newBlockOffset);
+                    if (e) { // != OK
+                        __freeBlocksList__.push_back ( {w.newBlockOffset, w.newBlockSize} );
+                        w.hasNewBlock = false;
+                    }
+                }
+                __flush__ ();
+
+                // 2. write the journal with the commit record
+                byte *journal = NULL;
+                size_t journalSize = journalEntries * __journalEntrySize__ + __journalCommitRecordSize__;
+                if (!e) {
+                    journal = (byte *) malloc (journalSize);
+                    if (journal) {
+                        int i = 0;
+                        for (auto it = __transaction__.begin (); it != __transaction__.end (); ++ it) {
+                            if (it->second.hasNewBlock)
+                                __putJournalEntry__ (journal, i ++, it->second.newBlockOffset, it->second.newBlockSize);
+                            if (it->second.hasOldBlock)
+                                __putJournalEntry__ (journal, i ++, it->second.oldBlockOffset, (int16_t) -it->second.oldBlockSize);
+                        }
+                        if (!__writeJournal__ (journal, journalEntries))
+                            e = err_file_io;
+                    } else {
+                        e = err_bad_alloc;
+                    }
+                }
+                if (e) { // != OK, roll-back: the new blocks are free blocks again, the data file hasn't been changed
+                    // log_e ("commit failed, rolling back");
+                    for (auto it = __transaction__.begin (); it != __transaction__.end (); ++ it) {
+                        __stagedWrite__& w = it->second;
+                        if (w.hasNewBlock) {
+                            __secondaryIndexesErase__ (w.value, w.newBlockOffset);
+                            __freeBlocksList__.push_back ( {w.newBlockOffset, w.newBlockSize} );
+                        }
+                    }
+                    if (journal) 
+                        free (journal);
+                    #ifdef __USE_KEY_VALUE_DATABASE_EXCEPTIONS__
+                        throw e;
+                    #endif
+                    __errorFlags__ |= e;
+                    return e;
+                }
+
+                // 3. the transaction is committed now, change the block sizes in the data file
+                bool applied = __applyJournal__ (journal, journalEntries);
+                free (journal);
+                if (!applied) {
+                    // log_e ("write error, the journal will be applied by Open, closing data file");
+                    __dataFile__.close (); // memory key value pairs and disk data file are not synchronized any more - the journal is still there so the next Open will finish the commit
+                    #ifdef __USE_KEY_VALUE_DATABASE_EXCEPTIONS__
+                        throw err_file_io;
+                    #endif
+                    __errorFlags__ |= err_file_io;
+                    return err_file_io;
+                }
+                fileSystem.remove (__journalFileName__ ());
+
+                // 4. roll-out: update (memory) structures
+                for (auto it = __transaction__.begin (); it != __transaction__.end (); ++ it) {
+                    const keyType& key = it->first;
+                    __stagedWrite__& w = it->second;
+                    if (w.hasOldBlock) {
+                        __secondaryIndexesErase__ (w.oldValue, w.oldBlockOffset);
+                        if (__freeBlocksList__.push_back ( {w.oldBlockOffset, w.oldBlockSize} )) { // != OK
+                            // log_i ("free block list push_back failed, continuing anyway");
+                        }
+                    }
+                    if (w.hasOldBlock && w.hasNewBlock) {
+                        __indexRelocate__ (key, w.oldBlockOffset, w.newBlockOffset); // there is no reason this would fail
+                        __relocations__ ++;
+                    } else if (w.hasOldBlock) {
+                        e = __indexErase__ (key, w.oldBlockOffset);
+                        #ifdef __KEY_VALUE_DATABASE_STATISTICS__
+                            __statistics__.deletes ++;
+                        #endif
+                    } else if (w.hasNewBlock) {
+                        e = __indexInsert__ (key, w.newBlockOffset, false);
+                        #ifdef __KEY_VALUE_DATABASE_STATISTICS__
+                            __statistics__.inserts ++;
+                        #endif
+                    }
+                    if (e) { // != OK
+                        // log_e ("index update failed, can't roll-back, critical error, closing data file");
+                        __dataFile__.close (); // memory key value pairs and disk data file are not synchronized any more - it is better to close the file, this would cause all disk related operations from now on to fail
+                        __errorFlags__ |= e;
+                        return e;
+                    }
+                    if (w.hasNewBlock) {
+                        #ifdef __KEY_VALUE_DATABASE_BLOOM_FILTER_BITS_PER_KEY__
+                            __bloomFilterInsert__ (key);
+                        #endif
+                        #ifdef __KEY_VALUE_DATABASE_TTL__
+                            if (w.expires)
+                                __expiryHeapPush__ (w.expires, w.newBlockOffset);
+                        #endif
+                    }
+                }
+                return err_ok;
+            }
+
+
+           /*
+            *  Secondary indexes maintenance. If the value has the same index key as the kept value at the same block offset (Update may keep the block),
+            *  its entry is left as it is. If inserting into one of the indexes fails, the entries already inserted into the others are erased.
+            *
+            *  These functions do not handle the __semaphore__.
+            */
+
+            signed char __secondaryIndexesInsert__ (const valueType& value, blockOffsetType blockOffset, const valueType *keepValue = NULL, blockOffsetType keepBlockOffset = 0) {
+                if (__inIndexSearch__) {
+                    // log_e ("not while searching secondary indexes, error: err_cant_do_it_now");
+                    return err_cant_do_it_now;
+                }
+                for (__secondaryIndexBase__ *p = __secondaryIndexes__; p; p = p->__next__) {
+                    if (keepValue && keepBlockOffset == blockOffset && p->__sameIndexKey__ (value, *keepValue))
+                        continue;
+                    signed char e = p->__insert__ (value, blockOffset);
+                    if (e) { // != OK
+                        for (__secondaryIndexBase__ *q = __secondaryIndexes__; q != p; q = q->__next__)
+                            if (!(keepValue && keepBlockOffset == blockOffset && q->__sameIndexKey__ (value, *keepValue)))
+                                q->__erase__ (value, blockOffset);
+                        return e;
+                    }
+                }
+                return err_ok;
+            }
+
+            void __secondaryIndexesErase__ (const valueType& value, blockOffsetType blockOffset, const valueType *keepValue = NULL, blockOffsetType keepBlockOffset = 0) {
+                for (__secondaryIndexBase__ *p = __secondaryIndexes__; p; p = p->__next__)
+                    if (!(keepValue && keepBlockOffset == blockOffset && p->__sameIndexKey__ (value, *keepValue)))
+                        p->__erase__ (value, blockOffset);
+            }
+
+            void __secondaryIndexesClear__ () {
+                for (__secondaryIndexBase__ *p = __secondaryIndexes__; p; p = p->__next__)
+                    p->__clear__ ();
+            }
+
+            // moves the slack towards the growth of the updated String value (an exponential moving average of the last 16 updates or so)
+            void __observeGrowth__ (size_t oldLength, size_t newLength) {
+                float growth = newLength > oldLength ? (float) (newLength - oldLength) / (oldLength + 1) : 0; // add 1 for closing 0
+                if (growth > 1)
+                    growth = 1;
+                __pctFree__ += (growth - __pctFree__) / 16;
+            }
+
+            // calculates the size of the data and the size of the block (with slack for String values) needed for the key-value pair
+            void __blockSizes__ (const keyType& key, const valueType& value, size_t& dataSize, size_t& blockSize) {
+                dataSize = __blockHeaderSize__; // block size (and expiry time) information
+                blockSize = dataSize;
+                if (is_string<keyType>::value) { // if key is of type String ... (if anyone knows hot to do this in compile-time a feedback is welcome)
+                    dataSize += (__stringLength__ (key) + 1); // add 1 for closing 0, keys never change, so they don't need any slack
+                    blockSize += (__stringLength__ (key) + 1);
+                } else { // fixed size key
+                    dataSize += sizeof (keyType);
+                    blockSize += sizeof (keyType);
+                }                
+                if (is_same<valueType, String>::value) { // if value is of type String ... (if anyone knows hot to do this in compile-time a feedback is welcome)
+                    size_t valueSize = __storedStringSize__ (*(String *) &value); // characters with closing 0 or compressed
+                    dataSize += valueSize;
+                    blockSize += valueSize + valueSize * __pctFree__ + 0.5; // add slack for Strings
+                } else { // fixed size value
+                    dataSize += sizeof (valueType);
+                    blockSize += sizeof (valueType);
+                }
+            }
+
+            // constructs the block (the expiry time, if there is one, is left to the calling function)
+            void __buildBlock__ (byte *block, int16_t blockSize, const keyType& key, const valueType& value) {
+                memcpy (block, &blockSize, sizeof (blockSize)); 
+                size_t i = __blockHeaderSize__;
+                if (is_string<keyType>::value) { // if key is of type String ... (if anyone knows hot to do this in compile-time a feedback is welcome)
+                    __stringCopy__ (key, (char *) block + i); i += __stringLength__ (key) + 1; // add 1 for closing 0
+                } else { // fixed size key
+                    memcpy (block + i, &key, sizeof (key)); i += sizeof (key);
+                }       
+                if (is_same<valueType, String>::value) { // if value is of type String ... (if anyone knows hot to do this in compile-time a feedback is welcome)
+                    #ifdef __KEY_VALUE_DATABASE_COMPRESSION__
+                        uint16_t compressedSize;
+                        if (__compressedValueOf__ == (String *) &value) { // already compressed by __blockSizes__
+                            compressedSize = (uint16_t) __compressedValueSize__;
+                            if (compressedSize)
+                                memcpy (block + i + __compressedHeaderSize__, __compressedValue__, compressedSize);
+                        } else { // __blockSizes__ couldn't keep the compressed value (out of memory)
+                            compressedSize = (uint16_t) __compressString__ (*(String *) &value, block + i + __compressedHeaderSize__);
+                        }
+                        __releaseCompressedValue__ ();
+                        if (compressedSize) {
+                            uint16_t compressedLength = (uint16_t) ((String *) &value)->length ();
+                            block [i] = __compressedMarker__;
+                            memcpy (block + i + 1, &compressedSize, sizeof (compressedSize));
+                            memcpy (block + i + 1 + sizeof (compressedSize), &compressedLength, sizeof (compressedLength));
+                            return;
+                        }
+                    #endif
+                    size_t l = ((String *) &value)->length () + 1; // add 1 for closing 0
+                    memcpy (block + i, ((String *) &value)->c_str (), l);
+                } else { // fixed size value
+                    memcpy (block + i, &value, sizeof (value));
+                }
+            }
+
+            // the number of bytes a String value takes in the block: its characters with closing 0 or, if it gets compressed, the compressed header and data
+            size_t __storedStringSize__ (const String& value) {
+                #ifdef __KEY_VALUE_DATABASE_COMPRESSION__
+                    // the value is compressed only here, the result is kept for __buildBlock__ that follows
+                    __releaseCompressedValue__ ();
+                    size_t maxSize = __maxCompressedSize__ (value);
+                    if (!maxSize) {
+                        __compressedValueOf__ = &value; // stored as it is
+                    } else {
+                        __compressedValue__ = (uint8_t *) malloc (maxSize);
+                        size_t compressedSize = __compress__ (value.c_str (), value.length (), __compressedValue__, maxSize); // only calculates the size if malloc failed
+                        if (__compressedValue__) {
+                            __compressedValueOf__ = &value;
+                            __compressedValueSize__ = compressedSize;
+                        }
+                        if (compressedSize)
+                            return __compressedHeaderSize__ + compressedSize;
+                    }
+                #endif
+                return value.length () + 1; // add 1 for closing 0
+            }
+
+            // the same for the stored String value that starts at data, the result is larger than available if it doesn't fit
+            static size_t __storedStringSize__ (const char *data, size_t available) {
+                #ifdef __KEY_VALUE_DATABASE_COMPRESSION__
+                    if ((uint8_t) *data == __compressedMarker__) {
+                        if (available < __compressedHeaderSize__)
+                            return available + 1;
+                        uint16_t compressedSize;
+                        memcpy (&compressedSize, data + 1, sizeof (compressedSize));
+                        return __compressedHeaderSize__ + compressedSize;
+                    }
+                #else
+                    (void) available;
+                #endif
+                return strlen (data) + 1; // add 1 for closing 0
+            }
+
+            // copies the value from the read buffer
+            signed char __valueFromData__ (valueType& value, const char *data, size_t length) {
+                if (is_same<valueType, String>::value) { // if value is of type String ... (if anyone knows hot to do this in compile-time a feedback is welcome)
+                    *(String *) &value = data;
+                    if (!*(String *) &value)
+                        return err_bad_alloc;
+                } else { // fixed size value
+                    memcpy ((void *) &value, data, length);
+                }
+                return err_ok;
+            }
+
+
+           /*
+            *  The header of the data file. __checkFileHeader__ writes it into a new data file, checks it in an existing one or upgrades the data file
+            *  if it doesn't have the header yet (by copying it behind a new header into dataFileName.upg, which then replaces the data file). A data file
+            *  without the header has been written in the original format, without any of the flags, so it can only be upgraded if none of them is expected.
+            *
+            *  These functions do not handle the __semaphore__.
+            */
+
+            struct __fileHeader__ {
+                uint32_t magic;
+                uint16_t version;
+                uint16_t headerSize;
+                uint32_t flags;             // the #defines that change the data file format
+                uint32_t typeFingerprint;   // how the keys and the values are stored
+            };
+            enum { __fileHeaderSize__ = sizeof (__fileHeader__), __fileMagic__ = 0x4244564B, __fileVersion__ = 1 }; // magic = "KVDB"
+            enum { __fileFlagTTL__ = 1, __fileFlagChecksum__ = 2, __fileFlagSegments__ = 4, __fileFlagCompression__ = 8 };
+
+            __fileHeader__ __expectedFileHeader__ () {
+                uint32_t flags = 0;
+                #ifdef __KEY_VALUE_DATABASE_TTL__
+                    flags |= __fileFlagTTL__;
+                #endif
+                #ifdef __KEY_VALUE_DATABASE_CHECKSUM__
+                    flags |= __fileFlagChecksum__;
+                #endif
+                #ifdef __KEY_VALUE_DATABASE_SEGMENT_SIZE__
+                    flags |= __fileFlagSegments__;
+                #endif
+                #ifdef __KEY_VALUE_DATABASE_COMPRESSION__
+                    flags |= __fileFlagCompression__;
+                #endif
+                // Strings (and String keys) are stored as 0 terminated characters, the other types as their (fixed size) bytes
+                uint32_t storage [2] = { is_string<keyType>::value ? 0 : (uint32_t) sizeof (keyType), is_same<valueType, String>::value ? 0 : (uint32_t) sizeof (valueType) };
+                uint32_t typeFingerprint = __fnv1a__ (storage, sizeof (storage));
+                #ifdef __KEY_VALUE_DATABASE_COMPRESSION_DICTIONARY__
+                    typeFingerprint ^= __fnv1a__ (__compressionDictionary__ (), __compressionDictionaryLength__); // compressed values can only be read with the same dictionary
+                #endif
+                return { (uint32_t) __fileMagic__, (uint16_t) __fileVersion__, (uint16_t) __fileHeaderSize__, flags, typeFingerprint };
+            }
+
+            bool __writeFileHeader__ () {
+                __fileHeader__ header = __expectedFileHeader__ ();
+                if (!__dataFile__.seek (0, SeekSet) || __write__ ((byte *) &header, sizeof (header)) != sizeof (header))
+                    return false;
+                __flush__ ();
+                return true;
+            }
+
+            // checks if the opened data file starts with the magic number
+            bool __hasFileHeader__ () {
+                uint32_t magic;
+                return __dataFile__.seek (0, SeekSet) && __read__ ((uint8_t *) &magic, sizeof (magic)) == sizeof (magic) && magic == (uint32_t) __fileMagic__;
+            }
+
+            // returns OK if the opened data file has the expected header or it doesn't have one at all, err_data_changed if its header is different
+            signed char __verifyFileHeader__ () {
+                if (!__hasFileHeader__ ())
+                    return err_ok;
+                __fileHeader__ header;
+                __fileHeader__ expected = __expectedFileHeader__ ();
+                if (!__dataFile__.seek (0, SeekSet) || __read__ ((uint8_t *) &header, sizeof (header)) != sizeof (header))
+                    return err_data_changed;
+                if (header.version != expected.version || header.headerSize != expected.headerSize || header.flags != expected.flags || header.typeFingerprint != expected.typeFingerprint)
+                    return err_data_changed; // written by another version, with different #defines or for different key or value types
+                return err_ok;
+            }
+
+            signed char __checkFileHeader__ () {
+                if (__dataFile__.size () == 0) // a new data file
+                    return __writeFileHeader__ () ? err_ok : err_file_io;
+                if (__hasFileHeader__ ())
+                    return __verifyFileHeader__ ();
+                if (__expectedFileHeader__ ().flags) // the blocks of the data file don't have the expiry times or checksums, or the values are not compressed
+                    return err_data_changed;
+                return __upgradeFile__ ();
+            }
+
+            const char *__upgradeFileName__ () {
+                snprintf (__sideFileNameBuffer__, sizeof (__sideFileNameBuffer__), "%s.upg", __dataFileName__);
+                return __sideFileNameBuffer__;
+            }
+
+            // copies the data file without the header behind a new header, the data file is only replaced when the copy is complete
+            signed char __upgradeFile__ () {
+                // log_i ("upgrading the data file");
+                if (!__reserveReadBuffer__ (512))
+                    return err_bad_alloc;
+                const char *upgradeFileName = __upgradeFileName__ ();
+                File f = fileSystem.open (upgradeFileName, "w");
+                if (!f)
+                    return err_file_io;
+                __fileHeader__ header = __expectedFileHeader__ ();
+                bool copied = f.write ((byte *) &header, sizeof (header)) == sizeof (header) && __dataFile__.seek (0, SeekSet);
+                while (copied) {
+                    size_t bytesRead = __read__ ((uint8_t *) __readBuffer__, 512);
+                    if (!bytesRead)
+                        break;
+                    copied = f.write ((byte *) __readBuffer__, bytesRead) == bytesRead;
+                }
+                f.flush ();
+                f.close ();
+                if (!copied) {
+                    fileSystem.remove (upgradeFileName);
+                    return err_file_io;
+                }
+                // if the controller resets after the data file has been removed, Open only renames dataFileName.upg
+                __dataFile__.close ();
+                if (!fileSystem.remove (__dataFileName__) || !fileSystem.rename (upgradeFileName, __dataFileName__))
+                    return err_file_io;
+                __dataFile__ = fileSystem.open (__dataFileName__, "r+");
+                return __dataFile__ ? err_ok : err_file_io;
+            }
+
+
+           /*
+            *  Reads the value from __dataFile__.
+            *  
+            *  Returns success, in case of error it also sets lastErrorCode.
+            *
+            *  This function does not handle the __semaphore__.
+            */
+
+
+            signed char __readBlock__ (int16_t& blockSize, keyType& key, valueType& value, blockOffsetType blockOffset, bool skipReadingValue = false) {
+                // reposition file pointer to the beginning of a block
+                if (!__seek__ (blockOffset)) {
+                    // log_e ("seek error err_file_io");
+                    #ifdef __USE_KEY_VALUE_DATABASE_EXCEPTIONS__
+                        throw err_file_io;
+                    #endif
+                    __errorFlags__ |= err_file_io;
+                    return err_file_io;
+                }
+
+                // read block size
+                if (__read__ ((uint8_t *) &blockSize, sizeof (int16_t)) != sizeof (blockSize)) {
+                    // log_e ("read block size error err_file_io");
+                    #ifdef __USE_KEY_VALUE_DATABASE_EXCEPTIONS__
+                        throw err_file_io;
+                    #endif
+                    __errorFlags__ |= err_file_io;                    
+                    return err_file_io;
+                }
+                // a block size that doesn't make sense would misalign reading all the following blocks
+                if (blockSize < 0 ? -blockSize < (int16_t) sizeof (int16_t) : blockSize <= (int16_t) __blockHeaderSize__) {
+                    // log_e ("invalid block size error err_data_changed");
+                    #ifdef __USE_KEY_VALUE_DATABASE_EXCEPTIONS__
+                        throw err_data_changed;
+                    #endif
+                    __errorFlags__ |= err_data_changed;
+                    return err_data_changed;
+                }
+                // if block is free the reading is already done
+                if (blockSize < 0) { 
+                    // log_i ("OK");
+                    return err_ok;
+                }
+
+                #ifdef __KEY_VALUE_DATABASE_TTL__
+                    // read expiry time
+                    if (__read__ ((uint8_t *) &__lastExpires__, sizeof (__lastExpires__)) != sizeof (__lastExpires__)) {
+                        // log_e ("read expiry time error err_file_io");
+                        #ifdef __USE_KEY_VALUE_DATABASE_EXCEPTIONS__
+                            throw err_file_io;
+                        #endif
+                        __errorFlags__ |= err_file_io;
+                        return err_file_io;
+                    }
+                #endif
+
+                #if defined (__KEY_VALUE_DATABASE_CHECKSUM__) || defined (__KEY_VALUE_DATABASE_COMPRESSION__)
+                    // read the whole block at once to check its checksum (or decompress the value) and then take the key and the value from __readBuffer__
+                    size_t bytesRead;
+                    signed char e = __readBlockData__ (blockSize, bytesRead);
+                    if (e) // != OK
+                        return e;
+                    size_t i;
+                    if (is_string<keyType>::value) { // if key is of type String ... (if anyone knows hot to do this in compile-time a feedback is welcome)
+                        __readStringKey__ (key, __readBuffer__, __boolTag__<is_string<keyType>::value> ());
+                        if (!__isKeyValid__ (key)) {
+                            // log_e ("String key construction error err_bad_alloc");
+                            #ifdef __USE_KEY_VALUE_DATABASE_EXCEPTIONS__
+                                throw err_bad_alloc;
+                            #endif
+                            __errorFlags__ |= err_bad_alloc;
+                            return err_bad_alloc;
+                        }
+                        i = strlen (__readBuffer__) + 1; // add 1 for closing 0
+                    } else { // fixed size key
+                        memcpy ((void *) &key, __readBuffer__, sizeof (key));
+                        i = sizeof (key);
+                    }
+                    if (!skipReadingValue) {
+                        const char *data;
+                        size_t length;
+                        e = __locateValue__ (i, bytesRead, data, length);
+                        if (e) // != OK
+                            return e;
+                        e = __valueFromData__ (value, data, length);
+                        if (e) { // != OK
+                            // log_e ("String value construction error err_bad_alloc");
+                            #ifdef __USE_KEY_VALUE_DATABASE_EXCEPTIONS__
+                                throw e;
+                            #endif
+                            __errorFlags__ |= e;
+                            return e;
+                        }
+                    }
+                    // log_i ("OK");            
+                    return err_ok;
+                #endif
+
+                // read key
+                if (is_string<keyType>::value) { // if key is of type String ... (if anyone knows hot to do this in compile-time a feedback is welcome)
+                    // read the file until 0 is read
+                    while (__dataFile__.available ()) { 
+                            char c = (char) __readByte__ (); 
+                            if (!c) break;
+                            if (!__stringConcat__ (key, c)) {
+                                // log_e ("String key construction error err_bad_alloc");
+                                #ifdef __USE_KEY_VALUE_DATABASE_EXCEPTIONS__
+                                    throw err_bad_alloc;
+                                #endif
+                                __errorFlags__ |= err_bad_alloc;
+                                return err_bad_alloc;
+                            }
+                    }
+                } else {
+                    // fixed size key                
+                    if (__read__ ((uint8_t *) &key, sizeof (key)) != sizeof (key)) {
+                        // log_e ("read key error err_file_io");
+                        #ifdef __USE_KEY_VALUE_DATABASE_EXCEPTIONS__
+                            throw err_file_io;
+                        #endif
+                        __errorFlags__ |= err_file_io;
+                        return err_file_io;
+                    }                                
+                }
+
+                // read value
+                if (!skipReadingValue) {
+                    if (is_same<valueType, String>::value) { // if value is of type String ... (if anyone knows hot to do this in compile-time a feedback is welcome)
+                        // read the file until 0 is read               
+                        while (__dataFile__.available ()) { 
+                                char c = (char) __readByte__ (); 
+                                if (!c) break;
+                                if (!((String *) &value)->concat (c)) {
+                                    // log_e ("String value construction error err_bad_alloc");
+                                    #ifdef __USE_KEY_VALUE_DATABASE_EXCEPTIONS__
+                                        throw err_bad_alloc;
+                                    #endif
+                                    __errorFlags__ |= err_bad_alloc;
+                                    return err_bad_alloc;     
+                                }
+                        }
+                    } else {
+                        // fixed size value               
+                        if (__read__ ((uint8_t *) &value, sizeof (value)) != sizeof (value)) {
+                            // log_e ("read value error err_file_io");
+                            #ifdef __USE_KEY_VALUE_DATABASE_EXCEPTIONS__
+                                throw err_file_io;
+                            #endif
+                            __errorFlags__ |= err_file_io;
+                            return err_file_io;      
+                        }                                
+                    }
+                }
+                // log_i ("OK");            
+                return err_ok;
+            }
+
+
+           /*
+            *  Reads the whole block (without block size information) into __readBuffer__ with a single file read and checks if it belongs to the key.
+            *  On success data and length describe the value inside __readBuffer__.
+            *
+            *  If the block has been found only by the key's fingerprint (keys on disk) it may belong to another key, which is not an error, just err_not_found.
+            *
+            *  This function does not handle the __semaphore__.
+            */
+
+            template <class K>
+            signed char __readBlockValue__ (const K& key, blockOffsetType blockOffset, int16_t& blockSize, const char *& data, size_t& length, bool foundByFingerprint = false) {
+                if (!__seek__ (blockOffset)) {
+                    // log_e ("seek error err_file_io");
+                    #ifdef __USE_KEY_VALUE_DATABASE_EXCEPTIONS__
+                        throw err_file_io;
+                    #endif
+                    __errorFlags__ |= err_file_io;
+                    return err_file_io;
+                }
+                if (__read__ ((uint8_t *) &blockSize, sizeof (int16_t)) != sizeof (blockSize)) {
+                    // log_e ("read block size error err_file_io");
+                    #ifdef __USE_KEY_VALUE_DATABASE_EXCEPTIONS__
+                        throw err_file_io;
+                    #endif
+                    __errorFlags__ |= err_file_io;                    
+                    return err_file_io;
+                }
+                if (blockSize <= (int16_t) __blockHeaderSize__) {
+                    // log_e ("error that shouldn't happen: err_data_changed");
+                    #ifdef __USE_KEY_VALUE_DATABASE_EXCEPTIONS__
+                        throw err_data_changed;
+                    #endif
+                    __errorFlags__ |= err_data_changed;
+                    return err_data_changed; // shouldn't happen, but check anyway ...
+                }
+
+                #ifdef __KEY_VALUE_DATABASE_TTL__
+                    if (__read__ ((uint8_t *) &__lastExpires__, sizeof (__lastExpires__)) != sizeof (__lastExpires__)) {
+                        // log_e ("read expiry time error err_file_io");
+                        #ifdef __USE_KEY_VALUE_DATABASE_EXCEPTIONS__
+                            throw err_file_io;
+                        #endif
+                        __errorFlags__ |= err_file_io;                    
+                        return err_file_io;
+                    }
+                #endif
+
+                size_t bytesRead;
+                signed char e = __readBlockData__ (blockSize, bytesRead);
+                if (e) // != OK
+                    return e;
+
+                // check the key
+                size_t i;
+                if (!__isStoredKey__ (key, bytesRead, i)) {
+                    if (foundByFingerprint)
+                        return err_not_found; // the block belongs to another key with the same fingerprint
+                    // log_e ("error that shouldn't happen: err_data_changed");
+                    #ifdef __USE_KEY_VALUE_DATABASE_EXCEPTIONS__
+                        throw err_data_changed;
+                    #endif
+                    __errorFlags__ |= err_data_changed;
+                    return err_data_changed; // shouldn't happen, but check anyway ...
+                }
+
+                // locate the value
+                return __locateValue__ (i, bytesRead, data, length);
+            }
+
+
+           /*
+            *  Reads the block size and, if the block is used, the size of the data in it (with block header) the way __readBlock__ reads it.
+            *
+            *  This function does not handle the __semaphore__.
+            */
+
+            signed char __readBlockDataSize__ (blockOffsetType blockOffset, int16_t& blockSize, size_t& dataSize) {
+                if (!__seek__ (blockOffset) || __read__ ((uint8_t *) &blockSize, sizeof (int16_t)) != sizeof (blockSize)) {
+                    // log_e ("seek or read block size error err_file_io");
+                    #ifdef __USE_KEY_VALUE_DATABASE_EXCEPTIONS__
+                        throw err_file_io;
+                    #endif
+                    __errorFlags__ |= err_file_io;
+                    return err_file_io;
+                }
+                if (blockSize < 0 ? -blockSize < (int16_t) sizeof (int16_t) : blockSize <= (int16_t) __blockHeaderSize__) {
+                    // log_e ("invalid block size error err_data_changed");
+                    #ifdef __USE_KEY_VALUE_DATABASE_EXCEPTIONS__
+                        throw err_data_changed;
+                    #endif
+                    __errorFlags__ |= err_data_changed;
+                    return err_data_changed;
+                }
+                dataSize = 0;
+                if (blockSize < 0)
+                    return err_ok;
+                #ifdef __KEY_VALUE_DATABASE_TTL__
+                    if (__read__ ((uint8_t *) &__lastExpires__, sizeof (__lastExpires__)) != sizeof (__lastExpires__)) {
+                        // log_e ("read expiry time error err_file_io");
+                        #ifdef __USE_KEY_VALUE_DATABASE_EXCEPTIONS__
+                            throw err_file_io;
+                        #endif
+                        __errorFlags__ |= err_file_io;
+                        return err_file_io;
+                    }
+                #endif
+                size_t bytesRead;
+                signed char e = __readBlockData__ (blockSize, bytesRead);
+                if (e) // != OK
+                    return e;
+                __storedDataLength__ (bytesRead, dataSize); // __readBlockData__ has already checked that it fits
+                dataSize += __blockHeaderSize__;
+                return err_ok;
+            }
+
+
+           /*
+            *  Locates the value that starts at i in __readBuffer__ (after the key). A compressed String value is decompressed behind the bytes read, so that data
+            *  always points to the (0 terminated) characters or the bytes of the value.
+            *
+            *  This function does not handle the __semaphore__.
+            */
+
+            signed char __locateValue__ (size_t i, size_t bytesRead, const char *& data, size_t& length) {
+                data = __readBuffer__ + i;
+                if (is_same<valueType, String>::value) { // if value is of type String ... (if anyone knows hot to do this in compile-time a feedback is welcome)
+                    #ifdef __KEY_VALUE_DATABASE_COMPRESSION__
+                        if ((uint8_t) *data == __compressedMarker__) {
+                            uint16_t compressedSize;
+                            uint16_t compressedLength;
+                            memcpy (&compressedSize, data + 1, sizeof (compressedSize));
+                            memcpy (&compressedLength, data + 1 + sizeof (compressedSize), sizeof (compressedLength));
+                            length = compressedLength;
+                            // the size has already been checked by __readBlockData__, __readBuffer__ keeps its content when it grows
+                            if (!__reserveReadBuffer__ (bytesRead + 1 + length + 1)) {
+                                // log_e ("malloc error, out of memory");
+                                #ifdef __USE_KEY_VALUE_DATABASE_EXCEPTIONS__
+                                    throw err_bad_alloc;
+                                #endif
+                                __errorFlags__ |= err_bad_alloc;
+                                return err_bad_alloc;
+                            }
+                            char *decompressed = __readBuffer__ + bytesRead + 1;
+                            if (!__decompress__ ((const uint8_t *) __readBuffer__ + i + __compressedHeaderSize__, compressedSize, decompressed, length)) {
+                                // log_e ("decompression error: err_data_changed");
+                                #ifdef __USE_KEY_VALUE_DATABASE_EXCEPTIONS__
+                                    throw err_data_changed;
+                                #endif
+                                __errorFlags__ |= err_data_changed;
+                                return err_data_changed;
+                            }
+                            decompressed [length] = 0;
+                            data = decompressed;
+                            return err_ok;
+                        }
+                    #endif
+                    length = strlen (data);
+                } else { // fixed size value
+                    length = sizeof (valueType);
+                    if (i + length > bytesRead) {
+                        // log_e ("read value error err_file_io");
+                        #ifdef __USE_KEY_VALUE_DATABASE_EXCEPTIONS__
+                            throw err_file_io;
+                        #endif
+                        __errorFlags__ |= err_file_io;
+                        return err_file_io;      
+                    }
+                }
+                return err_ok;
+            }
+
+
+           /*
+            *  Reads the rest of the block (after the block size and expiry time have already been read) into __readBuffer__ with a single file read and
+            *  closes it with 0. It checks if the key and the value fit into the block and, if __KEY_VALUE_DATABASE_CHECKSUM__ is #defined, the block's checksum.
+            *
+            *  This function does not handle the __semaphore__.
+            */
+
+            signed char __readBlockData__ (int16_t blockSize, size_t& bytesRead) {
+                #ifdef __KEY_VALUE_DATABASE_CHECKSUM__
+                    uint32_t checksum;
+                    if (__read__ ((uint8_t *) &checksum, sizeof (checksum)) != sizeof (checksum)) {
+                        // log_e ("read checksum error err_file_io");
+                        #ifdef __USE_KEY_VALUE_DATABASE_EXCEPTIONS__
+                            throw err_file_io;
+                        #endif
+                        __errorFlags__ |= err_file_io;                    
+                        return err_file_io;
+                    }
+                #endif
+
+                // make sure the read buffer is large enough, leave 1 byte for closing 0
+                size_t bytesToRead = blockSize - __blockHeaderSize__;
+                if (!__reserveReadBuffer__ (bytesToRead + 1)) {
+                    // log_e ("malloc error, out of memory");
+                    #ifdef __USE_KEY_VALUE_DATABASE_EXCEPTIONS__
+                        throw err_bad_alloc;
+                    #endif
+                    __errorFlags__ |= err_bad_alloc;
+                    return err_bad_alloc;
+                }
+
+                // the last block in the data file may be shorter than its block size (the free space at its end may not be written yet)
+                bytesRead = __read__ ((uint8_t *) __readBuffer__, bytesToRead);
+                __readBuffer__ [bytesRead] = 0;
+
+                #ifdef __KEY_VALUE_DATABASE_TTL__
+                    uint32_t expires = __lastExpires__;
+                #else
+                    uint32_t expires = 0;
+                #endif
+                #ifndef __KEY_VALUE_DATABASE_CHECKSUM__
+                    uint32_t checksum = 0;
+                #endif
+                if (!__isBlockDataValid__ (blockSize, expires, checksum, bytesRead)) {
+                    // log_e ("block data (or checksum) error err_data_changed");
+                    #ifdef __USE_KEY_VALUE_DATABASE_EXCEPTIONS__
+                        throw err_data_changed;
+                    #endif
+                    __errorFlags__ |= err_data_changed;
+                    return err_data_changed;
+                }
+                return err_ok;
+            }
+
+            // calculates how many bytes the key and the value, read into __readBuffer__, take in the block, returns false if they don't fit into the bytes read
+            bool __storedDataLength__ (size_t bytesRead, size_t& dataLength) {
+                dataLength = is_string<keyType>::value ? strlen (__readBuffer__) + 1 : sizeof (keyType); // add 1 for closing 0
+                if (dataLength > bytesRead)
+                    return false;
+                dataLength += is_same<valueType, String>::value ? __storedStringSize__ (__readBuffer__ + dataLength, bytesRead - dataLength) : sizeof (valueType);
+                return dataLength <= bytesRead;
+            }
+
+            // checks if the key and the value, read into __readBuffer__, fit into the bytes read and, with __KEY_VALUE_DATABASE_CHECKSUM__, if the block's checksum is right
+            bool __isBlockDataValid__ (int16_t blockSize, uint32_t expires, uint32_t checksum, size_t bytesRead) {
+                size_t dataLength;
+                if (!__storedDataLength__ (bytesRead, dataLength))
+                    return false;
+                #ifdef __KEY_VALUE_DATABASE_CHECKSUM__
+                    return __blockChecksum__ (blockSize, expires, __readBuffer__, dataLength) == checksum;
+                #else
+                    (void) blockSize; (void) expires; (void) checksum;
+                    return true;
+                #endif
+            }
+
+
+          #ifdef __KEY_VALUE_DATABASE_CHECKSUM__
+
+           /*
+            *  CRC32C (Castagnoli polynomial) with a table of 16 entries, which processes 4 bits at a time and takes only 64 bytes of flash. The checksum of the
+            *  data before can be passed as crc to continue the calculation.
+            */
+
+            static uint32_t __crc32c__ (const void *data, size_t length, uint32_t crc = 0) {
+                static const uint32_t table [16] = { 0x00000000, 0x105EC76F, 0x20BD8EDE, 0x30E349B1, 0x417B1DBC, 0x5125DAD3, 0x61C69362, 0x7198540D,
+                                                     0x82F63B78, 0x92A8FC17, 0xA24BB5A6, 0xB21572C9, 0xC38D26C4, 0xD3D3E1AB, 0xE330A81A, 0xF36E6F75 };
+                crc = ~crc;
+                for (size_t i = 0; i < length; i ++) {
+                    crc ^= ((const uint8_t *) data) [i];
+                    crc = (crc >> 4) ^ table [crc & 0x0F];
+                    crc = (crc >> 4) ^ table [crc & 0x0F];
+                }
+                return ~crc;
+            }
+
+            // the block size is taken as if the block was used, so freeing the block (or making it used) doesn't change its checksum
+            static uint32_t __blockChecksum__ (int16_t blockSize, uint32_t expires, const char *data, size_t dataLength) {
+                if (blockSize < 0)
+                    blockSize = (int16_t) -blockSize;
+                uint32_t crc = __crc32c__ (&blockSize, sizeof (blockSize));
+                #ifdef __KEY_VALUE_DATABASE_TTL__
+                    crc = __crc32c__ (&expires, sizeof (expires), crc);
+                #else
+                    (void) expires;
+                #endif
+                return __crc32c__ (data, dataLength, crc);
+            }
+
+            // calculates the checksum of the block constructed by __buildBlock__ (with the expiry time already in place)
+            void __setBlockChecksum__ (byte *block, size_t dataSize) {
+                int16_t blockSize;
+                memcpy (&blockSize, block, sizeof (blockSize));
+                uint32_t expires = 0;
+                #ifdef __KEY_VALUE_DATABASE_TTL__
+                    memcpy (&expires, block + sizeof (int16_t), sizeof (expires));
+                #endif
+                uint32_t checksum = __blockChecksum__ (blockSize, expires, (const char *) block + __blockHeaderSize__, dataSize - __blockHeaderSize__);
+                memcpy (block + __blockHeaderSize__ - __blockChecksumSize__, &checksum, sizeof (checksum));
+            }
+
+          #endif
+
+
+          #ifdef __KEY_VALUE_DATABASE_COMPRESSION__
+
+           /*
+            *  LZ77 like compression of String values. The compressed data consists of groups of a flag byte and 8 items, flag bit (starting with the
+            *  lowest one) 0 means a literal byte, 1 a match: 2 bytes with 12 bit offset - 1 and 4 bit length - 3 (matches are 3 to 18 bytes long and
+            *  up to 4096 bytes back). The dictionary, if there is one, is placed before the value, so that the matches can refer to it as well. Only
+            *  the last position of each (hashed) 3 bytes is remembered, which keeps the compression fast and its memory (512 bytes of stack) small.
+            */
+
+            enum { __compressedMarker__ = 0xFF, __compressedHeaderSize__ = 1 + 2 * sizeof (uint16_t) }; // marker, compressed size and length
+
+            #ifdef __KEY_VALUE_DATABASE_COMPRESSION_DICTIONARY__
+                static const char *__compressionDictionary__ () { return __KEY_VALUE_DATABASE_COMPRESSION_DICTIONARY__; }
+                enum { __compressionDictionaryLength__ = sizeof (__KEY_VALUE_DATABASE_COMPRESSION_DICTIONARY__) - 1 };
+            #else
+                static const char *__compressionDictionary__ () { return ""; }
+                enum { __compressionDictionaryLength__ = 0 };
+            #endif
+
+            // byte at position p of the dictionary followed by the value
+            static uint8_t __compressionByte__ (const char *value, size_t p) { return p < __compressionDictionaryLength__ ? __compressionDictionary__ () [p] : value [p - __compressionDictionaryLength__]; }
+
+            static uint8_t __compressionHash__ (const char *value, size_t p) { return (uint8_t) (((uint32_t) __compressionByte__ (value, p) | (uint32_t) __compressionByte__ (value, p + 1) << 8 | (uint32_t) __compressionByte__ (value, p + 2) << 16) * 2654435761UL >> 24); }
+
+            // returns the largest compressed size the String value may have to be stored compressed, 0 if it shouldn't be compressed at all
+            static size_t __maxCompressedSize__ (const String& value) {
+                size_t length = value.length ();
+                if (length && (uint8_t) value [0] == __compressedMarker__) // it would be taken as compressed otherwise, so it is compressed even if it grows: a flag byte for each 8 literals
+                    return length + (length + 7) / 8;
+                if (length < __KEY_VALUE_DATABASE_COMPRESSION_MIN_SIZE__ || length <= __compressedHeaderSize__)
+                    return 0;
+                return length - __compressedHeaderSize__; // compressed value with its header has to be shorter than the characters with closing 0
+            }
+
+            // returns the compressed size of the String value if it should be stored compressed (compression is written to compressed if it is not NULL), 0 if it should not
+            static size_t __compressString__ (const String& value, uint8_t *compressed) {
+                size_t maxSize = __maxCompressedSize__ (value);
+                return maxSize ? __compress__ (value.c_str (), value.length (), compressed, maxSize) : 0;
+            }
+
+            // the compressed String value that __blockSizes__ has calculated and __buildBlock__ is going to copy into the block, so that it is compressed only once
+            const String *__compressedValueOf__ = NULL;
+            uint8_t *__compressedValue__ = NULL;
+            size_t __compressedValueSize__ = 0;
+
+            void __releaseCompressedValue__ () {
+                if (__compressedValue__) free (__compressedValue__);
+                __compressedValue__ = NULL;
+                __compressedValueOf__ = NULL;
+                __compressedValueSize__ = 0;
+            }
+
+            // returns the compressed size or 0 if it would be larger than maxSize
+            static size_t __compress__ (const char *value, size_t length, uint8_t *compressed, size_t maxSize) {
+                uint16_t lastPosition [256]; // the last position + 1 of each hashed 3 bytes, 0 = none yet
+                memset (lastPosition, 0, sizeof (lastPosition));
+                size_t end = __compressionDictionaryLength__ + length;
+                for (size_t p = 0; p < __compressionDictionaryLength__ && p + 2 < end; p ++)
+                    lastPosition [__compressionHash__ (value, p)] = (uint16_t) (p + 1);
+
+                size_t size = 0;
+                size_t flagPosition = 0;
+                int items = 8;
+                for (size_t p = __compressionDictionaryLength__; p < end; items ++) {
+                    if (items == 8) { // start a new group
+                        if (size + 1 > maxSize)
+                            return 0;
+                        flagPosition = size ++;
+                        if (compressed)
+                            compressed [flagPosition] = 0;
+                        items = 0;
+                    }
+                    size_t matchLength = 0;
+                    size_t matchOffset = 0;
+                    if (p + 2 < end) {
+                        uint8_t h = __compressionHash__ (value, p);
+                        size_t candidate = lastPosition [h];
+                        lastPosition [h] = (uint16_t) (p + 1);
+                        if (candidate && p - (candidate - 1) <= 4096) {
+                            candidate --;
+                            while (matchLength < 18 && p + matchLength < end && __compressionByte__ (value, candidate + matchLength) == __compressionByte__ (value, p + matchLength))
+                                matchLength ++;
+                            matchOffset = p - candidate;
+                        }
+                    }
+                    if (matchLength >= 3) {
+                        if (size + 2 > maxSize)
+                            return 0;
+                        if (compressed) {
+                            compressed [flagPosition] |= 1 << items;
+                            compressed [size] = (uint8_t) (matchOffset - 1);
+                            compressed [size + 1] = (uint8_t) (((matchOffset - 1) >> 8) | ((matchLength - 3) << 4));
+                        }
+                        size += 2;
+                        for (size_t q = p + 1; q < p + matchLength && q + 2 < end; q ++)
+                            lastPosition [__compressionHash__ (value, q)] = (uint16_t) (q + 1);
+                        p += matchLength;
+                    } else {
+                        if (size + 1 > maxSize)
+                            return 0;
+                        if (compressed)
+                            compressed [size] = __compressionByte__ (value, p);
+                        size ++;
+                        p ++;
+                    }
+                }
+                return size;
+            }
+
+            // decompresses exactly length characters, returns false if the compressed data is not valid
+            static bool __decompress__ (const uint8_t *compressed, size_t compressedSize, char *value, size_t length) {
+                size_t s = 0;
+                uint8_t flags = 0;
+                int items = 0;
+                for (size_t d = 0; d < length; items --, flags >>= 1) {
+                    if (!items) {
+                        if (s >= compressedSize)
+                            return false;
+                        flags = compressed [s ++];
+                        items = 8;
+                    }
+                    if (flags & 1) {
+                        if (s + 2 > compressedSize)
+                            return false;
+                        size_t offset = (compressed [s] | (compressed [s + 1] & 0x0F) << 8) + 1;
+                        size_t l = (compressed [s + 1] >> 4) + 3;
+                        s += 2;
+                        if (offset > d + __compressionDictionaryLength__ || d + l > length)
+                            return false;
+                        for (; l; l --, d ++)
+                            value [d] = offset > d ? __compressionDictionary__ () [__compressionDictionaryLength__ + d - offset] : value [d - offset];
+                    } else {
+                        if (s >= compressedSize)
+                            return false;
+                        value [d ++] = compressed [s ++];
+                    }
+                }
+                return s == compressedSize;
+            }
+
+          #endif
+
+
+           /*
+            *  Checks the blocks of the opened (segment) file one after another, starting at offset, counting (and with repair freeing) the bad places. A bad block is freed
+            *  together with everything up to the next good block, which is only found with __KEY_VALUE_DATABASE_CHECKSUM__, without checksums the block
+            *  size is trusted if it makes sense or else the rest of the file is considered bad.
+            *
+            *  This function does not handle the __semaphore__.
+            */
+
+            signed char __verifyFile__ (uint32_t offset, bool repair, uint32_t& badBlocks) {
+                uint32_t fileSize = __dataFile__.size ();
+                while (offset < fileSize) {
+                    int16_t blockSize;
+                    signed char e = __verifyBlock__ (offset, blockSize);
+                    if (e == err_ok) {
+                        offset += blockSize < 0 ? -blockSize : blockSize;
+                        continue;
+                    }
+                    if (e != err_data_changed)
+                        return e;
+
+                    // log_i ("bad block found");
+                    badBlocks ++;
+                    uint32_t nextOffset = fileSize;
+                    #ifdef __KEY_VALUE_DATABASE_CHECKSUM__
+                        // the next good block is the first place where a block with the right checksum starts, the block size may have been corrupted as well
+                        for (uint32_t o = offset + sizeof (int16_t); o < fileSize; o ++) {
+                            e = __verifyBlock__ (o, blockSize, true);
+                            if (e == err_ok) {
+                                nextOffset = o;
+                                break;
+                            }
+                            if (e != err_data_changed)
+                                return e;
+                        }
+                    #else
+                        uint32_t size = blockSize < 0 ? -blockSize : blockSize;
+                        if (size > __blockHeaderSize__ && offset + size < fileSize)
+                            nextOffset = offset + size;
+                    #endif
+                    if (repair) {
+                        e = __freeRegion__ (offset, nextOffset - offset);
+                        if (e) // != OK
+                            return e;
+                    }
+                    offset = nextOffset;
+                }
+                return err_ok;
+            }
+
+            // returns OK if the block at offset is good, err_data_changed if it is not or one of the other error codes, free blocks are only checked if strict
+            signed char __verifyBlock__ (uint32_t offset, int16_t& blockSize, bool strict = false) {
+                blockSize = 0;
+                if (!__dataFile__.seek (offset, SeekSet))
+                    return err_file_io;
+                if (__read__ ((uint8_t *) &blockSize, sizeof (blockSize)) != sizeof (blockSize))
+                    return err_data_changed; // the file ends in the middle of the block size
+                if (blockSize < 0 && !strict)
+                    return -blockSize < (int16_t) sizeof (int16_t) ? err_data_changed : err_ok;
+                int16_t size = blockSize < 0 ? -blockSize : blockSize;
+                if (size <= (int16_t) __blockHeaderSize__)
+                    return err_data_changed;
+
+                uint32_t header [2] = {}; // expiry time and checksum, if they are there
+                size_t headerSize = __blockHeaderSize__ - sizeof (int16_t);
+                if (headerSize && __read__ ((uint8_t *) header, headerSize) != headerSize)
+                    return err_data_changed;
+                if (!__reserveReadBuffer__ (size - __blockHeaderSize__ + 1))
+                    return err_bad_alloc;
+                size_t bytesRead = __read__ ((uint8_t *) __readBuffer__, size - __blockHeaderSize__);
+                __readBuffer__ [bytesRead] = 0;
+                #ifdef __KEY_VALUE_DATABASE_TTL__
+                    return __isBlockDataValid__ (size, header [0], header [1], bytesRead) ? err_ok : err_data_changed;
+                #else
+                    return __isBlockDataValid__ (size, 0, header [0], bytesRead) ? err_ok : err_data_changed;
+                #endif
+            }
+
+            // marks size bytes at offset as free blocks (more of them if they don't fit into a single block)
+            signed char __freeRegion__ (uint32_t offset, uint32_t size) {
+                while (size > 0) {
+                    uint32_t s = size;
+                    if (s > 32767)
+                        s = size - 32767 >= sizeof (int16_t) ? 32767 : 32767 - sizeof (int16_t); // leave enough for the block size of the next free block
+                    if (s < sizeof (int16_t))
+                        s = sizeof (int16_t);
+                    int16_t blockSize = (int16_t) -s;
+                    if (!__dataFile__.seek (offset, SeekSet) || __write__ ((byte *) &blockSize, sizeof (blockSize)) != sizeof (blockSize))
+                        return err_file_io;
+                    offset += s;
+                    size -= s < size ? s : size;
+                }
+                __flush__ ();
+                return err_ok;
+            }
+
+
+           /*
+            *  Free space helpers: splitting the free blocks, scanning the blocks and the maintenance steps.
+            *
+            *  These functions do not handle the __semaphore__.
+            */
+
+            // the new block takes blockSize bytes of the free block at index i of __freeBlocksList__, the rest stays free if it is large enough,
+            // returns the size of the block that is taken (the whole free block if it is not split)
+            size_t __splitFreeBlock__ (int i, size_t blockSize) {
+                blockOffsetType blockOffset = __freeBlocksList__ [i].blockOffset;
+                size_t freeBlockSize = __freeBlocksList__ [i].blockSize;
+                if (freeBlockSize < blockSize + __KEY_VALUE_DATABASE_MIN_SPLIT_SIZE__)
+                    return freeBlockSize;
+                // the rest gets its block size first, until the first block size is written the free block still contains it as a whole
+                int16_t restSize = (int16_t) -(freeBlockSize - blockSize);
+                int16_t takenSize = (int16_t) -blockSize;
+                if (!__seek__ (blockOffset + blockSize) || __write__ ((byte *) &restSize, sizeof (restSize)) != sizeof (restSize))
+                    return freeBlockSize;
+                if (!__seek__ (blockOffset) || __write__ ((byte *) &takenSize, sizeof (takenSize)) != sizeof (takenSize))
+                    return freeBlockSize;
+                __flush__ ();
+                if (__freeBlocksList__.push_back ( {(blockOffsetType) (blockOffset + blockSize), (int16_t) -restSize} )) // != OK, the new block takes the whole free block then, it is written over the rest's block size
+                    return freeBlockSize;
+                __freeBlocksList__ [i].blockSize = (int16_t) blockSize;
+                return blockSize;
+            }
+
+            // adds up the sizes of the used blocks and the free space at their end by reading all the blocks
+            signed char __scanBlocks__ (uint64_t& usedBytes, uint64_t& slackBytes) {
+                usedBytes = slackBytes = 0;
+                #ifdef __KEY_VALUE_DATABASE_SEGMENT_SIZE__
+                    for (uint32_t segment = 0; segment <= __lastSegment__; segment ++) {
+                        if (!__seek__ ((blockOffsetType) segment << 32)) {
+                            // log_e ("seek error err_file_io");
+                            #ifdef __USE_KEY_VALUE_DATABASE_EXCEPTIONS__
+                                throw err_file_io;
+                            #endif
+                            __errorFlags__ |= err_file_io;
+                            return err_file_io;
+                        }
+                        uint32_t segmentSize = __dataFile__.size ();
+                        int16_t blockSize;
+                        for (uint32_t segmentOffset = segment == 0 ? __fileHeaderSize__ : 0; segmentOffset < segmentSize; segmentOffset += blockSize < 0 ? -blockSize : blockSize) {
+                            blockOffsetType blockOffset = ((blockOffsetType) segment << 32) | segmentOffset;
+                #else
+                        int16_t blockSize;
+                        for (blockOffsetType blockOffset = __fileHeaderSize__; blockOffset < __dataFileSize__; blockOffset += blockSize < 0 ? -blockSize : blockSize) {
+                #endif
+                            size_t dataSize;
+                            signed char e = __readBlockDataSize__ (blockOffset, blockSize, dataSize);
+                            if (e) // != OK
+                                return e;
+                            if (blockSize > 0) {
+                                usedBytes += blockSize;
+                                slackBytes += blockSize - dataSize;
+                            }
+                        }
+                #ifdef __KEY_VALUE_DATABASE_SEGMENT_SIZE__
+                    }
+                #endif
+                return err_ok;
+            }
+
+            // the end of the blocks in the (segment) file of the block offset, the last block of the data file may end after the end of the file
+            uint32_t __blocksEnd__ (blockOffsetType blockOffset) {
+                #ifdef __KEY_VALUE_DATABASE_SEGMENT_SIZE__
+                    uint32_t segment = (uint32_t) (blockOffset >> 32);
+                    if (segment == __lastSegment__)
+                        return __lastSegmentSize__;
+                    if (segment > __lastSegment__ || !__seek__ ((blockOffsetType) segment << 32))
+                        return 0;
+                    return __dataFile__.size ();
+                #else
+                    (void) blockOffset;
+                    return __dataFileSize__;
+                #endif
+            }
+
+            signed char __readBlockSize__ (blockOffsetType blockOffset, int16_t& blockSize) {
+                if (!__seek__ (blockOffset) || __read__ ((uint8_t *) &blockSize, sizeof (blockSize)) != sizeof (blockSize))
+                    return err_file_io;
+                return blockSize ? err_ok : err_data_changed; // a block size of 0 would stop the maintenance pass
+            }
+
+            signed char __maintenanceStep__ (int maxBlocks, bool compact, bool *passCompleted) {
+                if (passCompleted)
+                    *passCompleted = false;
+                int examined = 0;
+                while (examined < maxBlocks) {
+                    uint32_t blocksEnd = __blocksEnd__ (__maintenanceOffset__);
+                    if ((uint32_t) __maintenanceOffset__ >= blocksEnd) {
+                        #ifdef __KEY_VALUE_DATABASE_SEGMENT_SIZE__
+                            uint32_t segment = (uint32_t) (__maintenanceOffset__ >> 32);
+                            if (segment < __lastSegment__) { // continue with the next segment file
+                                __maintenanceOffset__ = (blockOffsetType) (segment + 1) << 32;
+                                continue;
+                            }
+                        #endif
+                        __maintenanceOffset__ = __fileHeaderSize__;
+                        if (passCompleted)
+                            *passCompleted = true;
+                        return err_ok;
+                    }
+                    int16_t blockSize;
+                    signed char e = __readBlockSize__ (__maintenanceOffset__, blockSize);
+                    if (e) // != OK
+                        return e;
+                    examined ++;
+                    if (blockSize > 0) { // used block
+                        __maintenanceOffset__ += blockSize;
+                        continue;
+                    }
+
+                    // merge the free blocks that follow into this one
+                    uint32_t freeSize = -blockSize;
+                    int mergedBlocks = 0;
+                    while ((uint32_t) __maintenanceOffset__ + freeSize < blocksEnd && examined < maxBlocks) {
+                        e = __readBlockSize__ (__maintenanceOffset__ + freeSize, blockSize);
+                        if (e) // != OK
+                            return e;
+                        if (blockSize > 0 || freeSize - blockSize > 32767)
+                            break;
+                        freeSize -= blockSize;
+                        mergedBlocks ++;
+                        examined ++;
+                    }
+                    if (mergedBlocks) {
+                        blockSize = (int16_t) -freeSize;
+                        if (!__seek__ (__maintenanceOffset__) || __write__ ((byte *) &blockSize, sizeof (blockSize)) != sizeof (blockSize))
+                            return err_file_io;
+                        __flush__ ();
+                        bool found = false;
+                        for (int i = 0; i < __freeBlocksList__.size (); ) {
+                            if (__freeBlocksList__ [i].blockOffset == __maintenanceOffset__) {
+                                __freeBlocksList__ [i ++].blockSize = (int16_t) freeSize;
+                                found = true;
+                            } else if (__freeBlocksList__ [i].blockOffset > __maintenanceOffset__ && __freeBlocksList__ [i].blockOffset < __maintenanceOffset__ + freeSize) {
+                                __freeBlocksList__.erase_unordered (__freeBlocksList__.begin () + i); // the i-th element is replaced by the last one
+                            } else {
+                                i ++;
+                            }
+                        }
+                        if (!found && __freeBlocksList__.push_back ( {__maintenanceOffset__, (int16_t) freeSize} )) { // != OK
+                            // log_i ("free block list push_back failed, continuing anyway");
+                        }
+                    }
+
+                    // move the used block that follows into the free space
+                    if (compact && (uint32_t) __maintenanceOffset__ + freeSize < blocksEnd && examined < maxBlocks) {
+                        e = __readBlockSize__ (__maintenanceOffset__ + freeSize, blockSize);
+                        if (e) // != OK
+                            return e;
+                        if (blockSize > 0 && (uint32_t) blockSize <= freeSize && freeSize - blockSize != 1) { // the rest of the free space needs at least its block size
+                            examined ++;
+                            e = __moveBlock__ (__maintenanceOffset__, freeSize, blockSize);
+                            if (e) // != OK
+                                return e;
+                            __maintenanceOffset__ += blockSize; // the free space is behind the moved block now
+                            continue;
+                        }
+                    }
+                    __maintenanceOffset__ += freeSize;
+                }
+                return err_ok;
+            }
+
+            // moves the used block of blockSize bytes that follows the free space at freeOffset into it, the free space is behind the moved block then
+            signed char __moveBlock__ (blockOffsetType freeOffset, uint32_t freeSize, int16_t blockSize) {
+                blockOffsetType oldBlockOffset = freeOffset + freeSize;
+
+                // 1. read the key (and the value for the secondary indexes) for the (memory) structures
+                int16_t bs;
+                keyType key;
+                valueType value;
+                signed char e = __readBlock__ (bs, key, value, oldBlockOffset, !__secondaryIndexes__);
+                if (e) // != OK
+                    return e;
+                #ifdef __KEY_VALUE_DATABASE_TTL__
+                    uint32_t expires = __lastExpires__;
+                #endif
+                if (__secondaryIndexes__) {
+                    e = __secondaryIndexesInsert__ (value, freeOffset);
+                    if (e) // != OK
+                        return e;
+                }
+
+                // 2. copy the block into the free space, still marked as free, with the rest of the free space behind it
+                size_t bytesRead = 0;
+                if (__reserveReadBuffer__ (blockSize) && __seek__ (oldBlockOffset))
+                    bytesRead = __read__ ((uint8_t *) __readBuffer__, blockSize); // the last block of the data file may end after the end of the file
+                int16_t copySize = (int16_t) -blockSize;
+                int16_t restSize = (int16_t) -(freeSize - blockSize);
+                bool copied = bytesRead >= sizeof (int16_t);
+                if (copied) {
+                    memcpy (__readBuffer__, &copySize, sizeof (copySize));
+                    if (freeSize > (uint32_t) blockSize)
+                        copied = __seek__ (freeOffset + blockSize) && __write__ ((byte *) &restSize, sizeof (restSize)) == sizeof (restSize);
+                    copied = copied && __seek__ (freeOffset) && __write__ ((byte *) __readBuffer__, bytesRead) == bytesRead;
+                    __flush__ ();
+                }
+
+                // 3. swap the used and the free block through the journal, so a reset in the middle leaves the key in one of them
+                byte journal [3 * __journalEntrySize__ + __journalCommitRecordSize__];
+                int journalEntries = 0;
+                __putJournalEntry__ (journal, journalEntries ++, freeOffset, blockSize);
+                __putJournalEntry__ (journal, journalEntries ++, oldBlockOffset, copySize);
+                if (freeSize > (uint32_t) blockSize)
+                    __putJournalEntry__ (journal, journalEntries ++, freeOffset + blockSize, (int16_t) -freeSize);
+                if (!copied || !__writeJournal__ (journal, journalEntries)) {
+                    if (__secondaryIndexes__)
+                        __secondaryIndexesErase__ (value, freeOffset);
+                    return err_file_io; // the data file hasn't been changed (the free space is still free)
+                }
+                if (!__applyJournal__ (journal, journalEntries)) {
+                    // log_e ("write error, the journal will be applied by Open, closing data file");
+                    __dataFile__.close (); // memory key value pairs and disk data file are not synchronized any more - the journal is still there so the next Open will finish the move
+                    return err_file_io;
+                }
+                fileSystem.remove (__journalFileName__ ());
+
+                // 4. roll-out: update (memory) structures
+                __indexRelocate__ (key, oldBlockOffset, freeOffset); // there is no reason this would fail
+                if (__secondaryIndexes__)
+                    __secondaryIndexesErase__ (value, oldBlockOffset);
+                #ifdef __KEY_VALUE_DATABASE_TTL__
+                    if (expires)
+                        __expiryHeapPush__ (expires, freeOffset);
+                #endif
+                for (int i = 0; i < __freeBlocksList__.size (); i ++)
+                    if (__freeBlocksList__ [i].blockOffset == freeOffset) {
+                        __freeBlocksList__ [i].blockOffset = freeOffset + blockSize;
+                        return err_ok;
+                    }
+                if (__freeBlocksList__.push_back ( {freeOffset + blockSize, (int16_t) freeSize} )) { // != OK
+                    // log_i ("free block list push_back failed, continuing anyway");
+                }
+                return err_ok;
+            }
+
+            // runs a MaintenanceStep if the policy says so, called by Delete, the Updates that move the value and Commit
+            void __autoMaintenance__ () {
+                if (!__maintenancePolicy__.coalesceAbove && !__maintenancePolicy__.compactAbove)
+                    return;
+                if (++ __maintenanceChecks__ < __maintenancePolicy__.checkEvery || __inIteration__ || __inTransaction__ || __inIndexSearch__)
+                    return;
+                __maintenanceChecks__ = 0;
+                uint64_t freeBytes = 0;
+                for (auto& f: __freeBlocksList__)
+                    freeBytes += f.blockSize;
+                if (freeBytes >= __dataFileSize__)
+                    return;
+                float amplification = (float) __dataFileSize__ / (__dataFileSize__ - freeBytes);
+                bool compact = __maintenancePolicy__.compactAbove && amplification > __maintenancePolicy__.compactAbove;
+                if (compact || (__maintenancePolicy__.coalesceAbove && amplification > __maintenancePolicy__.coalesceAbove)) {
+                    signed char e = __maintenanceStep__ (__maintenancePolicy__.blocksPerStep, compact, NULL);
+                    if (e) // != OK, the operation that has called it has succeeded anyway
+                        __errorFlags__ |= e;
+                }
+            }
+
+
+          #ifdef __KEY_VALUE_DATABASE_TTL__
+
+           /*
+            *  Expiry time helpers. __isExpired__ checks the last block read.
+            *
+            *  These functions do not handle the __semaphore__ (but __deleteIfExpired__ is called while the database is locked anyway).
+            */
+
+            static uint32_t __now__ () { return (uint32_t) time (NULL); }
+
+            bool __isExpired__ () { return __lastExpires__ && __lastExpires__ <= __now__ (); }
+
+            // deletes the key if it exists and has expired, returns OK or one of the error codes
+            signed char __deleteIfExpired__ (const keyType& key) {
+                blockOffsetType *pBlockOffset;
+                int16_t blockSize;
+                const char *data;
+                size_t length;
+                signed char e = __findBlockValue__ (key, pBlockOffset, blockSize, data, length);
+                if (e == err_not_found)
                     return err_ok;
+                if (e) // != OK
+                    return e;
+                return __isExpired__ () ? __delete__ (key) : err_ok;
+            }
+
+            void __expiryHeapPush__ (uint32_t expires, blockOffsetType blockOffset) {
+                if (__expiryHeap__.push_back ( {expires, blockOffset} )) { // != OK
+                    // log_i ("expiry heap push_back failed, the key will only expire on read");
+                    return;
+                }
+                int i = __expiryHeap__.size () - 1;
+                while (i > 0 && __expiryHeap__ [(i - 1) / 2].expires > __expiryHeap__ [i].expires) {
+                    __expiryEntry__ tmp = __expiryHeap__ [i]; __expiryHeap__ [i] = __expiryHeap__ [(i - 1) / 2]; __expiryHeap__ [(i - 1) / 2] = tmp;
+                    i = (i - 1) / 2;
                 }
+            }
 
-                // read key
-                if (is_same<keyType, String>::value) { // if key is of type String ... (if anyone knows hot to do this in compile-time a feedback is welcome)
-                    // read the file until 0 is read
-                    while (__dataFile__.available ()) { 
-                            char c = (char) __dataFile__.read (); 
-                            if (!c) break;
-                            if (!((String *) &key)->concat (c)) {
-                                // log_e ("String key construction error err_bad_alloc");
-                                #ifdef __USE_KEY_VALUE_DATABASE_EXCEPTIONS__
-                                    throw err_bad_alloc;
-                                #endif
-                                __errorFlags__ |= err_bad_alloc;
-                                return err_bad_alloc;
-                            }
+            // removes the top (the earliest) entry
+            void __expiryHeapPop__ () {
+                int n = __expiryHeap__.size () - 1;
+                __expiryHeap__ [0] = __expiryHeap__ [n];
+                __expiryHeap__.pop_back ();
+                int i = 0;
+                while (true) {
+                    int c = 2 * i + 1; // the earlier of the children
+                    if (c >= n)
+                        break;
+                    if (c + 1 < n && __expiryHeap__ [c + 1].expires < __expiryHeap__ [c].expires)
+                        c ++;
+                    if (__expiryHeap__ [i].expires <= __expiryHeap__ [c].expires)
+                        break;
+                    __expiryEntry__ tmp = __expiryHeap__ [i]; __expiryHeap__ [i] = __expiryHeap__ [c]; __expiryHeap__ [c] = tmp;
+                    i = c;
+                }
+            }
+
+          #endif
+
+
+           /*
+            *  Makes sure __readBuffer__ can hold at least size bytes. The buffer only grows, so it doesn't get reallocated once it is large enough.
+            *  Its content is kept (a compressed value gets decompressed behind the block read).
+            */
+
+            bool __reserveReadBuffer__ (size_t size) {
+                if (__readBufferSize__ >= size)
+                    return true;
+                size_t newSize = (size + 63) & ~63; // round up to 64 bytes so the buffer doesn't get reallocated for each byte of growth
+                char *newBuffer = (char *) realloc (__readBuffer__, newSize);
+                if (!newBuffer)
+                    return false;
+                __readBuffer__ = newBuffer;
+                __readBufferSize__ = newSize;
+                return true;
+            }
+
+
+           /*
+            *  Checks if the key, read into __readBuffer__, is the same as the one we are looking for and how many bytes it occupies in the block.
+            */
+
+            bool __isStoredKey__ (const keyType& key, size_t bytesRead, size_t& keySize) {
+                if (is_string<keyType>::value) { // if key is of type String ... (if anyone knows hot to do this in compile-time a feedback is welcome)
+                    keySize = strlen (__readBuffer__) + 1; // add 1 for closing 0
+                    return keySize <= bytesRead && __stringEquals__ (key, __readBuffer__, keySize - 1);
+                }
+                // else fixed size key
+                keySize = sizeof (keyType);
+                if (keySize > bytesRead)
+                    return false;
+                keyType storedKey;
+                memcpy ((void *) &storedKey, __readBuffer__, sizeof (keyType));
+                return storedKey == key;
+            }
+
+            bool __isStoredKey__ (const char *key, size_t bytesRead, size_t& keySize) {
+                keySize = strlen (__readBuffer__) + 1; // add 1 for closing 0
+                return keySize <= bytesRead && !strcmp (__readBuffer__, key);
+            }
+
+
+           /*
+            *  String keys (String, inlineString or prefixString) are stored as 0 terminated characters, all the other keys as they are (fixed size). The following functions
+            *  handle both kinds of String keys the same way, fixed size keys never get to call them (or they get the trivial versions).
+            */
+
+            // (is_string is declared at the beginning of the class)
+
+            // checks if String key parameter has been constructed successfully, characters given instead are valid if they are not NULL (like String (NULL) would be)
+            static bool __isKeyValid__ (const String& key) { return !!key; }
+            template <size_t N> static bool __isKeyValid__ (const inlineString<N>& key) { return !!key; }
+            template <size_t N> static bool __isKeyValid__ (const prefixString<N>& key) { return !!key; }
+            template <class T> static bool __isKeyValid__ (const T&) { return true; }
+            static bool __isKeyValid__ (const char *key) { return key != NULL; }
+
+            static size_t __stringLength__ (const String& key) { return key.length (); }
+            template <size_t N> static size_t __stringLength__ (const inlineString<N>& key) { return key.length (); }
+            template <size_t N> static size_t __stringLength__ (const prefixString<N>& key) { return key.length (); }
+            template <class T> static size_t __stringLength__ (const T&) { return 0; }
+
+            // copies the characters with closing 0 (prefixString doesn't keep them together so there is no c_str)
+            static void __stringCopy__ (const String& key, char *buffer) { memcpy (buffer, key.c_str (), key.length () + 1); }
+            template <size_t N> static void __stringCopy__ (const inlineString<N>& key, char *buffer) { memcpy (buffer, key.c_str (), key.length () + 1); }
+            template <size_t N> static void __stringCopy__ (const prefixString<N>& key, char *buffer) { key.copyTo (buffer); }
+            template <class T> static void __stringCopy__ (const T&, char *buffer) { *buffer = 0; }
+
+            static bool __stringEquals__ (const String& key, const char *chars, size_t length) { return key.length () == length && !memcmp (key.c_str (), chars, length); }
+            template <size_t N> static bool __stringEquals__ (const inlineString<N>& key, const char *chars, size_t length) { return !key.compareTo (chars, length); }
+            template <size_t N> static bool __stringEquals__ (const prefixString<N>& key, const char *chars, size_t length) { return !key.compareTo (chars, length); }
+            template <class T> static bool __stringEquals__ (const T&, const char *, size_t) { return false; }
+
+            static bool __stringConcat__ (String& key, char c) { return key.concat (c); }
+            template <size_t N> static bool __stringConcat__ (inlineString<N>& key, char c) { return key.concat (c); }
+            template <size_t N> static bool __stringConcat__ (prefixString<N>& key, char c) { return key.concat (c); }
+            template <class T> static bool __stringConcat__ (T&, char) { return false; }
+
+            static void __stringAssign__ (String& key, const char *chars) { key = chars; }
+            template <size_t N> static void __stringAssign__ (inlineString<N>& key, const char *chars) { key = chars; }
+            template <size_t N> static void __stringAssign__ (prefixString<N>& key, const char *chars) { key = chars; }
+            template <class T> static void __stringAssign__ (T& key, const char *chars) { static_assert (is_string<T>::value, "only String, inlineString and prefixString keys can be given as characters"); }
+
+            // __stringAssign__ for the code that only String keys get to at run-time, but is compiled for the fixed size keys as well
+            template <class T> static void __readStringKey__ (T& key, const char *chars, __boolTag__<true>) { __stringAssign__ (key, chars); }
+            template <class T> static void __readStringKey__ (T&, const char *, __boolTag__<false>) { }
+
+
+           /*
+            *  The index of blocks is (memory) Map of keys and block offsets or, with __KEY_VALUE_DATABASE_KEYS_ON_DISK__, an array of (key fingerprint, block offset)
+            *  entries, sorted by fingerprint. Different keys may have the same fingerprint, so all the blocks with key's fingerprint are read until the one that
+            *  belongs to the key is found. This is a single disk read in most cases.
+            *
+            *  These functions do not handle the __semaphore__.
+            */
+
+            // finds the key's block and reads it into __readBuffer__, pBlockOffset points to block offset in the index afterwards, err_not_found is not flagged
+            template <class K>
+            signed char __findBlockValue__ (const K& key, blockOffsetType *& pBlockOffset, int16_t& blockSize, const char *& data, size_t& length) {
+                #ifdef __KEY_VALUE_DATABASE_BLOOM_FILTER_BITS_PER_KEY__
+                    if (!__bloomFilterMayContain__ (key))
+                        return err_not_found;
+                #endif
+                #ifndef __KEY_VALUE_DATABASE_KEYS_ON_DISK__
+                    Map<keyType, blockOffsetType>::clearErrorFlags ();
+                    pBlockOffset = Map<keyType, blockOffsetType>::find_value (key);
+                    if (!pBlockOffset) { // if not found or error
+                        signed char e = Map<keyType, blockOffsetType>::errorFlags ();
+                        if (e) { // error
+                            __errorFlags__ |= e;
+                            return e;
+                        }
+                        return err_not_found;
                     }
-                } else {
-                    // fixed size key                
-                    if (__dataFile__.read ((uint8_t *) &key, sizeof (key)) != sizeof (key)) {
-                        // log_e ("read key error err_file_io");
+                    return __readBlockValue__ (key, *pBlockOffset, blockSize, data, length);
+                #else
+                    uint32_t fingerprint;
+                    if (!__fingerprint__ (key, fingerprint)) {
+                        // log_e ("malloc error, out of memory");
                         #ifdef __USE_KEY_VALUE_DATABASE_EXCEPTIONS__
-                            throw err_file_io;
+                            throw err_bad_alloc;
                         #endif
-                        __errorFlags__ |= err_file_io;
-                        return err_file_io;
-                    }                                
+                        __errorFlags__ |= err_bad_alloc;
+                        return err_bad_alloc;
+                    }
+                    for (int i = __fingerprintLowerBound__ (fingerprint); i < __fingerprintIndexSize__ && __fingerprintIndex__ [i].fingerprint == fingerprint; i ++) {
+                        signed char e = __readBlockValue__ (key, __fingerprintIndex__ [i].blockOffset, blockSize, data, length, true);
+                        if (e != err_not_found) { // found or error
+                            pBlockOffset = &__fingerprintIndex__ [i].blockOffset;
+                            return e;
+                        }
+                    }
+                    return err_not_found;
+                #endif
+            }
+
+            // inserts (key, blockOffset) into the index, returns err_not_unique if the key is already there
+            signed char __indexInsert__ (const keyType& key, blockOffsetType blockOffset, bool checkUniqueness = true) {
+                #ifndef __KEY_VALUE_DATABASE_KEYS_ON_DISK__
+                    (void) checkUniqueness; // keys in the Map are always unique
+                    return Map<keyType, blockOffsetType>::insert (key, blockOffset);
+                #else
+                    uint32_t fingerprint;
+                    if (!__fingerprint__ (key, fingerprint))
+                        return err_bad_alloc;
+                    int position = __fingerprintLowerBound__ (fingerprint);
+                    if (checkUniqueness)
+                        for (int i = position; i < __fingerprintIndexSize__ && __fingerprintIndex__ [i].fingerprint == fingerprint; i ++) {
+                            int16_t blockSize;
+                            const char *data;
+                            size_t length;
+                            signed char e = __readBlockValue__ (key, __fingerprintIndex__ [i].blockOffset, blockSize, data, length, true);
+                            if (e == err_ok)
+                                return err_not_unique;
+                            if (e != err_not_found)
+                                return e;
+                        }
+                    return __fingerprintIndexInsert__ (position, fingerprint, blockOffset) ? err_ok : err_bad_alloc;
+                #endif
+            }
+
+            signed char __indexErase__ (const keyType& key, blockOffsetType blockOffset) {
+                #ifndef __KEY_VALUE_DATABASE_KEYS_ON_DISK__
+                    (void) blockOffset;
+                    return Map<keyType, blockOffsetType>::erase (key);
+                #else
+                    int i = __fingerprintIndexFind__ (key, blockOffset);
+                    if (i < 0)
+                        return i == -1 ? err_not_found : err_bad_alloc;
+                    memmove (&__fingerprintIndex__ [i], &__fingerprintIndex__ [i + 1], (__fingerprintIndexSize__ - i - 1) * sizeof (__fingerprintIndexEntry__));
+                    __fingerprintIndexSize__ --;
+                    return err_ok;
+                #endif
+            }
+
+            // the key's block has been moved to a new place
+            void __indexRelocate__ (const keyType& key, blockOffsetType oldBlockOffset, blockOffsetType newBlockOffset) {
+                #ifndef __KEY_VALUE_DATABASE_KEYS_ON_DISK__
+                    blockOffsetType *p = Map<keyType, blockOffsetType>::find_value (key);
+                    if (p && *p == oldBlockOffset)
+                        *p = newBlockOffset;
+                #else
+                    int i = __fingerprintIndexFind__ (key, oldBlockOffset);
+                    if (i >= 0)
+                        __fingerprintIndex__ [i].blockOffset = newBlockOffset;
+                #endif
+            }
+
+            // 32 bit FNV-1a hash
+            static uint32_t __fnv1a__ (const void *data, size_t length) {
+                uint32_t h = 2166136261UL;
+                for (size_t i = 0; i < length; i ++) {
+                    h ^= ((const uint8_t *) data) [i];
+                    h *= 16777619UL;
                 }
+                return h;
+            }
 
-                // read value
-                if (!skipReadingValue) {
-                    if (is_same<valueType, String>::value) { // if value is of type String ... (if anyone knows hot to do this in compile-time a feedback is welcome)
-                        // read the file until 0 is read               
-                        while (__dataFile__.available ()) { 
-                                char c = (char) __dataFile__.read (); 
-                                if (!c) break;
-                                if (!((String *) &value)->concat (c)) {
-                                    // log_e ("String value construction error err_bad_alloc");
-                                    #ifdef __USE_KEY_VALUE_DATABASE_EXCEPTIONS__
-                                        throw err_bad_alloc;
-                                    #endif
-                                    __errorFlags__ |= err_bad_alloc;
-                                    return err_bad_alloc;     
-                                }
+            #if defined (__KEY_VALUE_DATABASE_KEYS_ON_DISK__) || defined (__KEY_VALUE_DATABASE_BLOOM_FILTER_BITS_PER_KEY__)
+
+                // String keys are fingerprinted by their characters (prefixString doesn't keep them together so they are copied into __readBuffer__ first), fixed size keys by their bytes
+                bool __fingerprint__ (const keyType& key, uint32_t& fingerprint) {
+                    if (is_string<keyType>::value) { // if key is of type String ... (if anyone knows hot to do this in compile-time a feedback is welcome)
+                        size_t l = __stringLength__ (key);
+                        if (!__reserveReadBuffer__ (l + 1))
+                            return false;
+                        __stringCopy__ (key, __readBuffer__);
+                        fingerprint = __fnv1a__ (__readBuffer__, l);
+                    } else { // fixed size key
+                        fingerprint = __fnv1a__ (&key, sizeof (keyType));
+                    }
+                    return true;
+                }
+
+                bool __fingerprint__ (const char *key, uint32_t& fingerprint) {
+                    fingerprint = __fnv1a__ (key, strlen (key));
+                    return true;
+                }
+
+            #endif
+
+            #ifdef __KEY_VALUE_DATABASE_KEYS_ON_DISK__
+
+                // returns the position of the first entry with fingerprint not less than the one given
+                int __fingerprintLowerBound__ (uint32_t fingerprint) {
+                    int l = 0;
+                    int r = __fingerprintIndexSize__;
+                    while (l < r) {
+                        int m = (l + r) / 2;
+                        if (__fingerprintIndex__ [m].fingerprint < fingerprint)
+                            l = m + 1;
+                        else
+                            r = m;
+                    }
+                    return l;
+                }
+
+                // returns the position of (key's fingerprint, blockOffset) entry, -1 if it is not found or -2 if the fingerprint couldn't be calculated
+                int __fingerprintIndexFind__ (const keyType& key, blockOffsetType blockOffset) {
+                    uint32_t fingerprint;
+                    if (!__fingerprint__ (key, fingerprint))
+                        return -2;
+                    for (int i = __fingerprintLowerBound__ (fingerprint); i < __fingerprintIndexSize__ && __fingerprintIndex__ [i].fingerprint == fingerprint; i ++)
+                        if (__fingerprintIndex__ [i].blockOffset == blockOffset)
+                            return i;
+                    return -1;
+                }
+
+                // the index grows by half of its size at a time, so inserting is amortized constant apart from moving the entries behind the position
+                bool __fingerprintIndexInsert__ (int position, uint32_t fingerprint, blockOffsetType blockOffset) {
+                    if (__fingerprintIndexSize__ == __fingerprintIndexCapacity__) {
+                        int newCapacity = __fingerprintIndexCapacity__ + __fingerprintIndexCapacity__ / 2 + 8;
+                        __fingerprintIndexEntry__ *newIndex = (__fingerprintIndexEntry__ *) realloc (__fingerprintIndex__, newCapacity * sizeof (__fingerprintIndexEntry__));
+                        if (!newIndex) {
+                            // log_e ("realloc error, out of memory");
+                            return false;
                         }
-                    } else {
-                        // fixed size value               
-                        if (__dataFile__.read ((uint8_t *) &value, sizeof (value)) != sizeof (value)) {
-                            // log_e ("read value error err_file_io");
-                            #ifdef __USE_KEY_VALUE_DATABASE_EXCEPTIONS__
-                                throw err_file_io;
-                            #endif
-                            __errorFlags__ |= err_file_io;
-                            return err_file_io;      
-                        }                                
+                        __fingerprintIndex__ = newIndex;
+                        __fingerprintIndexCapacity__ = newCapacity;
                     }
+                    memmove (&__fingerprintIndex__ [position + 1], &__fingerprintIndex__ [position], (__fingerprintIndexSize__ - position) * sizeof (__fingerprintIndexEntry__));
+                    __fingerprintIndex__ [position] = {fingerprint, blockOffset};
+                    __fingerprintIndexSize__ ++;
+                    return true;
                 }
-                // log_i ("OK");            
-                return err_ok;
+
+                static int __compareFingerprints__ (const void *a, const void *b) {
+                    uint32_t fa = ((const __fingerprintIndexEntry__ *) a)->fingerprint;
+                    uint32_t fb = ((const __fingerprintIndexEntry__ *) b)->fingerprint;
+                    return fa < fb ? -1 : fa > fb;
+                }
+
+            #endif
+
+
+            #ifdef __KEY_VALUE_DATABASE_BLOOM_FILTER_BITS_PER_KEY__
+
+               /*
+                *  Bloom filter of key fingerprints. If it says the key is not there, it is not, so the index and data file don't have to be searched. The bits
+                *  are set on Insert but never cleared on Delete, so the filter gets rebuilt (from the index) when the number of keys added to it outgrows its size,
+                *  even if the number of keys stays the same.
+                *  If there is not enough memory for the filter the database just works without it.
+                */
+
+                // the number of bit positions per key that gives the lowest false positive rate, (bits per key) * ln 2
+                enum { __bloomFilterHashes__ = (int) (__KEY_VALUE_DATABASE_BLOOM_FILTER_BITS_PER_KEY__ * 0.69 + 0.5) > 0 ? (int) (__KEY_VALUE_DATABASE_BLOOM_FILTER_BITS_PER_KEY__ * 0.69 + 0.5) : 1 };
+
+                // bit positions are derived from a single fingerprint by double hashing (each next position is delta further)
+                void __bloomFilterAdd__ (uint32_t fingerprint) {
+                    uint32_t delta = (fingerprint >> 17) | (fingerprint << 15);
+                    for (int i = 0; i < __bloomFilterHashes__; i ++) {
+                        uint32_t bit = fingerprint % __bloomFilterBits__;
+                        __bloomFilter__ [bit >> 3] |= (uint8_t) (1 << (bit & 7));
+                        fingerprint += delta;
+                    }
+                }
+
+                template <class K>
+                bool __bloomFilterMayContain__ (const K& key) {
+                    uint32_t fingerprint;
+                    if (!__bloomFilter__ || !__fingerprint__ (key, fingerprint))
+                        return true; // can't tell
+                    uint32_t delta = (fingerprint >> 17) | (fingerprint << 15);
+                    for (int i = 0; i < __bloomFilterHashes__; i ++) {
+                        uint32_t bit = fingerprint % __bloomFilterBits__;
+                        if (!(__bloomFilter__ [bit >> 3] & (1 << (bit & 7))))
+                            return false;
+                        fingerprint += delta;
+                    }
+                    return true;
+                }
+
+                // called after the key has been inserted into the index
+                void __bloomFilterInsert__ (const keyType& key) {
+                    if (++ __bloomFilterAdded__ > __bloomFilterCapacity__) { // also if there is no filter yet
+                        __bloomFilterRebuild__ ();
+                        return;
+                    }
+                    uint32_t fingerprint;
+                    if (__fingerprint__ (key, fingerprint))
+                        __bloomFilterAdd__ (fingerprint);
+                    else
+                        __bloomFilterFree__ (); // can't add the key, the filter would give wrong answers
+                }
+
+                // sizes the filter for twice the current number of keys and fills it from the index
+                void __bloomFilterRebuild__ () {
+                    __bloomFilterFree__ ();
+                    int capacity = size () < 32 ? 64 : 2 * size ();
+                    uint32_t bits = ((uint32_t) capacity * __KEY_VALUE_DATABASE_BLOOM_FILTER_BITS_PER_KEY__ + 7) & ~7;
+                    __bloomFilter__ = (uint8_t *) calloc (bits >> 3, 1);
+                    if (!__bloomFilter__) {
+                        // log_e ("calloc error, out of memory, continuing without Bloom filter");
+                        return;
+                    }
+                    __bloomFilterBits__ = bits;
+                    __bloomFilterCapacity__ = capacity;
+                    __bloomFilterAdded__ = size ();
+                    #ifndef __KEY_VALUE_DATABASE_KEYS_ON_DISK__
+                        Map<keyType, blockOffsetType>& index = *this;
+                        for (auto& p: index) {
+                            uint32_t fingerprint;
+                            if (!__fingerprint__ (p.first, fingerprint)) {
+                                __bloomFilterFree__ ();
+                                return;
+                            }
+                            __bloomFilterAdd__ (fingerprint);
+                        }
+                    #else
+                        for (int i = 0; i < __fingerprintIndexSize__; i ++)
+                            __bloomFilterAdd__ (__fingerprintIndex__ [i].fingerprint);
+                    #endif
+                }
+
+                void __bloomFilterFree__ () {
+                    if (__bloomFilter__) free (__bloomFilter__);
+                    __bloomFilter__ = NULL;
+                    __bloomFilterBits__ = 0;
+                    __bloomFilterCapacity__ = 0;
+                    __bloomFilterAdded__ = 0;
+                }
+
+            #endif
+
+
+           /*
+            *  Repositions __dataFile__ pointer to blockOffset, switching to the right segment file first if the data is split into more segments.
+            *
+            *  This function does not handle the __semaphore__.
+            */
+
+            bool __seek__ (blockOffsetType blockOffset) {
+                #ifdef __KEY_VALUE_DATABASE_SEGMENT_SIZE__
+                    uint32_t segment = (uint32_t) (blockOffset >> 32);
+                    if (segment != __dataFileSegment__ || !__dataFile__)
+                        if (!__openSegment__ (segment))
+                            return false;
+                    return __dataFile__.seek ((uint32_t) blockOffset, SeekSet);
+                #else
+                    return __dataFile__.seek (blockOffset, SeekSet);
+                #endif
+            }
+
+
+           /*
+            *  Read, write and flush __dataFile__, counting the bytes and the flushes if __KEY_VALUE_DATABASE_STATISTICS__ is #defined.
+            *
+            *  These functions do not handle the __semaphore__.
+            */
+
+            size_t __read__ (uint8_t *buffer, size_t size) {
+                size_t bytesRead = __dataFile__.read (buffer, size);
+                #ifdef __KEY_VALUE_DATABASE_STATISTICS__
+                    __statistics__.bytesRead += bytesRead;
+                #endif
+                return bytesRead;
+            }
+
+            int __readByte__ () {
+                #ifdef __KEY_VALUE_DATABASE_STATISTICS__
+                    __statistics__.bytesRead ++;
+                #endif
+                return __dataFile__.read ();
+            }
+
+            size_t __write__ (const uint8_t *buffer, size_t size) {
+                size_t bytesWritten = __dataFile__.write (buffer, size);
+                #ifdef __KEY_VALUE_DATABASE_STATISTICS__
+                    __statistics__.bytesWritten += bytesWritten;
+                #endif
+                return bytesWritten;
+            }
+
+            void __flush__ () {
+                __dataFile__.flush ();
+                #ifdef __KEY_VALUE_DATABASE_STATISTICS__
+                    __statistics__.flushes ++;
+                #endif
+            }
+
+            // counts the lookup and whether it has found the key, if __KEY_VALUE_DATABASE_STATISTICS__ is #defined
+            void __countLookup__ (signed char e) {
+                #ifdef __KEY_VALUE_DATABASE_STATISTICS__
+                    __statistics__.lookups ++;
+                    if (!e)
+                        __statistics__.hits ++;
+                    else if (e == err_not_found)
+                        __statistics__.misses ++;
+                #else
+                    (void) e;
+                #endif
+            }
+
+
+           /*
+            *  Times FindValue, Insert, Update and Delete: it takes the lock when it is constructed (so the wait for it is included) and releases it when
+            *  it is destructed, stop records the latency into the histogram and calls the trace callback function. Without __KEY_VALUE_DATABASE_LATENCY_HISTOGRAMS__
+            *  and __KEY_VALUE_DATABASE_TRACE__ it does nothing.
+            */
+
+            #if defined (__KEY_VALUE_DATABASE_LATENCY_HISTOGRAMS__) || defined (__KEY_VALUE_DATABASE_TRACE__)
+
+                struct __operationTimer__ {
+                    keyValueDatabase *__kvdb__;
+                    traceOperation __operation__;
+                    unsigned long __started__;
+
+                    __operationTimer__ (keyValueDatabase *kvdb, traceOperation operation) : __kvdb__ (kvdb), __operation__ (operation), __started__ (micros ()) { kvdb->Lock (); }
+                    ~__operationTimer__ () { __kvdb__->Unlock (); }
+
+                    signed char stop (signed char e) { return stop (e, __operation__); }
+
+                    // the operations that do one or another (like Upsert) are timed as the one they have done
+                    signed char stop (signed char e, traceOperation operation) { 
+                        __kvdb__->__operationDone__ (operation, micros () - __started__, e);
+                        return e;
+                    }
+                };
+
+            #else
+
+                struct __operationTimer__ {
+                    __operationTimer__ (keyValueDatabase *, traceOperation) {}
+                    signed char stop (signed char e) { return e; }
+                    signed char stop (signed char e, traceOperation) { return e; }
+                };
+
+            #endif
+
+            void __operationDone__ (traceOperation operation, uint32_t latency, signed char e) {
+                (void) operation; (void) latency; (void) e; // not all of them are used, depending on what is #defined
+                #ifdef __KEY_VALUE_DATABASE_LATENCY_HISTOGRAMS__
+                    __latencyHistograms__ [operation].record (latency);
+                #endif
+                #ifdef __KEY_VALUE_DATABASE_TRACE__
+                    if (__traceCallback__)
+                        __traceCallback__ (operation, latency, e);
+                #endif
+            }
+
+            #ifdef __KEY_VALUE_DATABASE_LATENCY_HISTOGRAMS__
+
+                // appends formatted text to the report in buffer, as much as fits
+                static void __reportAppend__ (char *buffer, size_t size, size_t& length, const char *format, ...) {
+                    if (length >= size - 1)
+                        return;
+                    va_list args;
+                    va_start (args, format);
+                    int n = vsnprintf (buffer + length, size - length, format, args);
+                    va_end (args);
+                    if (n > 0)
+                        length = length + n < size - 1 ? length + n : size - 1;
+                }
+
+            #endif
+
+
+           /*
+            *  Returns the offset where a new block of blockSize bytes is going to be appended, starting a new segment file if needed.
+            *  __blockAppended__ should be called after the block is successfully written.
+            */
+
+            blockOffsetType __appendBlockOffset__ (size_t blockSize) {
+                #ifdef __KEY_VALUE_DATABASE_SEGMENT_SIZE__
+                    if (__lastSegmentSize__ > 0 && (uint64_t) __lastSegmentSize__ + blockSize > __KEY_VALUE_DATABASE_SEGMENT_SIZE__) { // roll over to a new segment file
+                        __lastSegment__ ++;
+                        __lastSegmentSize__ = 0;
+                    }
+                    return ((blockOffsetType) __lastSegment__ << 32) | __lastSegmentSize__;
+                #else
+                    (void) blockSize;
+                    return __dataFileSize__;
+                #endif
+            }
+
+            void __blockAppended__ (size_t blockSize) {
+                __dataFileSize__ += blockSize;
+                __appendedBytes__ += blockSize;
+                #ifdef __KEY_VALUE_DATABASE_SEGMENT_SIZE__
+                    __lastSegmentSize__ += blockSize;
+                #endif
             }
 
+
+            #ifdef __KEY_VALUE_DATABASE_SEGMENT_SIZE__
+
+               /*
+                *  Segment 0 is stored in dataFileName, the following segments in dataFileName.1, dataFileName.2, ...
+                */
+
+                const char *__segmentFileName__ (uint32_t segment) {
+                    if (segment == 0)
+                        return __dataFileName__;
+                    snprintf (__segmentFileNameBuffer__, sizeof (__segmentFileNameBuffer__), "%s.%lu", __dataFileName__, (unsigned long) segment);
+                    return __segmentFileNameBuffer__;
+                }
+
+               /*
+                *  Opens (or creates if it doesn't exist yet) the segment file as __dataFile__. There is only one segment file opened at a time, so
+                *  the database doesn't use more file handles than it would with a single data file.
+                */
+
+                bool __openSegment__ (uint32_t segment) {
+                    if (__dataFile__) __dataFile__.close ();
+                    const char *segmentFileName = __segmentFileName__ (segment);
+                    __dataFile__ = fileSystem.open (segmentFileName, "r+");
+                    if (!__dataFile__) {
+                        __dataFile__ = fileSystem.open (segmentFileName, "w");
+                        if (__dataFile__) {
+                            __dataFile__.close ();
+                            __dataFile__ = fileSystem.open (segmentFileName, "r+");
+                        }
+                    }
+                    __dataFileSegment__ = segment;
+                    return __dataFile__;
+                }
+
+            #endif
+
     };
 
 
@@ -15,12 +15,17 @@
 #ifndef __MAP_HPP__
     #define __MAP_HPP__
 
+    #include "inlineString.hpp"
+    #include "prefixString.hpp"
+
     // ----- TUNNING PARAMETERS -----
 
     #define __MAP_MAX_STACK_SIZE__ 32 // statically allocated stack needed for iterating through elements, 24 should be enough for the number of elemetns that fit into ESP32's memory
 
     // #define __USE_MAP_EXCEPTIONS__   // uncomment this line if you want Map to throw exceptions
 
+    // #define __MAP_ORDER_STATISTICS__ // uncomment this line if you want Map nodes to keep the sizes of their subtrees, so that select, rank and count run in O (log n)
+
 
     // error flags: there are only two types of error flags that can be set: OVERFLOW and OUT_OF_RANGE - please note that all errors are negative (char) numbers
     #define err_ok              ((signed char) 0b00000000)  //    0 - no error
@@ -76,12 +81,11 @@
                 Map (std::initializer_list<Pair> il) {
                     for (auto i: il) {
 
-                        if (is_same<keyType, String>::value)   // if key is of type String ... (if anyone knows hot to do this in compile-time a feedback is welcome)
-                            if (!*(String *) &i.first) {                           // ... check if parameter construction is valid
-                                // log_e ("BAD_ALLOC");
-                                __errorFlags__ = err_bad_alloc;         // report error if it is not
-                                return;
-                            }
+                        if (!__isKeyValid__ (i.first)) {                           // check if String key parameter construction is valid
+                            // log_e ("BAD_ALLOC");
+                            __errorFlags__ = err_bad_alloc;         // report error if it is not
+                            return;
+                        }
 
                         if (is_same<valueType, String>::value) // if value is of type String ... (if anyone knows hot to do this in compile-time a feedback is welcome)
                             if (!*(String *) &i.second) {                         // ... check if parameter construction is valid
@@ -91,7 +95,7 @@
                             }
 
                         __balancedBinarySearchTreeNode__ *pInserted = NULL; 
-                        signed char h = __insert__ (&__root__, i.first, i.second, &pInserted);
+                        signed char h = __insert__ (&__root__, i.first, &pInserted, i.second);
                         if  (h >= 0)  // OK, h contains the balanced binary search tree height 
                             __height__ = h;
                     }
@@ -148,7 +152,7 @@
                 // copy other's elements
                 for (auto e: other) {
                     __balancedBinarySearchTreeNode__ *pInserted = NULL; 
-                    int h = this->__insert__ (&__root__, e.first, e.second, &pInserted); if  (h >= 0) __height__ = h;
+                    int h = this->__insert__ (&__root__, e.first, &pInserted, e.second); if  (h >= 0) __height__ = h;
                 }
                 // copy the error flags as well
                 __errorFlags__ |= other.__errorFlags__;
@@ -170,15 +174,14 @@
                 // copy other's pairs
                 for (auto e: other) {
 
-                    if (is_same<keyType, String>::value)     // if key is of type String ... (if anyone knows hot to do this in compile-time a feedback is welcome)
-                        if (!*(String *) &e.first) {                            // ... check if parameter construction is valid
-                            // log_e ("BAD_ALLOC");
-                            #ifdef __USE_MAP_EXCEPTIONS__
-                                throw err_bad_alloc;
-                            #endif
-                            __errorFlags__ |= err_bad_alloc;          // report error if it is not
-                            return this;
-                        }
+                    if (!__isKeyValid__ (e.first)) {                            // check if String key parameter construction is valid
+                        // log_e ("BAD_ALLOC");
+                        #ifdef __USE_MAP_EXCEPTIONS__
+                            throw err_bad_alloc;
+                        #endif
+                        __errorFlags__ |= err_bad_alloc;          // report error if it is not
+                        return this;
+                    }
 
                     if (is_same<valueType, String>::value)   // if value is of type String ... (if anyone knows hot to do this in compile-time a feedback is welcome)
                         if (!*(String *) &e.second) {                          // ... check if parameter construction is valid
@@ -191,7 +194,7 @@
                         }
 
                     __balancedBinarySearchTreeNode__ *pInserted = NULL; 
-                    int h = this->__insert__ (&__root__, e.first, e.second, &pInserted); if  (h >= 0) __height__ = h;
+                    int h = this->__insert__ (&__root__, e.first, &pInserted, e.second); if  (h >= 0) __height__ = h;
                 }
                 // copy the error flags as well
                 __errorFlags__ |= other.__errorFlags__;
@@ -211,20 +214,19 @@
             *  Error handling can be somewhat tricky. It may be a good idea to use __USE_MAP_EXCEPTIONS__ if using [] operator.
             */
 
-            valueType &operator [] (keyType key) {
+            valueType &operator [] (const keyType& key) {
                 static valueType dummyValue1 = {};
                 static valueType dummyValue2 = {};
 
-                if (is_same<keyType, String>::value)      // if key is of type String ... (if anyone knows hot to do this in compile-time a feedback is welcome)
-                    if (!*(String *) &key) {              // ... check if parameter construction is valid
-                        // log_e ("BAD_ALLOC");
-                        #ifdef __USE_MAP_EXCEPTIONS__
-                            throw err_bad_alloc;
-                        #endif
-                        __errorFlags__ |= err_bad_alloc;  // report error if it is not
-                        dummyValue1 = dummyValue2;
-                        return dummyValue1;               // operator must return a reference, so return the reference to dummy value (make a copy of the default value first)
-                    }
+                if (!__isKeyValid__ (key)) {              // check if String key parameter construction is valid
+                    // log_e ("BAD_ALLOC");
+                    #ifdef __USE_MAP_EXCEPTIONS__
+                        throw err_bad_alloc;
+                    #endif
+                    __errorFlags__ |= err_bad_alloc;  // report error if it is not
+                    dummyValue1 = dummyValue2;
+                    return dummyValue1;               // operator must return a reference, so return the reference to dummy value (make a copy of the default value first)
+                }
 
                 // find the right pair
                 __balancedBinarySearchTreeNode__ *p = __root__;
@@ -239,7 +241,7 @@
                 }
                 // else                               // 4. case: not found, else insert a new pair
                 __balancedBinarySearchTreeNode__ *pInserted = NULL; 
-                signed char h = __insert__ (&__root__, key, dummyValue2, &pInserted);
+                signed char h = __insert__ (&__root__, key, &pInserted);
                 if  (h >= 0) {  // OK, h contains the balanced binary search tree height 
                     __height__ = h;
                     return pInserted->pair.second;
@@ -256,17 +258,16 @@
             *  Returns OK if succeeds and error err_not_found or err_bad_alloc if String key parameter could not be constructed.
             */
 
-            signed char erase (keyType key) { 
+            signed char erase (const keyType& key) { 
 
-                if (is_same<keyType, String>::value)   // if key is of type String ... (if anyone knows hot to do this in compile-time a feedback is welcome)
-                    if (!*(String *) &key) {                 // ... check if parameter construction is valid
-                        // log_e ("BAD_ALLOC");
-                        #ifdef __USE_MAP_EXCEPTIONS__
-                            throw err_bad_alloc;
-                        #endif
-                        __errorFlags__ |= err_bad_alloc;        // report error if it is not
-                        return err_bad_alloc;                   // report error if it is not
-                    }
+                if (!__isKeyValid__ (key)) {                 // check if String key parameter construction is valid
+                    // log_e ("BAD_ALLOC");
+                    #ifdef __USE_MAP_EXCEPTIONS__
+                        throw err_bad_alloc;
+                    #endif
+                    __errorFlags__ |= err_bad_alloc;        // report error if it is not
+                    return err_bad_alloc;                   // report error if it is not
+                }
 
                 signed char h = __erase__ (&__root__, key); 
                 if  (h >= 0) {  // OK, h contains the balanced binary search tree height 
@@ -280,19 +281,21 @@
 
            /*
             *  Inserts a new Map pair, returns OK or one of the errors.
+            *
+            *  Parameters are passed by reference so they only get copied once - into the new node. If they are temporary (rvalues), like in
+            *  mp.insert (String ("key"), String ("value")), they get moved into the new node instead of being copied.
             */
 
-            signed char insert (Pair pair) { 
+            signed char insert (const Pair& pair) { 
 
-                if (is_same<keyType, String>::value)   // if key is of type String ... (if anyone knows hot to do this in compile-time a feedback is welcome)
-                    if (!*(String *) &pair.first) {                        // ... check if parameter construction is valid
-                        // log_e ("BAD_ALLOC");
-                        #ifdef __USE_MAP_EXCEPTIONS__
-                            throw err_bad_alloc;
-                        #endif
-                        __errorFlags__ |= err_bad_alloc;        // report error if it is not
-                        return err_bad_alloc;                   // report error if it is not
-                    }
+                if (!__isKeyValid__ (pair.first)) {                        // check if String key parameter construction is valid
+                    // log_e ("BAD_ALLOC");
+                    #ifdef __USE_MAP_EXCEPTIONS__
+                        throw err_bad_alloc;
+                    #endif
+                    __errorFlags__ |= err_bad_alloc;        // report error if it is not
+                    return err_bad_alloc;                   // report error if it is not
+                }
 
                 if (is_same<valueType, String>::value) // if value is of type String ... (if anyone knows hot to do this in compile-time a feedback is welcome)
                     if (!*(String *) &pair.second) {                      // ... check if parameter construction is valid
@@ -305,7 +308,7 @@
                     }
 
                 __balancedBinarySearchTreeNode__ *pInserted = NULL; 
-                int h = __insert__ (&__root__, pair.first, pair.second, &pInserted);                 
+                int h = __insert__ (&__root__, pair.first, &pInserted, pair.second);                 
                 if  (h >= 0) {  // OK, h contains the balanced binary search tree height 
                     __height__ = h;
                     return err_ok;
@@ -313,35 +316,64 @@
                     return h;
             }
 
-            signed char insert (keyType key, valueType value) { 
+            signed char insert (const keyType& key, const valueType& value) { return emplace (key, value); }
 
-                if (is_same<keyType, String>::value)   // if key is of type String ... (if anyone knows hot to do this in compile-time a feedback is welcome)
-                    if (!*(String *) &key) {                             // ... check if parameter construction is valid
-                        // log_e ("BAD_ALLOC");
-                        #ifdef __USE_MAP_EXCEPTIONS__
-                            throw err_bad_alloc;
-                        #endif
-                        __errorFlags__ |= err_bad_alloc;        // report error if it is not
-                        return err_bad_alloc;                   // report error if it is not
-                    }
+            signed char insert (keyType&& key, valueType&& value) { return emplace ((keyType&&) key, (valueType&&) value); }
 
-                if (is_same<valueType, String>::value) // if value is of type String ... (if anyone knows hot to do this in compile-time a feedback is welcome)
-                    if (!*(String *) &value) {               // ... check if parameter construction is valid
-                        // log_e ("BAD_ALLOC");
+
+           /*
+            *  Inserts a new Map pair constructing the value in place (in the new node) from valueArgs, like:
+            *
+            *    mp.emplace (1, "one");
+            *
+            *  Returns OK or one of the errors.
+            */
+
+            template <class... Args>
+            signed char emplace (const keyType& key, Args&&... valueArgs) { return __emplace__ (key, (Args&&) valueArgs...); }
+
+            template <class... Args>
+            signed char emplace (keyType&& key, Args&&... valueArgs) { return __emplace__ ((keyType&&) key, (Args&&) valueArgs...); }
+
+
+           /*
+            *  Replaces Map content with pairs that are already sorted by their keys, like:
+            *
+            *    Map<int, String>::Pair pairs [] = { {1, "one"}, {2, "two"}, {3, "three"} };
+            *    mp.build_from_sorted (pairs, pairs + 3);
+            *
+            *  The pairs are given as a range of pointers (or random access iterators, like vector's) from first to last (not included). Since the
+            *  middle pair of each (sub)range becomes the root of its subtree, the tree is built in O(n) time and it is balanced without any rotations.
+            *
+            *  Returns OK or one of the errors:
+            *    - err_not_unique if keys are not sorted in ascending order or not unique (Map is left unchanged then)
+            *    - err_bad_alloc if out of memory (Map is left empty then)
+            */
+
+            template <class pairIterator>
+            signed char build_from_sorted (pairIterator first, pairIterator last) {
+                int count = last - first;
+
+                // check the order first, so nothing gets changed if the pairs can't be used
+                for (int i = 1; i < count; i++)
+                    if (!((*(first + (i - 1))).first < (*(first + i)).first)) {
+                        // log_e ("NOT_UNIQUE");
                         #ifdef __USE_MAP_EXCEPTIONS__
-                            throw err_bad_alloc;
+                            throw err_not_unique;
                         #endif
-                        __errorFlags__ |= err_bad_alloc;        // report error if it is not
-                        return err_bad_alloc;                   // report error if it is not
+                        __errorFlags__ |= err_not_unique;
+                        return err_not_unique;
                     }
 
-                __balancedBinarySearchTreeNode__ *pInserted = NULL;
-                int h = __insert__ (&__root__, key, value, &pInserted);
-                if  (h >= 0) {  // OK, h contains the balanced binary search tree height
-                    __height__ = h;
-                    return err_ok;
-                } else
+                __clear__ (&__root__);
+                __height__ = 0;
+                int h = __buildFromSorted__ (&__root__, first, count);
+                if (h < 0) { // < 0 means an error, release what has already been built
+                    __clear__ (&__root__);
                     return h;
+                }
+                __height__ = h;
+                return err_ok;
             }
     
         
@@ -380,7 +412,7 @@
                 }
 
                 // find the key, construct the stack meanwhile
-                iterator (keyType key, Map* mp) {
+                iterator (const keyType& key, Map* mp) {
                     __mp__ = mp;
 
                     if (__mp__->size () == 0)
@@ -405,6 +437,91 @@
                     __lastVisitedPair__ = NULL;
                 }
 
+                // find the String key given as characters without constructing a String, construct the stack meanwhile
+                iterator (const char *key, size_t keyLength, Map* mp) {
+                    __mp__ = mp;
+
+                    if (__mp__->size () == 0)
+                        return;
+                    // else
+
+                    Map::__balancedBinarySearchTreeNode__* p = mp->__root__;
+                    while (p) {
+                        __stack__ [++ __stackPointer__] = p;            
+
+                        int c = __compareKeys__ (key, keyLength, p->pair.first);
+                        if (c < 0) 
+                            p = p->leftSubtree;                                 // 1. case: continue searching in left subtree
+                        else if (c > 0) 
+                            p = p->rightSubtree;                                // 2. case: continue searching in reight subtree
+                        else {
+                            __lastVisitedPair__ = __stack__ [__stackPointer__]; // 3. case: found, return the reference ot the value,  remember the last visited pair
+                            return;
+                        }
+                    }
+
+                    __stackPointer__ = -1;                                      // 4. case: not found
+                    __lastVisitedPair__ = NULL;
+                }
+
+                #ifdef __MAP_ORDER_STATISTICS__
+                    // position the (end) iterator to the index-th pair in key order (counting from 0), construct the stack meanwhile
+                    iterator& __select__ (int index) {
+                        Map* mp = __mp__;
+
+                        if (index < 0 || index >= __mp__->size ())
+                            return *this;
+                        // else
+
+                        Map::__balancedBinarySearchTreeNode__* p = mp->__root__;
+                        while (p) {
+                            __stack__ [++ __stackPointer__] = p;            
+
+                            int leftSize = Map::__subtreeSize__ (p->leftSubtree);
+                            if (index < leftSize) {
+                                p = p->leftSubtree;                                 // 1. case: continue searching in left subtree
+                            } else if (index > leftSize) {
+                                index -= leftSize + 1;                              // 2. case: continue searching in reight subtree, skip left subtree and the node
+                                p = p->rightSubtree;
+                            } else {
+                                __lastVisitedPair__ = p;                            // 3. case: found
+                                return *this;
+                            }
+                        }
+                        return *this;
+                    }
+                #endif
+
+                // find the first pair with the key greater than (forward) or the last pair with the key lesser than (backward) the key, or the pair with
+                // the same key (orEqual), construct the stack meanwhile
+                iterator (const keyType& key, Map* mp, bool forward, bool orEqual) {
+                    __mp__ = mp;
+
+                    int8_t found = -1;                                          // the stack position of the best pair found so far
+                    Map::__balancedBinarySearchTreeNode__* p = mp->__root__;
+                    while (p) {
+                        __stack__ [++ __stackPointer__] = p;            
+
+                        if (key < p->pair.first) {                              // 1. case: the node's key is greater, continue searching in left subtree for a lesser one
+                            if (forward) found = __stackPointer__;
+                            p = p->leftSubtree;
+                        } else if (p->pair.first < key) {                       // 2. case: the node's key is lesser, continue searching in right subtree for a greater one
+                            if (!forward) found = __stackPointer__;
+                            p = p->rightSubtree;
+                        } else if (orEqual) {                                   // 3. case: the same key is what we are looking for
+                            found = __stackPointer__;
+                            break;
+                        } else {                                                // 4. case: the same key, the neighbour is in one of the subtrees (or above)
+                            p = forward ? p->rightSubtree : p->leftSubtree;
+                        }
+                    }
+
+                    // the stack above the found pair is not needed (and must not be mistaken for already visited subtree by ++ and --)
+                    while (__stackPointer__ > found)
+                        __stack__ [__stackPointer__ --] = NULL;
+                    __lastVisitedPair__ = found >= 0 ? __stack__ [found] : NULL;
+                }
+
 
                 // * operator
                 Pair& operator *() { return (__lastVisitedPair__->pair); }
@@ -522,19 +639,198 @@
             *        Serial.println ("not found");
             */
             
-            iterator find (keyType key) {
+            iterator find (const keyType& key) {
+
+                if (!__isKeyValid__ (key)) {              // check if String key parameter construction is valid
+                    // log_e ("BAD_ALLOC");
+                    #ifdef __USE_MAP_EXCEPTIONS__
+                        throw err_bad_alloc;
+                    #endif
+                    __errorFlags__ |= err_bad_alloc;  // report error if it is not
+                    return end ();
+                }
+
+                return iterator (key, this);
+            }
+
+
+           /*
+            *  Finds String key given as characters (with or without their length) without constructing a temporary String, so no heap allocation is needed, like:
+            *
+            *    auto it = mpS.find ("SSID");
+            */
+
+            iterator find (const char *key) {
+                if (!key) {                               // the same as String (NULL) would be
+                    // log_e ("BAD_ALLOC");
+                    #ifdef __USE_MAP_EXCEPTIONS__
+                        throw err_bad_alloc;
+                    #endif
+                    __errorFlags__ |= err_bad_alloc;
+                    return end ();
+                }
+
+                return iterator (key, strlen (key), this);
+            }
+
+            iterator find (const char *key, size_t keyLength) {
+                if (!key) {                               // the same as String (NULL) would be
+                    // log_e ("BAD_ALLOC");
+                    #ifdef __USE_MAP_EXCEPTIONS__
+                        throw err_bad_alloc;
+                    #endif
+                    __errorFlags__ |= err_bad_alloc;
+                    return end ();
+                }
+
+                return iterator (key, keyLength, this);
+            }
+
+
+           /*
+            *  Return iterators to the neighbours of the key in O (log n), or end () if there is no such pair:
+            *
+            *    - lower_bound (key) or ceiling (key) to the first pair with the key >= key
+            *    - upper_bound (key) to the first pair with the key > key
+            *    - floor (key) to the last pair with the key <= key
+            *
+            *  The iterators may be moved in both directions from there, -- lower_bound (key) gets the last pair with the key < key, for example:
+            *
+            *    for (auto it = mpB.lower_bound (from); it != mpB.end () && it->first < to; ++ it) 
+            *        Serial.println (it->second); 
+            */
+
+            iterator lower_bound (const keyType& key) { return __bound__ (key, true, true); }
+
+            iterator upper_bound (const keyType& key) { return __bound__ (key, true, false); }
+
+            iterator floor (const keyType& key) { return __bound__ (key, false, true); }
+
+            iterator ceiling (const keyType& key) { return __bound__ (key, true, true); }
+
+
+           /*
+            *  Order statistics, available if __MAP_ORDER_STATISTICS__ is #defined (each node keeps the size of its subtree then, which costs an int per node):
+            *
+            *    - select (i) returns an iterator to the i-th pair in key order (counting from 0) or end () if there is no such pair
+            *    - rank (key) returns the number of pairs with the keys < key (which is also the position of the key if it exists)
+            *    - count (from, to) returns the number of pairs with from <= keys < to, by two rank lookups (so not in constant time)
+            *
+            *  All of them run in O (log n), so paginating through Map is cheap, for example:
+            *
+            *    int i = 0;
+            *    for (auto it = mpB.select (page * pageSize); it != mpB.end () && i < pageSize; ++ it, i ++) 
+            *        Serial.println (it->second); 
+            */
+
+            #ifdef __MAP_ORDER_STATISTICS__
+
+                iterator select (int i) { return end ().__select__ (i); }
 
-                if (is_same<keyType, String>::value)      // if key is of type String ... (if anyone knows hot to do this in compile-time a feedback is welcome)
-                    if (!*(String *) &key) {              // ... check if parameter construction is valid
+                int rank (const keyType& key) {
+
+                    if (!__isKeyValid__ (key)) {              // check if String key parameter construction is valid
                         // log_e ("BAD_ALLOC");
                         #ifdef __USE_MAP_EXCEPTIONS__
                             throw err_bad_alloc;
                         #endif
                         __errorFlags__ |= err_bad_alloc;  // report error if it is not
-                        return end ();
+                        return 0;
                     }
 
-                return iterator (key, this);
+                    int r = 0;
+                    __balancedBinarySearchTreeNode__ *p = __root__;
+                    while (p != NULL) {
+                        if (key < p->pair.first) {
+                            p = p->leftSubtree;                                 // 1. case: continue searching in left subtree
+                        } else if (p->pair.first < key) {
+                            r += __subtreeSize__ (p->leftSubtree) + 1;          // 2. case: left subtree and the node are lesser, continue searching in reight subtree
+                            p = p->rightSubtree;
+                        } else {
+                            return r + __subtreeSize__ (p->leftSubtree);        // 3. case: found, only left subtree is lesser
+                        }
+                    }
+                    return r;
+                }
+
+                int count (const keyType& from, const keyType& to) { 
+                    int c = rank (to) - rank (from);
+                    return c > 0 ? c : 0;
+                }
+
+            #endif
+
+
+           /*
+            *  Returns a pointer to the value of the pair with the key or NULL if the key is not found. Unlike find it doesn't construct an iterator
+            *  (and fill its stack), so this is the fastest way to get to the value when only the value is needed, like:
+            *
+            *    int *v = mpB.find_value (1);
+            *    if (v) 
+            *        Serial.println (*v); 
+            *    else 
+            *        Serial.println ("not found");
+            *
+            *  String keys may also be given as characters, like mpS.find_value ("SSID").
+            */
+
+            valueType *find_value (const keyType& key) {
+
+                if (!__isKeyValid__ (key)) {              // check if String key parameter construction is valid
+                    // log_e ("BAD_ALLOC");
+                    #ifdef __USE_MAP_EXCEPTIONS__
+                        throw err_bad_alloc;
+                    #endif
+                    __errorFlags__ |= err_bad_alloc;  // report error if it is not
+                    return NULL;
+                }
+
+                __balancedBinarySearchTreeNode__ *p = __root__;
+                while (p != NULL) {
+                    if (key < p->pair.first) 
+                        p = p->leftSubtree;           // 1. case: continue searching in left subtree
+                    else if (p->pair.first < key) 
+                        p = p->rightSubtree;          // 2. case: continue searching in reight subtree
+                    else 
+                        return &(p->pair.second);     // 3. case: found
+                }
+                return NULL;                          // 4. case: not found
+            }
+
+            valueType *find_value (const char *key) {
+                if (!key) {                               // the same as String (NULL) would be
+                    // log_e ("BAD_ALLOC");
+                    #ifdef __USE_MAP_EXCEPTIONS__
+                        throw err_bad_alloc;
+                    #endif
+                    __errorFlags__ |= err_bad_alloc;
+                    return NULL;
+                }
+
+                return find_value (key, strlen (key));
+            }
+
+            valueType *find_value (const char *key, size_t keyLength) {
+                if (!key) {                               // the same as String (NULL) would be
+                    // log_e ("BAD_ALLOC");
+                    #ifdef __USE_MAP_EXCEPTIONS__
+                        throw err_bad_alloc;
+                    #endif
+                    __errorFlags__ |= err_bad_alloc;
+                    return NULL;
+                }
+
+                __balancedBinarySearchTreeNode__ *p = __root__;
+                while (p != NULL) {
+                    int c = __compareKeys__ (key, keyLength, p->pair.first);
+                    if (c < 0) 
+                        p = p->leftSubtree;           // 1. case: continue searching in left subtree
+                    else if (c > 0) 
+                        p = p->rightSubtree;          // 2. case: continue searching in reight subtree
+                    else 
+                        return &(p->pair.second);     // 3. case: found
+                }
+                return NULL;                          // 4. case: not found
             }
 
 
@@ -548,6 +844,9 @@
                 __balancedBinarySearchTreeNode__ *rightSubtree;
                 int8_t leftSubtreeHeight;
                 int8_t rightSubtreeHeight;
+                #ifdef __MAP_ORDER_STATISTICS__
+                    int subtreeSize;                        // the number of nodes in the subtree with this node as its root
+                #endif
             };
     
             __balancedBinarySearchTreeNode__ *__root__ = NULL; 
@@ -558,25 +857,112 @@
             valueType __dummyValue1__ = {};            
             valueType __dummyValue2__ = {};          
 
+            iterator __bound__ (const keyType& key, bool forward, bool orEqual) {
+
+                if (!__isKeyValid__ (key)) {              // check if String key parameter construction is valid
+                    // log_e ("BAD_ALLOC");
+                    #ifdef __USE_MAP_EXCEPTIONS__
+                        throw err_bad_alloc;
+                    #endif
+                    __errorFlags__ |= err_bad_alloc;  // report error if it is not
+                    return end ();
+                }
+
+                return iterator (key, this, forward, orEqual);
+            }
+
             // Mega and Uno do no thave is_same implemented, so we have tio imelement it ourselves: https://stackoverflow.com/questions/15200516/compare-typedef-is-same-type
             template<typename T, typename U> struct is_same { static const bool value = false; };
             template<typename T> struct is_same<T, T> { static const bool value = true; };
 
             // internal functions
-            
-            signed char __insert__ (__balancedBinarySearchTreeNode__ **p, keyType& key, valueType& value, __balancedBinarySearchTreeNode__ **pInserted) { // returns the height of balanced binary search tree or error
-                // 1. case: a leaf has been reached - add new node here
-                if ((*p) == NULL) {
-                    // log_i ("a leaf has been reached - add new node here");
-                  
-                    // different ways of allocation the memory for a new node
-                    #if MAP_MEMORY_TYPE == PSRAM_MEM
-                        __balancedBinarySearchTreeNode__ *n = (__balancedBinarySearchTreeNode__ *) ps_malloc (sizeof (__balancedBinarySearchTreeNode__));
-                    #else
-                        __balancedBinarySearchTreeNode__ *n = (__balancedBinarySearchTreeNode__ *) malloc (sizeof (__balancedBinarySearchTreeNode__));
+
+           /*
+            *  Compares characters with String (or inlineString, prefixString) key the same way as Strings compare among themselves (only these keys can be compared this way).
+            *  Returns < 0 if characters come before the key, 0 if they are equal and > 0 if they come after.
+            */
+
+            static int __compareKeys__ (const char *key, size_t keyLength, const String& nodeKey) {
+                size_t l = nodeKey.length ();
+                int c = memcmp (key, nodeKey.c_str (), keyLength < l ? keyLength : l);
+                if (c) return c;
+                return keyLength < l ? -1 : keyLength > l;
+            }
+
+            template <size_t N>
+            static int __compareKeys__ (const char *key, size_t keyLength, const inlineString<N>& nodeKey) { return -nodeKey.compareTo (key, keyLength); }
+
+            template <size_t N>
+            static int __compareKeys__ (const char *key, size_t keyLength, const prefixString<N>& nodeKey) { return -nodeKey.compareTo (key, keyLength); }
+
+            template <class T>
+            static int __compareKeys__ (const char *key, size_t keyLength, const T& nodeKey) { return -1; } // other keys can't be compared with characters, so they are never found
+
+
+           /*
+            *  String keys (String, inlineString and prefixString) may fail to construct if the controller runs out of memory, other keys can't.
+            */
+
+            static bool __isKeyValid__ (const String& key) { return !!key; }
+
+            template <size_t N>
+            static bool __isKeyValid__ (const inlineString<N>& key) { return !!key; }
+
+            template <size_t N>
+            static bool __isKeyValid__ (const prefixString<N>& key) { return !!key; }
+
+            template <class T>
+            static bool __isKeyValid__ (const T&) { return true; }
+
+            template <class K, class... Args>
+            signed char __emplace__ (K&& key, Args&&... valueArgs) { 
+
+                if (!__isKeyValid__ (key)) {                             // check if String key parameter construction is valid
+                    // log_e ("BAD_ALLOC");
+                    #ifdef __USE_MAP_EXCEPTIONS__
+                        throw err_bad_alloc;
                     #endif
+                    __errorFlags__ |= err_bad_alloc;        // report error if it is not
+                    return err_bad_alloc;                   // report error if it is not
+                }
 
-                    if (n == NULL) {
+                __balancedBinarySearchTreeNode__ *pInserted = NULL;
+                int h = __insert__ (&__root__, (K&&) key, &pInserted, (Args&&) valueArgs...);
+                if  (h >= 0) {  // OK, h contains the balanced binary search tree height
+                    __height__ = h;
+                    return err_ok;
+                } else
+                    return h;
+            }
+
+           /*
+            *  Balanced binary search tree is maintained iteratively: the way from the root to the place of change is remembered in a small fixed array of links
+            *  (pointers to leftSubtree, rightSubtree or __root__ that point to the nodes on the way) and then the heights are corrected and the (sub)trees
+            *  rebalanced on the way back. No recursion is needed so the stack usage doesn't depend on the height of the tree.
+            */
+
+            template <class K, class... Args>
+            signed char __insert__ (__balancedBinarySearchTreeNode__ **p, K&& key, __balancedBinarySearchTreeNode__ **pInserted, Args&&... valueArgs) { // p = root of the tree, returns the height of balanced binary search tree or error
+                __balancedBinarySearchTreeNode__ **way [__MAP_MAX_STACK_SIZE__];
+                int8_t wayLength = 0;
+
+                // 1. find a leaf where the new node belongs, remember the way to it
+                while (*p != NULL) {
+                    if (key < (*p)->pair.first) {
+                        way [wayLength ++] = p;
+                        p = &((*p)->leftSubtree);
+                    } else if ((*p)->pair.first < key) {
+                        way [wayLength ++] = p;
+                        p = &((*p)->rightSubtree);
+                    } else { // the node with the same key already exists 
+                        // log_e ("NOT_UNIQUE");
+                        #ifdef __USE_MAP_EXCEPTIONS__
+                            throw err_not_unique;
+                        #endif
+                        __errorFlags__ |= err_not_unique;
+                        return err_not_unique;
+                    }
+                    if (wayLength == __MAP_MAX_STACK_SIZE__) { // the tree would get too high to iterate through it
                         // log_e ("BAD_ALLOC");
                         #ifdef __USE_MAP_EXCEPTIONS__
                             throw err_bad_alloc;
@@ -584,253 +970,301 @@
                         __errorFlags__ |= err_bad_alloc;
                         return err_bad_alloc;
                     }
+                }
+
+                // 2. add new node here
+                // different ways of allocation the memory for a new node
+                #if MAP_MEMORY_TYPE == PSRAM_MEM
+                    __balancedBinarySearchTreeNode__ *n = (__balancedBinarySearchTreeNode__ *) ps_malloc (sizeof (__balancedBinarySearchTreeNode__));
+                #else
+                    __balancedBinarySearchTreeNode__ *n = (__balancedBinarySearchTreeNode__ *) malloc (sizeof (__balancedBinarySearchTreeNode__));
+                #endif
+
+                if (n == NULL) {
+                    // log_e ("BAD_ALLOC");
+                    #ifdef __USE_MAP_EXCEPTIONS__
+                        throw err_bad_alloc;
+                    #endif
+                    __errorFlags__ |= err_bad_alloc;
+                    return err_bad_alloc;
+                }
 
+                #ifndef ARDUINO_ARCH_AVR // Assuming Arduino Mega or Uno
+                    // construct the pair directly in the new node, so key and value get copied (or moved) only once
+                    #ifdef __MAP_ORDER_STATISTICS__
+                        new (n) __balancedBinarySearchTreeNode__ { { (K&&) key, valueType ((Args&&) valueArgs...) }, NULL, NULL, 0, 0, 1 };
+                    #else
+                        new (n) __balancedBinarySearchTreeNode__ { { (K&&) key, valueType ((Args&&) valueArgs...) }, NULL, NULL, 0, 0 };
+                    #endif
+                #else
                     memset (n, 0, sizeof (__balancedBinarySearchTreeNode__)); // prevent caling String destructor at the following assignments
-                    
-                    *n = { {key, value}, NULL, NULL, 0, 0 };
-                    *pInserted = n;
-
-                        // in case of Strings - it is possible that key and value didn't get constructed, so just swap stack memory with parameters - this always succeeds
-                        if (is_same<keyType, String>::value)   // if key is of type String ... (if anyone knows hot to do this in compile-time a feedback is welcome)
-                            if (!*(String *) &n->pair.first)                       // ... check if parameter construction is valid
-                                __swapStrings__ ((String *) &n->pair.first, (String *) &key); 
-                        if (is_same<valueType, String>::value) // if value is of type String ... (if anyone knows hot to do this in compile-time a feedback is welcome)
-                            if (!*(String *) &n->pair.second)                     // ... check if parameter construction is valid
-                                __swapStrings__ ((String *) &n->pair.second, (String *) &value);
-
-                    *p = n;
-                    __size__ ++;
-                    return 1; // height of the (sub)tree so far
-                }
-                
-                // 2. case: add a new node to the left subtree of the current node
-                if (key < (*p)->pair.first) {
-                    // log_i ("add a new node to the left subtree");
-
-                    int h = __insert__ (&((*p)->leftSubtree), key, value, pInserted);
-                    if (h < 0) return h; // < 0 means an error
-                    (*p)->leftSubtreeHeight = h;
-                    if ((*p)->leftSubtreeHeight - (*p)->rightSubtreeHeight > 1) {
-                        /* the tree is unbalanced, left subtree is too high, perform right rotation
-                                | = *p                 | = *p
-                                Y                      X
-                                / \                    / \
-                              X   c       =>         a   Y
-                              / \                        / \
-                            a   b                      b   c
-                        */
-                        __balancedBinarySearchTreeNode__ *tmp = (*p)->leftSubtree;  // picture: tmp = X
-                        (*p)->leftSubtree = tmp->rightSubtree;                      // picture: Y.leftSubtree = b
-                        if (tmp->leftSubtree == NULL) { // the rightSubtree can not be NULL at this point otherwise tmp wouldn't be unbalanced
-                            /* handle trivial case that happens at the leaves level and could preserve unbalance even after rotation
-                                    | = tmp                | = tmp
-                                    C                      C
-                                    /                      /
-                                  A           =>         B 
-                                    \                    / 
-                                    B                  A                           
-                            */
-                            tmp->rightSubtree->leftSubtree = tmp; 
-                            tmp = tmp->rightSubtree;
-                            tmp->leftSubtree->rightSubtree = NULL;
-                            tmp->leftSubtree->rightSubtreeHeight = 0;
-                            tmp->leftSubtreeHeight = 1;                
-                        }
-                        (*p)->leftSubtree = tmp->rightSubtree;
-                        (*p)->leftSubtreeHeight = tmp->rightSubtreeHeight;          // correct the hight information of (picture) b branch
-                        tmp->rightSubtree = (*p);                                   // picture: X.rightSubtree = Y
-                        (*p) = tmp;                                                 // X becomes the new (subtree) root
-                        // correct the height information of right subtree - we know that right subtree exists (picture: Y node)
-                        (*p)->rightSubtreeHeight = max ((*p)->rightSubtree->leftSubtreeHeight, (*p)->rightSubtree->rightSubtreeHeight) + 1; // the height of (sub)tree after rotation
-                    } 
-                    return max ((*p)->leftSubtreeHeight, (*p)->rightSubtreeHeight) + 1; // the new height of (sub)tree
-                }             
-    
-                // 3. case: the node with the same values already exists 
-                if (!((*p)->pair.first < key)) { // meaning at this point that key == (*p)->pair.first
-                    // log_e ("NOT_UNIQUE");
+                    #ifdef __MAP_ORDER_STATISTICS__
+                        *n = { { (K&&) key, valueType ((Args&&) valueArgs...) }, NULL, NULL, 0, 0, 1 };
+                    #else
+                        *n = { { (K&&) key, valueType ((Args&&) valueArgs...) }, NULL, NULL, 0, 0 };
+                    #endif
+                #endif
+
+                // in case of Strings - it is possible that key and value didn't get constructed
+                if (!__isKeyValid__ (n->pair.first) || (is_same<valueType, String>::value && !*(String *) &n->pair.second)) {
+                    // log_e ("BAD_ALLOC");
+                    __deleteNode__ (n);
                     #ifdef __USE_MAP_EXCEPTIONS__
-                        throw err_not_unique;
+                        throw err_bad_alloc;
                     #endif
-                    __errorFlags__ |= err_not_unique;
-                    return err_not_unique;
+                    __errorFlags__ |= err_bad_alloc;
+                    return err_bad_alloc;
                 }
-        
-                // 4. case: add a new node to the right subtree of the current node
-                // log_i ("add a new node to the right subtree");
 
-                int h = __insert__ (&((*p)->rightSubtree), key, value, pInserted);
-                if (h < 0) return h; // < 0 means an error
-                (*p)->rightSubtreeHeight = h;
-                if ((*p)->rightSubtreeHeight - (*p)->leftSubtreeHeight > 1) {
-                    /* the tree is unbalanced, right subtree is too high, perform left rotation
-                            | = *p                 | = *p
-                            X                      Y
-                            / \                    / \
-                          a   Y       =>         X   c
-                              / \                / \
-                            b   c              a   b
-                    */
-                    __balancedBinarySearchTreeNode__ *tmp = (*p)->rightSubtree; // picture: tmp = Y
-                    (*p)->rightSubtree = tmp->leftSubtree;                      // picture: X.rightSubtree = b
-                    if (tmp->rightSubtree == NULL) { // the leftSubtree can not be NULL at this point otherwise tmp wouldn't be unbalanced
-                        /* handle trivial case that happens at the leaves level and could preserve unbalance even after rotation
-                                | = tmp                | = tmp
-                                A                      A
-                                  \                      \
-                                  C        =>            B 
-                                  /                        \ 
-                                B                          C                           
-                        */
-                        tmp->leftSubtree->rightSubtree = tmp; 
-                        tmp = tmp->leftSubtree;
-                        tmp->rightSubtree->leftSubtree = NULL;
-                        tmp->rightSubtree->leftSubtreeHeight = 0;
-                        tmp->rightSubtreeHeight = 1;
-                    }
-                    (*p)->rightSubtree = tmp->leftSubtree;
-                    (*p)->rightSubtreeHeight = tmp->leftSubtreeHeight;  // correct the hight information of (picture) b branch
-                    tmp->leftSubtree = (*p);                            // picture:Y.leftSubtree = X
-                    (*p) = tmp;                                         // Y becomes the new (subtree) root
-                    // correct the height information of left subtree - we know that left subtree exists (picture: X node)
-                    (*p)->leftSubtreeHeight = max ((*p)->leftSubtree->leftSubtreeHeight, (*p)->leftSubtree->rightSubtreeHeight) + 1; // the height of (sub)tree after rotation
-                } 
-                return max ((*p)->leftSubtreeHeight, (*p)->rightSubtreeHeight) + 1; // the new height of (sub)tree
+                *pInserted = n;
+                *p = n;
+                __size__ ++;
+                #ifdef __MAP_ORDER_STATISTICS__
+                    for (int8_t i = 0; i < wayLength; i++) // all the subtrees on the way got a new node
+                        (*way [i])->subtreeSize ++;
+                #endif
+
+                // 3. correct the heights and rebalance the (sub)trees on the way back to the root, until some (sub)tree height doesn't change any more
+                signed char h = 1; // height of the (sub)tree so far
+                while (wayLength > 0) {
+                    __balancedBinarySearchTreeNode__ **q = way [-- wayLength];
+                    signed char oldHeight = __subtreeHeight__ (*q);
+                    h = __rebalance__ (q);
+                    if (h == oldHeight)
+                        return __height__; // nothing has changed above this point
+                }
+                return h;
             }
-    
-            signed char __erase__ (__balancedBinarySearchTreeNode__ **p, keyType& key) { // returns the height of balanced binary search tree or error
-                // 1. case: a leaf has been reached - key was not found
-                if ((*p) == NULL) {
-                    // log_e ("NOT_FOUND");
+
+            // builds a balanced (sub)tree from count sorted pairs starting at first, returns the height of the (sub)tree or error
+            template <class pairIterator>
+            signed char __buildFromSorted__ (__balancedBinarySearchTreeNode__ **p, pairIterator first, int count) {
+                if (count == 0)
+                    return 0;
+                int middle = count / 2;
+
+                // different ways of allocation the memory for a new node
+                #if MAP_MEMORY_TYPE == PSRAM_MEM
+                    __balancedBinarySearchTreeNode__ *n = (__balancedBinarySearchTreeNode__ *) ps_malloc (sizeof (__balancedBinarySearchTreeNode__));
+                #else
+                    __balancedBinarySearchTreeNode__ *n = (__balancedBinarySearchTreeNode__ *) malloc (sizeof (__balancedBinarySearchTreeNode__));
+                #endif
+
+                if (n == NULL) {
+                    // log_e ("BAD_ALLOC");
                     #ifdef __USE_MAP_EXCEPTIONS__
-                        throw err_not_found;
-                    #endif                    
-                    __errorFlags__ |= err_not_found;
-                    return err_not_found; 
-                }
-                        
-                // 2. case: delete the node from the left subtree
-                if (key < (*p)->pair.first) {
-                    int h = __erase__ (&((*p)->leftSubtree), key);
-                    if (h < 0) return h; // < 0 means an error                    
-                    (*p)->leftSubtreeHeight = h;
-                    if ((*p)->rightSubtreeHeight - (*p)->leftSubtreeHeight > 1) {                        
-                        /* the tree is unbalanced, right subtree is too high, perform left rotation
-                                | = *p                 | = *p
-                                X                      Y
-                                / \                    / \
-                              a   Y       =>         X   c
-                                  / \                / \
-                                b   c              a   b
-                        */
-                        __balancedBinarySearchTreeNode__ *tmp = (*p)->rightSubtree; // picture: tmp = Y
-                        (*p)->rightSubtree = tmp->leftSubtree;                      // picture: X.rightSubtree = b
-                        (*p)->rightSubtreeHeight = tmp->leftSubtreeHeight;          // correct the hight information of (picture) b branch
-                        tmp->leftSubtree = (*p);                                    // picture:Y.leftSubtree = X
-                        (*p) = tmp;                                                 // Y becomes the new (subtree) root
-                        // correct height information of left subtree - we know that left subtree exists (picture: X node)
-                        (*p)->leftSubtreeHeight = max ((*p)->leftSubtree->leftSubtreeHeight, (*p)->leftSubtree->rightSubtreeHeight) + 1;
-                    }
-                    return max ((*p)->leftSubtreeHeight, (*p)->rightSubtreeHeight) + 1;
+                        throw err_bad_alloc;
+                    #endif
+                    __errorFlags__ |= err_bad_alloc;
+                    return err_bad_alloc;
                 }
-    
-                // 3. case: found
-                if (!((*p)->pair.first < key)) { // meaning at this point that key == (*p)->pair.first
-                    // 3.a. case: delete a node with no children
-                    if ((*p)->leftSubtree == NULL && (*p)->rightSubtree == NULL) {
-                        // remove the node
-                        delete (*p);
-                        (*p) = NULL;
-                        // __size__ --; // we'll do it if erase () function instead
-                        return err_ok;
-                    }
-                    // 3.b. case: delete a node with only left child 
-                    if ((*p)->rightSubtree == NULL) {
-                        // remove the node and replace it with its child
-                        __balancedBinarySearchTreeNode__ *tmp = (*p);
-                        (*p) = (*p)->leftSubtree;
-                        delete tmp;
-                        // __size__ --; // we'll do it if erase () 
-                        return max ((*p)->leftSubtreeHeight, (*p)->rightSubtreeHeight) + 1; // return the new hight of a subtree
+
+                #ifndef ARDUINO_ARCH_AVR // Assuming Arduino Mega or Uno
+                    #ifdef __MAP_ORDER_STATISTICS__
+                        new (n) __balancedBinarySearchTreeNode__ { *(first + middle), NULL, NULL, 0, 0, count };
+                    #else
+                        new (n) __balancedBinarySearchTreeNode__ { *(first + middle), NULL, NULL, 0, 0 };
+                    #endif
+                #else
+                    memset (n, 0, sizeof (__balancedBinarySearchTreeNode__)); // prevent caling String destructor at the following assignments
+                    #ifdef __MAP_ORDER_STATISTICS__
+                        *n = { *(first + middle), NULL, NULL, 0, 0, count };
+                    #else
+                        *n = { *(first + middle), NULL, NULL, 0, 0 };
+                    #endif
+                #endif
+
+                // in case of Strings - it is possible that key and value didn't get constructed
+                if (!__isKeyValid__ (n->pair.first) || (is_same<valueType, String>::value && !*(String *) &n->pair.second)) {
+                    // log_e ("BAD_ALLOC");
+                    __deleteNode__ (n);
+                    #ifdef __USE_MAP_EXCEPTIONS__
+                        throw err_bad_alloc;
+                    #endif
+                    __errorFlags__ |= err_bad_alloc;
+                    return err_bad_alloc;
+                }
+
+                // link the node into the tree before building its subtrees, so everything built so far can be released in case of error
+                *p = n;
+                __size__ ++;
+
+                int h = __buildFromSorted__ (&n->leftSubtree, first, middle);
+                if (h < 0) return h; // < 0 means an error
+                n->leftSubtreeHeight = h;
+                h = __buildFromSorted__ (&n->rightSubtree, first + (middle + 1), count - middle - 1);
+                if (h < 0) return h; // < 0 means an error
+                n->rightSubtreeHeight = h;
+                return max (n->leftSubtreeHeight, n->rightSubtreeHeight) + 1; // the height of (sub)tree
+            }
+
+            signed char __erase__ (__balancedBinarySearchTreeNode__ **p, const keyType& key) { // p = root of the tree, returns the height of balanced binary search tree or error
+                __balancedBinarySearchTreeNode__ **way [__MAP_MAX_STACK_SIZE__];
+                int8_t wayLength = 0;
+
+                // 1. find the node, remember the way to it
+                while (true) {
+                    if (*p == NULL) { // a leaf has been reached - key was not found
+                        // log_e ("NOT_FOUND");
+                        #ifdef __USE_MAP_EXCEPTIONS__
+                            throw err_not_found;
+                        #endif                    
+                        __errorFlags__ |= err_not_found;
+                        return err_not_found; 
                     }
-                    // 3.c. case: delete a node with only right child 
-                    if ((*p)->leftSubtree == NULL) {
-                        // remove the node and replace it with its child
-                        __balancedBinarySearchTreeNode__ *tmp = (*p);
-                        (*p) = (*p)->rightSubtree;
-                        delete tmp;
-                        // __size__ --; // we'll do it if erase () 
-                        return max ((*p)->leftSubtreeHeight, (*p)->rightSubtreeHeight) + 1; // return the new hight of a subtree
+                    if (key < (*p)->pair.first) {
+                        way [wayLength ++] = p;
+                        p = &((*p)->leftSubtree);
+                    } else if ((*p)->pair.first < key) {
+                        way [wayLength ++] = p;
+                        p = &((*p)->rightSubtree);
+                    } else {
+                        break; // found
                     }
-                    // 3.d. case: deleting the node with both children
-                        // replace the node with its inorder successor (inorder predecessor would also do) and then delete it
-                        // find inorder successor = leftmost node from right subtree
-                        __balancedBinarySearchTreeNode__ *q = (*p)->rightSubtree; while (q->leftSubtree) q = q->leftSubtree;
-                        // remember inorder successor and then delete it from right subtree
-                        __balancedBinarySearchTreeNode__ tmp = *q;
-                        (*p)->rightSubtreeHeight = __erase__ (&((*p)->rightSubtree), q->pair.first);
-                        (*p)->pair = tmp.pair;
-                        if ((*p)->leftSubtreeHeight - (*p)->rightSubtreeHeight > 1) {
-                            /* the tree is unbalanced, left subtree is too high, perform right rotation
-                                    | = *p                 | = *p
-                                    Y                      X
-                                    / \                    / \
-                                  X   c       =>         a   Y
-                                  / \                        / \
-                                a   b                      b   c
-                            */
-                            __balancedBinarySearchTreeNode__ *tmp = (*p)->leftSubtree;  // picture: tmp = X
-                            (*p)->leftSubtree = tmp->rightSubtree;                      // picture: Y.leftSubtree = b
-                            (*p)->leftSubtreeHeight = tmp->rightSubtreeHeight;          // correct the hight information of (picture) b branch
-                            tmp->rightSubtree = (*p);                                   // picture: X.rightSubtree = Y
-                            (*p) = tmp;                                                 // X becomes the new (subtree) root
-                            // correct height information of right subtree - we know that right subtree exists (picture: Y node)
-                            (*p)->rightSubtreeHeight = max ((*p)->rightSubtree->leftSubtreeHeight, (*p)->rightSubtree->rightSubtreeHeight) + 1;
-                        }
-                        // __size__ --; // we'll do it if erase () 
-                        return max ((*p)->leftSubtreeHeight, (*p)->rightSubtreeHeight) + 1;
-                } // 3. case: found
-                        
-                // 4. case: delete the node from the right subtree of the current node
-                    int h = __erase__ (&((*p)->rightSubtree), key);
-                    if (h < 0) return h; // < 0 means an error                    
-                    (*p)->rightSubtreeHeight = h;
-                    if ((*p)->leftSubtreeHeight - (*p)->rightSubtreeHeight > 1) {
-                        /* the tree is unbalanced, left subtree is too high, perform right rotation
-                                | = *p                 | = *p
-                                Y                      X
-                                / \                    / \
-                              X   c       =>         a   Y
-                              / \                        / \
-                            a   b                      b   c
-                        */
-                        __balancedBinarySearchTreeNode__ *tmp = (*p)->leftSubtree;  // picture: tmp = X
-                        (*p)->leftSubtree = tmp->rightSubtree;                      // picture: Y.leftSubtree = b
-                        (*p)->leftSubtreeHeight = tmp->rightSubtreeHeight;          // correct the hight information of (picture) b branch
-                        tmp->rightSubtree = (*p);                                   // picture: X.rightSubtree = Y
-                        (*p) = tmp;                                                 // X becomes the new (subtree) root
-                        // correct height information of right subtree - we know that right subtree exists (picture: Y node)
-                        (*p)->rightSubtreeHeight = max ((*p)->rightSubtree->leftSubtreeHeight, (*p)->rightSubtree->rightSubtreeHeight) + 1;
+                }
+
+                // 2. unlink the node
+                __balancedBinarySearchTreeNode__ *n = *p;
+                if (n->leftSubtree == NULL) {
+                    *p = n->rightSubtree; // the right child (if it exists) takes its place
+                } else if (n->rightSubtree == NULL) {
+                    *p = n->leftSubtree; // the left child takes its place
+                } else {
+                    // the node has both children, its inorder successor (= the leftmost node from right subtree) takes its place
+                    int8_t nodeWayIndex = wayLength;
+                    way [wayLength ++] = p;
+                    __balancedBinarySearchTreeNode__ **q = &(n->rightSubtree); 
+                    while ((*q)->leftSubtree) {
+                        way [wayLength ++] = q;
+                        q = &((*q)->leftSubtree);
                     }
-                
-                return max ((*p)->leftSubtreeHeight, (*p)->rightSubtreeHeight) + 1;
+                    __balancedBinarySearchTreeNode__ *successor = *q;
+                    *q = successor->rightSubtree;       // unlink the successor from its place first
+                    successor->leftSubtree = n->leftSubtree;
+                    successor->rightSubtree = n->rightSubtree;
+                    successor->leftSubtreeHeight = n->leftSubtreeHeight;
+                    successor->rightSubtreeHeight = n->rightSubtreeHeight;
+                    #ifdef __MAP_ORDER_STATISTICS__
+                        successor->subtreeSize = n->subtreeSize;
+                    #endif
+                    *p = successor;
+                    // the way now goes through successor instead of the node
+                    if (nodeWayIndex + 1 < wayLength)
+                        way [nodeWayIndex + 1] = &(successor->rightSubtree);
+                }
+                __deleteNode__ (n);
+                // __size__ --; // we'll do it if erase () function instead
+                #ifdef __MAP_ORDER_STATISTICS__
+                    for (int8_t i = 0; i < wayLength; i++) // all the subtrees on the way lost a node
+                        (*way [i])->subtreeSize --;
+                #endif
+
+                // 3. correct the heights and rebalance the (sub)trees on the way back to the root
+                signed char h = __subtreeHeight__ (*p); // height of the (sub)tree so far (in case the root itself has been deleted)
+                while (wayLength > 0) {
+                    __balancedBinarySearchTreeNode__ **q = way [-- wayLength];
+                    signed char oldHeight = __subtreeHeight__ (*q);
+                    h = __rebalance__ (q);
+                    if (h == oldHeight)
+                        return __height__; // nothing has changed above this point
+                }
+                return h;
             }
-    
-            void __clear__ (__balancedBinarySearchTreeNode__ **p) {
-                if ((*p) == NULL) return;        // stop recursion at NULL
-                __clear__ (&(*p)->rightSubtree); // recursive delete right subtree  
-                __clear__ (&(*p)->leftSubtree);  // recursive delete left subtree
-                
-                // different wasy of freeing the memory used by the node
-                #ifdef __USE_IRAM__
-                    free (p);
-                #else
-                    delete (*p);
+
+            // corrects the height information of the (sub)tree *p (its subtrees are already correct) and rebalances it if needed, returns its (new) height
+            signed char __rebalance__ (__balancedBinarySearchTreeNode__ **p) {
+                __balancedBinarySearchTreeNode__ *n = *p;
+                n->leftSubtreeHeight = __subtreeHeight__ (n->leftSubtree);
+                n->rightSubtreeHeight = __subtreeHeight__ (n->rightSubtree);
+
+                if (n->leftSubtreeHeight - n->rightSubtreeHeight > 1) {
+                    // the tree is unbalanced, left subtree is too high, if its right subtree is the higher one rotate it to the left first
+                    if (n->leftSubtree->rightSubtreeHeight > n->leftSubtree->leftSubtreeHeight)
+                        n->leftSubtreeHeight = __rotateLeft__ (&(n->leftSubtree));
+                    return __rotateRight__ (p);
+                }
+                if (n->rightSubtreeHeight - n->leftSubtreeHeight > 1) {
+                    // the tree is unbalanced, right subtree is too high, if its left subtree is the higher one rotate it to the right first
+                    if (n->rightSubtree->leftSubtreeHeight > n->rightSubtree->rightSubtreeHeight)
+                        n->rightSubtreeHeight = __rotateRight__ (&(n->rightSubtree));
+                    return __rotateLeft__ (p);
+                }
+                return max (n->leftSubtreeHeight, n->rightSubtreeHeight) + 1;
+            }
+
+            signed char __rotateRight__ (__balancedBinarySearchTreeNode__ **p) { // returns the height of (sub)tree after rotation
+                /* 
+                        | = *p                 | = *p
+                        Y                      X
+                       / \                    / \
+                      X   c       =>         a   Y
+                     / \                        / \
+                    a   b                      b   c
+                */
+                __balancedBinarySearchTreeNode__ *y = *p;
+                __balancedBinarySearchTreeNode__ *x = y->leftSubtree;
+                y->leftSubtree = x->rightSubtree;
+                y->leftSubtreeHeight = x->rightSubtreeHeight;
+                x->rightSubtree = y;
+                x->rightSubtreeHeight = max (y->leftSubtreeHeight, y->rightSubtreeHeight) + 1;
+                #ifdef __MAP_ORDER_STATISTICS__
+                    y->subtreeSize = __subtreeSize__ (y->leftSubtree) + __subtreeSize__ (y->rightSubtree) + 1;
+                    x->subtreeSize = __subtreeSize__ (x->leftSubtree) + y->subtreeSize + 1;
                 #endif
+                *p = x;
+                return max (x->leftSubtreeHeight, x->rightSubtreeHeight) + 1;
+            }
+
+            signed char __rotateLeft__ (__balancedBinarySearchTreeNode__ **p) { // returns the height of (sub)tree after rotation
+                /* 
+                        | = *p                 | = *p
+                        X                      Y
+                       / \                    / \
+                      a   Y       =>         X   c
+                         / \                / \
+                        b   c              a   b
+                */
+                __balancedBinarySearchTreeNode__ *x = *p;
+                __balancedBinarySearchTreeNode__ *y = x->rightSubtree;
+                x->rightSubtree = y->leftSubtree;
+                x->rightSubtreeHeight = y->leftSubtreeHeight;
+                y->leftSubtree = x;
+                y->leftSubtreeHeight = max (x->leftSubtreeHeight, x->rightSubtreeHeight) + 1;
+                #ifdef __MAP_ORDER_STATISTICS__
+                    x->subtreeSize = __subtreeSize__ (x->leftSubtree) + __subtreeSize__ (x->rightSubtree) + 1;
+                    y->subtreeSize = x->subtreeSize + __subtreeSize__ (y->rightSubtree) + 1;
+                #endif
+                *p = y;
+                return max (y->leftSubtreeHeight, y->rightSubtreeHeight) + 1;
+            }
+
+            static signed char __subtreeHeight__ (__balancedBinarySearchTreeNode__ *n) { return n ? max (n->leftSubtreeHeight, n->rightSubtreeHeight) + 1 : 0; }
+
+            #ifdef __MAP_ORDER_STATISTICS__
+                static int __subtreeSize__ (__balancedBinarySearchTreeNode__ *n) { return n ? n->subtreeSize : 0; }
+            #endif
+
+            void __clear__ (__balancedBinarySearchTreeNode__ **p) {
+                // rotate left subtrees to the right until the node has no left subtree, then delete it and continue with its right subtree, this way no stack is needed
+                while (*p != NULL) {
+                    __balancedBinarySearchTreeNode__ *n = *p;
+                    if (n->leftSubtree != NULL) {
+                        *p = n->leftSubtree;
+                        n->leftSubtree = (*p)->rightSubtree;
+                        (*p)->rightSubtree = n;
+                    } else {
+                        *p = n->rightSubtree;
+                        __deleteNode__ (n);
+                        __size__ --;
+                    }
+                }
+                __height__ = 0;
+            }
 
-                (*p) = NULL;
-                __size__ --;
-                return;
+            // nodes are allocated with malloc (or ps_malloc) so they are destructed and freed the same way
+            static void __deleteNode__ (__balancedBinarySearchTreeNode__ *n) {
+                n->~__balancedBinarySearchTreeNode__ ();
+                free (n);
             }
 
             // swap strings by swapping their stack memory so constructors doesn't get called and nothing can go wrong like running out of memory meanwhile 
@@ -0,0 +1,172 @@
+/*
+ *  inlineString.hpp for Arduino
+ *
+ *  This file is part of Lightweight C++ Standard Template Library (STL) for Arduino: https://github.com/BojanJurca/Lightweight-Standard-Template-Library-STL-for-Arduino
+ *
+ *  inlineString is a String-like type, intended to be used as a Map (or keyValueDatabase) key. It keeps short strings (up to N characters) inside
+ *  the object itself and only uses heap for the longer ones. Arduino String always keeps its characters in a separate heap allocation (or in a
+ *  small inline buffer on some boards), so each Map node with a String key costs 2 heap allocations and each key comparison an extra jump in memory.
+ *  With inlineString keys most of the nodes fit into a single allocation:
+ *
+ *    Map<inlineString<>, int> mp;
+ *    keyValueDatabase<inlineString<31>, String> settings;
+ *
+ *  Like String, inlineString construction may fail if the controller runs out of memory (only possible for long strings). This can be checked with
+ *  bool operator:
+ *
+ *    inlineString<> s = "abc";
+ *    if (s) // success ...
+ *
+ */
+
+
+#ifndef __INLINE_STRING_HPP__
+    #define __INLINE_STRING_HPP__
+
+    // ----- TUNNING PARAMETERS -----
+
+    #define __INLINE_STRING_DEFAULT_CAPACITY__ 23 // the number of characters (without closing 0) inlineString<> keeps inside itself, longer strings go to heap
+
+
+    template <size_t N = __INLINE_STRING_DEFAULT_CAPACITY__> class inlineString {
+
+        static_assert (N + 1 >= sizeof (char *), "inlineString capacity is too small to hold a pointer to heap");
+
+        public:
+
+            inlineString () {}
+
+            inlineString (const char *s) { if (s) __copy__ (s, strlen (s)); else __length__ = __invalidLength__; }
+
+            inlineString (const char *s, size_t length) { __copy__ (s, length); }
+
+            inlineString (const String& s) { if (s) __copy__ (s.c_str (), s.length ()); else __length__ = __invalidLength__; }
+
+            inlineString (const inlineString& other) { __copy__ (other.c_str (), other.__length__); }
+
+            inlineString (inlineString&& other) { __take__ (other); }
+
+            ~inlineString () { __free__ (); }
+
+            inlineString& operator = (const inlineString& other) { if (this != &other) __copy__ (other.c_str (), other.__length__); return *this; }
+
+            inlineString& operator = (inlineString&& other) { if (this != &other) { __free__ (); __take__ (other); } return *this; }
+
+            inlineString& operator = (const char *s) { if (s) __copy__ (s, strlen (s)); else __copy__ (NULL, 0); return *this; }
+
+            inlineString& operator = (const String& s) { if (s) __copy__ (s.c_str (), s.length ()); else __copy__ (NULL, 0); return *this; }
+
+
+           /*
+            *  String-like access
+            */
+
+            const char *c_str () const { return __isInHeap__ () ? __heap__ () : __buffer__; }
+
+            size_t length () const { return __length__ == __invalidLength__ ? 0 : __length__; }
+
+            explicit operator bool () const { return __length__ != __invalidLength__; }
+
+            operator String () const { return String (c_str ()); }
+
+            // appends a character, returns false if it can't (needed for reading keys from disk character by character)
+            bool concat (char c) {
+                if (__length__ == __invalidLength__ || __length__ + 1 == __invalidLength__)
+                    return false;
+                if (__length__ < N) { // still fits inside
+                    __buffer__ [__length__] = c;
+                    __buffer__ [++ __length__] = 0;
+                    return true;
+                }
+                // else move (or keep) it in heap
+                char *p = (char *) realloc (__isInHeap__ () ? __heap__ () : NULL, __length__ + 2);
+                if (!p)
+                    return false;
+                if (__length__ == N) // it was inside until now
+                    memcpy (p, __buffer__, N);
+                p [__length__] = c;
+                p [++ __length__] = 0;
+                memcpy (__buffer__, &p, sizeof (p));
+                return true;
+            }
+
+
+           /*
+            *  Comparison, in the same order as Strings compare
+            */
+
+            int compareTo (const char *s, size_t length) const {
+                size_t l = this->length ();
+                int c = memcmp (c_str (), s, l < length ? l : length);
+                if (c) return c;
+                return l < length ? -1 : l > length;
+            }
+
+            int compareTo (const inlineString& other) const { return compareTo (other.c_str (), other.length ()); }
+
+            bool operator == (const inlineString& other) const { return length () == other.length () && !memcmp (c_str (), other.c_str (), length ()); }
+            bool operator != (const inlineString& other) const { return !(*this == other); }
+            bool operator <  (const inlineString& other) const { return compareTo (other) < 0; }
+            bool operator >  (const inlineString& other) const { return compareTo (other) > 0; }
+            bool operator <= (const inlineString& other) const { return compareTo (other) <= 0; }
+            bool operator >= (const inlineString& other) const { return compareTo (other) >= 0; }
+
+            bool operator == (const char *s) const { return s && !compareTo (s, strlen (s)); }
+            bool operator != (const char *s) const { return !(*this == s); }
+
+
+        private:
+
+            char __buffer__ [N + 1] = {};           // characters with closing 0 if they fit inside, the pointer to heap otherwise
+            uint16_t __length__ = 0;                // the number of characters
+            enum { __invalidLength__ = 0xFFFF };    // marks failed construction
+
+            bool __isInHeap__ () const { return __length__ > N && __length__ != __invalidLength__; }
+
+            char *__heap__ () const { char *p; memcpy (&p, __buffer__, sizeof (p)); return p; }
+
+            void __free__ () {
+                if (__isInHeap__ ())
+                    free (__heap__ ());
+                __buffer__ [0] = 0;
+                __length__ = 0;
+            }
+
+            // copies characters (that may also be its own), marks the object invalid if it can't
+            void __copy__ (const char *s, size_t length) {
+                char *old = __isInHeap__ () ? __heap__ () : NULL; // free it only after the characters are copied
+                if (!s || length >= __invalidLength__) {
+                    __buffer__ [0] = 0;
+                    __length__ = __invalidLength__;
+                } else if (length <= N) {
+                    memmove (__buffer__, s, length);
+                    __buffer__ [length] = 0;
+                    __length__ = length;
+                } else {
+                    char *p = (char *) malloc (length + 1);
+                    if (p) {
+                        memcpy (p, s, length);
+                        p [length] = 0;
+                        memcpy (__buffer__, &p, sizeof (p));
+                        __length__ = length;
+                    } else {
+                        // log_e ("BAD_ALLOC");
+                        __buffer__ [0] = 0;
+                        __length__ = __invalidLength__;
+                    }
+                }
+                if (old)
+                    free (old);
+            }
+
+            // takes over the content of the other object (which is empty afterwards)
+            void __take__ (inlineString& other) {
+                memcpy (__buffer__, other.__buffer__, N + 1);
+                __length__ = other.__length__;
+                other.__buffer__ [0] = 0;
+                other.__length__ = 0;
+            }
+
+    };
+
+#endif
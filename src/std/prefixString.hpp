@@ -0,0 +1,299 @@
+/*
+ *  prefixString.hpp for Arduino
+ *
+ *  This file is part of Lightweight C++ Standard Template Library (STL) for Arduino: https://github.com/BojanJurca/Lightweight-Standard-Template-Library-STL-for-Arduino
+ *
+ *  prefixString is a String-like type, intended to be used as a Map (or keyValueDatabase) key when many keys share long prefixes, like:
+ *
+ *    GET /api/v1/sensors/17/temperature
+ *    GET /api/v1/sensors/17/humidity
+ *    GET /api/v1/sensors/18/temperature
+ *
+ *  Each key is split at its last separator ('/' by default). The prefix (everything up to and including the separator) is kept only once, in a
+ *  shared prefix table, and the keys only point to it, the rest (suffix) is kept inside the key like inlineString does. The keys still compare
+ *  exactly as Strings do, so Map ordered iteration and searching work the same way, but the RAM needed for keys shrinks by the shared prefix ratio:
+ *
+ *    keyValueDatabase<prefixString<>, unsigned long> urlCounters;
+ *
+ *  Keys with equal prefixes (the most common case) are compared by their suffixes only. The prefix table is searched linearly when a key is
+ *  constructed from characters, so prefixString is meant for keys with a moderate number of distinct prefixes (directories), not for arbitrary
+ *  strings. Prefixes shorter than __PREFIX_STRING_MIN_PREFIX_LENGTH__ are not worth a pointer and are kept in the suffix.
+ *
+ *  The shared prefix table is protected by its own semaphore when RTOS is running beneath Arduino sketch.
+ *
+ */
+
+
+#ifndef __PREFIX_STRING_HPP__
+    #define __PREFIX_STRING_HPP__
+
+    #include "inlineString.hpp"
+
+    // ----- TUNNING PARAMETERS -----
+
+    #define __PREFIX_STRING_SEPARATOR__ '/'             // keys are split into prefix and suffix at the last separator
+    #define __PREFIX_STRING_MIN_PREFIX_LENGTH__ 8       // shorter prefixes are kept in the suffix
+    #define __PREFIX_STRING_DEFAULT_CAPACITY__ 11       // the number of suffix characters (without closing 0) prefixString<> keeps inside itself, longer suffixes go to heap
+
+
+    template <size_t N = __PREFIX_STRING_DEFAULT_CAPACITY__> class prefixString {
+
+        public:
+
+            prefixString () {}
+
+            prefixString (const char *s) { if (s) __assign__ (s, strlen (s)); else __suffix__ = (const char *) NULL; }
+
+            prefixString (const char *s, size_t length) { __assign__ (s, length); }
+
+            prefixString (const String& s) { if (s) __assign__ (s.c_str (), s.length ()); else __suffix__ = (const char *) NULL; }
+
+            prefixString (const prefixString& other) : __suffix__ (other.__suffix__) { __prefix__ = __acquire__ (other.__prefix__); }
+
+            prefixString (prefixString&& other) : __suffix__ ((inlineString<N>&&) other.__suffix__) { __prefix__ = other.__prefix__; other.__prefix__ = NULL; }
+
+            ~prefixString () { __release__ (__prefix__); }
+
+            prefixString& operator = (const prefixString& other) {
+                if (this != &other) {
+                    __prefixEntry__ *p = __acquire__ (other.__prefix__);
+                    __release__ (__prefix__);
+                    __prefix__ = p;
+                    __suffix__ = other.__suffix__;
+                }
+                return *this;
+            }
+
+            prefixString& operator = (prefixString&& other) {
+                if (this != &other) {
+                    __release__ (__prefix__);
+                    __prefix__ = other.__prefix__;
+                    other.__prefix__ = NULL;
+                    __suffix__ = (inlineString<N>&&) other.__suffix__;
+                }
+                return *this;
+            }
+
+            prefixString& operator = (const char *s) { prefixString tmp (s); return *this = (prefixString&&) tmp; }
+
+            prefixString& operator = (const String& s) { prefixString tmp (s); return *this = (prefixString&&) tmp; }
+
+
+           /*
+            *  String-like access (the characters are not kept together, so there is no c_str (), copyTo can be used instead)
+            */
+
+            size_t length () const { return __prefixLength__ () + __suffix__.length (); }
+
+            explicit operator bool () const { return !!__suffix__; }
+
+            // copies the characters with closing 0 into the buffer that must be at least length () + 1 bytes long
+            void copyTo (char *buffer) const {
+                size_t l = __prefixLength__ ();
+                if (l) memcpy (buffer, __prefix__->chars, l);
+                memcpy (buffer + l, __suffix__.c_str (), __suffix__.length () + 1);
+            }
+
+            operator String () const {
+                char *buffer = (char *) malloc (length () + 1);
+                if (!buffer) return String ((const char *) NULL); // invalid String
+                copyTo (buffer);
+                String s (buffer);
+                free (buffer);
+                return s;
+            }
+
+            // appends a character, returns false if it can't (needed for reading keys from disk character by character)
+            bool concat (char c) {
+                if (!__suffix__)
+                    return false;
+                if (c == __PREFIX_STRING_SEPARATOR__ && length () + 1 >= __PREFIX_STRING_MIN_PREFIX_LENGTH__) { // everything so far becomes the new prefix
+                    char *buffer = (char *) malloc (length () + 2);
+                    if (!buffer)
+                        return false;
+                    copyTo (buffer);
+                    size_t l = length ();
+                    buffer [l] = c;
+                    __prefixEntry__ *p = __intern__ (buffer, l + 1);
+                    free (buffer);
+                    if (!p)
+                        return false;
+                    __release__ (__prefix__);
+                    __prefix__ = p;
+                    __suffix__ = "";
+                    return true;
+                }
+                return __suffix__.concat (c);
+            }
+
+
+           /*
+            *  Comparison, in the same order as Strings compare
+            */
+
+            int compareTo (const char *s, size_t length) const { return __compareSegments__ (__prefixChars__ (), __prefixLength__ (), __suffix__.c_str (), __suffix__.length (), s, length, "", 0); }
+
+            int compareTo (const prefixString& other) const {
+                if (__prefix__ == other.__prefix__) // the same prefix, only suffixes need to be compared
+                    return __suffix__.compareTo (other.__suffix__);
+                return __compareSegments__ (__prefixChars__ (), __prefixLength__ (), __suffix__.c_str (), __suffix__.length (), other.__prefixChars__ (), other.__prefixLength__ (), other.__suffix__.c_str (), other.__suffix__.length ());
+            }
+
+            bool operator == (const prefixString& other) const { return __prefix__ == other.__prefix__ && __suffix__ == other.__suffix__; } // prefixes are unique so equal keys point to the same one
+            bool operator != (const prefixString& other) const { return !(*this == other); }
+            bool operator <  (const prefixString& other) const { return compareTo (other) < 0; }
+            bool operator >  (const prefixString& other) const { return compareTo (other) > 0; }
+            bool operator <= (const prefixString& other) const { return compareTo (other) <= 0; }
+            bool operator >= (const prefixString& other) const { return compareTo (other) >= 0; }
+
+            bool operator == (const char *s) const { return s && !compareTo (s, strlen (s)); }
+            bool operator != (const char *s) const { return !(*this == s); }
+
+
+           /*
+            *  Shared prefix table information, like the number of prefixes and RAM they occupy
+            */
+
+            static size_t prefixCount () {
+                __lock__ ();
+                size_t n = 0;
+                for (__prefixEntry__ *p = __prefixes__; p; p = p->next) n ++;
+                __unlock__ ();
+                return n;
+            }
+
+            static size_t prefixBytes () {
+                __lock__ ();
+                size_t n = 0;
+                for (__prefixEntry__ *p = __prefixes__; p; p = p->next) n += sizeof (__prefixEntry__) + p->length;
+                __unlock__ ();
+                return n;
+            }
+
+
+        private:
+
+            struct __prefixEntry__ {
+                __prefixEntry__ *next;
+                size_t refCount;
+                uint16_t length;
+                char chars [1];
+            };
+
+            __prefixEntry__ *__prefix__ = NULL;     // shared prefix or NULL if there is none
+            inlineString<N> __suffix__;             // the rest of the characters
+
+            static __prefixEntry__ *__prefixes__;   // shared prefix table (linked list)
+
+            size_t __prefixLength__ () const { return __prefix__ ? __prefix__->length : 0; }
+
+            const char *__prefixChars__ () const { return __prefix__ ? __prefix__->chars : ""; }
+
+            // splits the characters at the last separator
+            void __assign__ (const char *s, size_t length) {
+                size_t l = length;
+                while (l > 0 && s [l - 1] != __PREFIX_STRING_SEPARATOR__) l --; // l = prefix length
+                __prefixEntry__ *p = NULL;
+                if (l >= __PREFIX_STRING_MIN_PREFIX_LENGTH__) {
+                    p = __intern__ (s, l);
+                    if (!p) { // out of memory
+                        __release__ (__prefix__);
+                        __prefix__ = NULL;
+                        __suffix__ = (const char *) NULL; // mark invalid
+                        return;
+                    }
+                } else {
+                    l = 0;
+                }
+                __release__ (__prefix__);
+                __prefix__ = p;
+                __suffix__ = inlineString<N> (s + l, length - l);
+            }
+
+            // finds the prefix in the shared prefix table or adds it there, returns it acquired (or NULL if out of memory)
+            static __prefixEntry__ *__intern__ (const char *s, size_t length) {
+                if (length >= 0xFFFF)
+                    return NULL;
+                __lock__ ();
+                for (__prefixEntry__ *p = __prefixes__; p; p = p->next)
+                    if (p->length == length && !memcmp (p->chars, s, length)) {
+                        p->refCount ++;
+                        __unlock__ ();
+                        return p;
+                    }
+                __prefixEntry__ *p = (__prefixEntry__ *) malloc (sizeof (__prefixEntry__) + length);
+                if (p) {
+                    p->refCount = 1;
+                    p->length = length;
+                    memcpy (p->chars, s, length);
+                    p->chars [length] = 0;
+                    p->next = __prefixes__;
+                    __prefixes__ = p;
+                } else {
+                    // log_e ("BAD_ALLOC");
+                }
+                __unlock__ ();
+                return p;
+            }
+
+            static __prefixEntry__ *__acquire__ (__prefixEntry__ *p) {
+                if (p) {
+                    __lock__ ();
+                    p->refCount ++;
+                    __unlock__ ();
+                }
+                return p;
+            }
+
+            // the prefix is deleted from the shared prefix table when the last key pointing to it is gone
+            static void __release__ (__prefixEntry__ *p) {
+                if (!p)
+                    return;
+                __lock__ ();
+                if (-- p->refCount == 0) {
+                    __prefixEntry__ **q = &__prefixes__;
+                    while (*q != p) q = &(*q)->next;
+                    *q = p->next;
+                    free (p);
+                }
+                __unlock__ ();
+            }
+
+            // compares 2 strings, each given in 2 parts
+            static int __compareSegments__ (const char *a1, size_t n1, const char *a2, size_t n2, const char *b1, size_t m1, const char *b2, size_t m2) {
+                while (true) {
+                    if (!n1) {
+                        if (!n2) break;
+                        a1 = a2; n1 = n2; n2 = 0;
+                    }
+                    if (!m1) {
+                        if (!m2) break;
+                        b1 = b2; m1 = m2; m2 = 0;
+                    }
+                    size_t l = n1 < m1 ? n1 : m1;
+                    int c = memcmp (a1, b1, l);
+                    if (c) return c;
+                    a1 += l; n1 -= l;
+                    b1 += l; m1 -= l;
+                }
+                size_t la = n1 + n2, lb = m1 + m2;
+                return la < lb ? -1 : la > lb;
+            }
+
+            #ifdef SEMAPHORE_H // RTOS is running beneath Arduino sketch, multitasking (and semaphores) is supported
+                static SemaphoreHandle_t __semaphore__ () {
+                    static SemaphoreHandle_t s = xSemaphoreCreateMutex ();
+                    return s;
+                }
+                static void __lock__ () { xSemaphoreTake (__semaphore__ (), portMAX_DELAY); }
+                static void __unlock__ () { xSemaphoreGive (__semaphore__ ()); }
+            #else
+                static void __lock__ () {}
+                static void __unlock__ () {}
+            #endif
+
+    };
+
+    template <size_t N> typename prefixString<N>::__prefixEntry__ *prefixString<N>::__prefixes__ = NULL;
+
+#endif
@@ -100,10 +100,7 @@
             
             ~vector () { 
                 if (__elements__ != NULL) {
-                    #ifndef ARDUINO_ARCH_AVR // Assuming Arduino Mega or Uno
-                        for (int i = 0; i < __capacity__; i++)
-                            __elements__ [i].~vectorType ();
-                    #endif
+                    __destroyElements__ ();
                     free (__elements__);
                 }
             }
@@ -285,12 +282,32 @@
             *    
             *  Returns OK or one of the error flags in case of error:
             *    - could not allocate enough memory for requested storage
+            *
+            *  The element is passed by reference so it only gets copied once - into the vector. A temporary (rvalue) element gets moved instead.
             */
     
-            signed char push_back (vectorType element) {
+            signed char push_back (const vectorType& element) { 
+                if (__isElement__ (&element)) return emplace_back (vectorType (element)); // element would get moved while changing capacity
+                return emplace_back (element); 
+            }
+
+            signed char push_back (vectorType&& element) { return emplace_back ((vectorType&&) element); }
+
+
+           /*
+            *  Constructs a new element at the end of a vector in place, from constructor arguments, like:
+            *  
+            *    E.emplace_back (700);
+            *    
+            *  Returns OK or one of the error flags in case of error:
+            *    - could not allocate enough memory for requested storage
+            */
+
+            template <class... Args>
+            signed char emplace_back (Args&&... args) {
                 // do we have to resize __elements__ first?
                 if (__size__ == __capacity__) {
-                    signed char e = __changeCapacity__ (__capacity__ + __increment__);
+                    signed char e = __changeCapacity__ (__grownCapacity__ ());
                     if (e) { // != OK
                         #ifdef __THROW_VECTOR_QUEUE_EXCEPTIONS__
                             throw e;
@@ -299,8 +316,8 @@
                     }
                 }          
         
-                // add the new element at the end = (__front__ + __size__) % __capacity__, at this point we can be sure that there is enough __capacity__ of __elements__
-                __elements__ [(__front__ + __size__) % __capacity__] = element;
+                // construct the new element at the end = (__front__ + __size__) % __capacity__, at this point we can be sure that there is enough __capacity__ of __elements__
+                __construct__ (&__elements__ [(__front__ + __size__) % __capacity__], (Args&&) args...);
                 __size__ ++;
                 return err_ok;
             }
@@ -310,10 +327,20 @@
             * push_front (unlike push_back) is not a STL C++ vector member function
             */
               
-            signed char push_front (vectorType element) {
+            signed char push_front (const vectorType& element) { 
+                if (__isElement__ (&element)) return __push_front__ (vectorType (element)); // element would get moved while changing capacity
+                return __push_front__ (element); 
+            }
+
+            signed char push_front (vectorType&& element) { return __push_front__ ((vectorType&&) element); }
+
+        private:
+
+            template <class T>
+            signed char __push_front__ (T&& element) {
                 // do we have to resize __elements__ first?
                 if (__size__ == __capacity__) {
-                    signed char e = __changeCapacity__ (__capacity__ + __increment__);
+                    signed char e = __changeCapacity__ (__grownCapacity__ ());
                     if (e) { // != OK
                         #ifdef __THROW_VECTOR_QUEUE_EXCEPTIONS__
                             throw e;
@@ -324,11 +351,13 @@
         
                 // add the new element at the beginning, at this point we can be sure that there is enough __capacity__ of __elements__
                 __front__ = (__front__ + __capacity__ - 1) % __capacity__; // __front__ - 1
-                __elements__ [__front__] = element;
+                __construct__ (&__elements__ [__front__], (T&&) element);
                 __size__ ++;
                 return err_ok;
             }
 
+        public:
+
 
            /*
             *  Deletes last element from the end of a vector, like:
@@ -350,10 +379,10 @@
                 
                 // remove last element
                 __size__ --;
+                __destroy__ (&__elements__ [(__front__ + __size__) % __capacity__]);
 
-                // do we have to free the space occupied by deleted element?
-                if (__capacity__ > __size__ + __increment__ - 1) 
-                    __changeCapacity__ (__size__); // doesn't matter if it does't succeed, the element is deleted anyway
+                // do we have to free the space occupied by deleted elements?
+                __shrinkIfMostlyEmpty__ (); // doesn't matter if it does't succeed, the element is deleted anyway
                 return err_ok;
             }
 
@@ -372,12 +401,12 @@
                 }
 
                 // remove first element
+                __destroy__ (&__elements__ [__front__]);
                 __front__ = (__front__ + 1) % __capacity__; // __front__ + 1
                 __size__ --;
         
-                // do we have to free the space occupied by deleted element?
-                if (__capacity__ > __size__ + __increment__ - 1) 
-                    __changeCapacity__ (__size__);  // doesn't matter if it does't succeed, the elekent is deleted anyway
+                // do we have to free the space occupied by deleted elements?
+                __shrinkIfMostlyEmpty__ ();  // doesn't matter if it does't succeed, the elekent is deleted anyway
                 return err_ok;
             }
 
@@ -470,7 +499,7 @@
 
 
            /*
-            *  Erases the element occupying the position from the vector
+            *  Erases the element occupying the position from the vector, the elements behind it (or in front of it, whichever are fewer) are shifted in place
             *  
             *  Returns OK or one of the error flags in case of error:
             *    - element does't exist
@@ -498,19 +527,13 @@
                 // calculate logical index of element to be deleted
                 int pos = position - begin ();
 
-                // do we have to free the space occupied by the element to be deleted? This is the slowest option
-                if (__capacity__ > __size__ - 1 + __increment__ - 1)  
-                    if (__changeCapacity__ (__size__ - 1, pos, - 1) == err_ok)
-                        return err_ok;
-                    // else (if failed to change capacity) proceeed
-
-                // we have to reposition the elements, weather from the __front__ or from the calculated back, whichever is faster
+                // reposition the elements in place, weather from the __front__ or from the calculated back, whichever is faster, pop_front or pop_back will free the space if needed
                 if (pos < __size__ - pos) {
                     // move all elements form position to 1
                     int e1 = (__front__ + pos) % __capacity__;
                     for (int i = pos; i > 0; i --) {
                         int e2 = (e1 + __capacity__ - 1) % __capacity__; // e1 - 1
-                        __elements__ [e1] = __elements__ [e2];
+                        __elements__ [e1] = (vectorType&&) __elements__ [e2];
                         e1 = e2;
                     }
                     // delete the first element now
@@ -520,7 +543,7 @@
                     int e1 = (__front__ + pos) % __capacity__; 
                     for (int i = pos; i < __size__ - 1; i ++) {
                         int e2 = (e1 + 1) % __capacity__; // e2 = e1 + 1
-                        __elements__ [e1] = __elements__ [e2];
+                        __elements__ [e1] = (vectorType&&) __elements__ [e2];
                         e1 = e2;
                     }
                     // delete the last element now
@@ -529,6 +552,31 @@
             }
 
 
+           /*
+            *  Erases the element occupying the position from the vector by moving the last element in its place, so nothing has to be shifted but the order
+            *  of the elements is not preserved (erase_unordered is not a STL C++ vector member function)
+            *  
+            *  Returns OK or one of the error flags in case of error:
+            *    - element does't exist
+            */
+
+            signed char erase_unordered (iterator position) {
+                // check if position is valid
+                int pos = position - begin ();
+                if (pos < 0 || pos >= __size__) {
+                    #ifdef __THROW_VECTOR_QUEUE_EXCEPTIONS__
+                        throw err_out_of_range;
+                    #endif                           
+                    __errorFlags__ |= err_out_of_range;                       
+                    return err_out_of_range;
+                }                 
+
+                if (pos < __size__ - 1)
+                    __elements__ [(__front__ + pos) % __capacity__] = (vectorType&&) __elements__ [(__front__ + __size__ - 1) % __capacity__];
+                return pop_back (); // tere is no reason why this wouldn't succeed now, so OK
+            }
+
+
            /*
             *  Inserts a new element at the position into the vector
             *  
@@ -536,23 +584,34 @@
             *    - could not allocate enough memory for requested storage
             */
 
-            signed char insert (iterator position, vectorType element) {
+            signed char insert (iterator position, const vectorType& element) { 
+                if (__isElement__ (&element)) return __insert__ (position, vectorType (element)); // element would get moved while changing capacity or repositioning
+                return __insert__ (position, element); 
+            }
+
+            signed char insert (iterator position, vectorType&& element) { return __insert__ (position, (vectorType&&) element); }
+
+
+      private:
+
+            template <class T>
+            signed char __insert__ (iterator position, T&& element) {
                 if (position == end ())
-                    return push_back (element);
+                    return push_back ((T&&) element);
 
                 if (!(position != begin ()))               
-                    return push_front (element); 
+                    return push_front ((T&&) element); 
                 
                 // calculate logical index of element to be deleted
                 int pos = position - begin ();
 
                 // do we have to resize the space occupied by existing the elements? This is the slowest option
                 if (__capacity__ < __size__ + 1) {
-                    signed char e = __changeCapacity__ (__size__ + __increment__, -1, pos);
+                    signed char e = __changeCapacity__ (__grownCapacity__ (), pos);
                     if (e)                              
                         return e;
                     // else
-                    __elements__ [pos] = element;  
+                    __construct__ (&__elements__ [pos], (T&&) element);  
                     return err_ok; 
                 }
       
@@ -560,59 +619,78 @@
                 if (pos < __size__ - pos) {
                     // move elements form 0 to position 1 position down
                     __front__ = (__front__ + __capacity__ - 1) % __capacity__; // __front__ - 1
+                    __construct__ (&__elements__ [__front__]); // free slots are not constructed
                     __size__ ++;
                     int e1 = __front__;
                     for (int i = 0; i < pos; i++) {
                         int e2 = (e1 + 1) % __capacity__; // e2 = e1 + 1
-                        __elements__ [e1] = __elements__ [e2];
+                        __elements__ [e1] = (vectorType&&) __elements__ [e2];
                         e1 = e2;
                     }
                     // insert the new element now
-                    __elements__ [e1] = element;
+                    __elements__ [e1] = (T&&) element;
                     return err_ok;
                 } else {
                     // move elements from __size__ - 1 to position 1 position up
                     int back = (__front__ + __size__) % __capacity__; // calculated back + 1
+                    __construct__ (&__elements__ [back]); // free slots are not constructed
                     __size__ ++;
                     int e1 = back;
                     for (int i = __size__ - 1; i > pos; i--) {
                         int e2 = (e1 + __capacity__ - 1) % __capacity__; // e2 = e1 - 1
-                        __elements__ [e1] = __elements__ [e2];
+                        __elements__ [e1] = (vectorType&&) __elements__ [e2];
                         e1 = e2;
                     }
                     // insert the new element now
-                    __elements__ [e1] = element;        
+                    __elements__ [e1] = (T&&) element;        
                     return err_ok;
                 }
             }
 
-
-      private:
-
             vectorType *__elements__ = NULL;  // initially the vector has no elements, __elements__ buffer is empty
             int __capacity__ = 0;             // initial number of elements (or not occupied slots) in __elements__
-            int __increment__ = 5;            // by default, increment elements buffer for 5 element when needed
+            int __increment__ = 5;            // by default, increment elements buffer for at least 5 element when needed
             int __reservation__ = 0;          // no memory reservatio by default
             int __size__ = 0;                 // initially there are not elements in __elements__
             int __front__ = 0;                // points to the first element in __elements__, which do not exist yet at instance creation time
 
     
            /*
-            *  Resizes __elements__ to new capacity with the option of deleting and adding an element meanwhile
+            *  __elements__ grow by half of their capacity (but at least by __increment__) so adding n elements takes O (n) time altogether.
+            *  They shrink only when they are less than a quarter full, so adding and removing elements doesn't resize them each time.
+            */
+
+            int __grownCapacity__ () { return __capacity__ + (__capacity__ / 2 > __increment__ ? __capacity__ / 2 : __increment__); }
+
+            bool __isMostlyEmpty__ (int size) { return size <= __capacity__ / 4 && __shrunkCapacity__ (size) < __capacity__; }
+
+            int __shrunkCapacity__ (int size) {
+                int newCapacity = size == 0 ? 0 : (2 * size > __increment__ ? 2 * size : __increment__);
+                return newCapacity < __reservation__ ? __reservation__ : newCapacity;
+            }
+
+            void __shrinkIfMostlyEmpty__ () {
+                if (__isMostlyEmpty__ (__size__))
+                    __changeCapacity__ (__shrunkCapacity__ (__size__));
+            }
+
+
+           /*
+            *  Resizes __elements__ to new capacity with the option of leaving a free slot for a new element meanwhile
+            *
+            *  Only the elements are constructed in __elements__ buffer, free slots are not. Trivially copyable elements are just copied to the new buffer,
+            *  the others are moved there.
             *  
             *  Returns OK or one of the error flags in case of error:
             *    - could not allocate enough memory for requested storage
             */
 
-            signed char __changeCapacity__ (int newCapacity, int deleteElementAtPosition = -1, int leaveFreeSlotAtPosition = -1) {
+            signed char __changeCapacity__ (int newCapacity, int leaveFreeSlotAtPosition = -1) {
                 if (newCapacity < __reservation__) newCapacity = __reservation__;
                 if (newCapacity == 0) {
                     // delete old buffer
                     if (__elements__ != NULL) {
-                        #ifndef ARDUINO_ARCH_AVR // Assuming Arduino Mega or Uno
-                            for (int i = 0; i < __capacity__; i++)
-                                __elements__ [i].~vectorType ();
-                        #endif
+                        __destroyElements__ ();
                         free (__elements__);
                     }
                     
@@ -639,46 +717,80 @@
                     return err_bad_alloc;
                 }
 
-                #ifndef ARDUINO_ARCH_AVR // Assuming Arduino Mega or Uno
-                    new (newElements) vectorType [newCapacity]; 
-                #else                 
+                #ifdef ARDUINO_ARCH_AVR // Assuming Arduino Mega or Uno
                     // we can skip this step but won't be able to use objects as vector elements then
                     memset (newElements, 0, sizeof (vectorType) * newCapacity);
                 #endif
 
                 // copy existing elements to the new buffer
-                if (deleteElementAtPosition >= 0) __size__ --;      // one element will be deleted
-                if (leaveFreeSlotAtPosition >= 0) __size__ ++;      // a slot for 1 element will be added
-                if (__size__ > newCapacity) __size__ = newCapacity; // shouldn't really happen
+                int newSize = __size__;
+                if (leaveFreeSlotAtPosition >= 0) newSize ++;       // a slot for 1 element will be added
+                if (newSize > newCapacity) newSize = newCapacity;   // shouldn't really happen
                 
-                int e = __front__;
-                for (int i = 0; i < __size__; i++) {
-                    // is i-th element supposed to be deleted? Don't copy it then ...
-                    if (i == deleteElementAtPosition) e = (e + 1) % __capacity__; // e ++
-                    
-                    // do we have to leave a free slot for a new element at i-th place? Continue with the next index ...
-                    if (i == leaveFreeSlotAtPosition) continue;
-                    
-                    newElements [i] = __elements__ [e];
-                    e = (e + 1) % __capacity__;
+                if (__isTriviallyCopyable__ && leaveFreeSlotAtPosition < 0) {
+                    // copy the elements with (at most) 2 memcpy calls, the circular queue may wrap around the end of the old buffer
+                    int firstPart = __capacity__ - __front__ < newSize ? __capacity__ - __front__ : newSize;
+                    if (firstPart > 0) memcpy ((void *) newElements, (void *) (__elements__ + __front__), sizeof (vectorType) * firstPart);
+                    if (newSize > firstPart) memcpy ((void *) (newElements + firstPart), (void *) __elements__, sizeof (vectorType) * (newSize - firstPart));
+                } else {
+                    int e = __front__;
+                    for (int i = 0; i < newSize; i++) {
+                        // do we have to leave a free slot for a new element at i-th place? Continue with the next index ...
+                        if (i == leaveFreeSlotAtPosition) continue;
+                        
+                        __construct__ (&newElements [i], (vectorType&&) __elements__ [e]);
+                        e = (e + 1) % __capacity__;
+                    }
                 }
 
                 // delete the old elements' buffer
                 if (__elements__ != NULL) {
-                    #ifndef ARDUINO_ARCH_AVR // Assuming Arduino Mega or Uno
-                        for (int i = 0; i < __capacity__; i++)
-                            __elements__ [i].~vectorType ();
-                    #endif
+                    __destroyElements__ (); // the moved elements
                     free (__elements__);
                 }
                 
                 // update internal variables
                 __capacity__ = newCapacity;
                 __elements__ = newElements;
+                __size__ = newSize;
                 __front__ = 0;  // the first element is now aligned with 0
                 return err_ok;
             }
 
+
+           /*
+            *  Checks if the address points inside of __elements__ buffer
+            */
+
+            bool __isElement__ (const vectorType *p) { return __elements__ != NULL && p >= __elements__ && p < __elements__ + __capacity__; }
+
+
+           /*
+            *  Constructs an element in a free (not constructed) slot, in place, from constructor arguments and destroys it when the slot gets free again
+            */
+
+            template <class... Args>
+            void __construct__ (vectorType *slot, Args&&... args) {
+                #ifndef ARDUINO_ARCH_AVR // Assuming Arduino Mega or Uno
+                    new (slot) vectorType ((Args&&) args...);
+                #else
+                    *slot = vectorType ((Args&&) args...);
+                #endif
+            }
+
+            void __destroy__ (vectorType *slot) {
+                #ifndef ARDUINO_ARCH_AVR // Assuming Arduino Mega or Uno
+                    slot->~vectorType ();
+                #endif
+            }
+
+            void __destroyElements__ () {
+                for (int i = 0, e = __front__; i < __size__; i++, e = (e + 1) % __capacity__)
+                    __destroy__ (&__elements__ [e]);
+            }
+
+            enum { __isTriviallyCopyable__ = __is_trivially_copyable (vectorType) }; // compiler built-in, <type_traits> is not available on all boards
+
     };
     
 
@@ -766,10 +878,7 @@
             
             ~vector () {
                 if (__elements__ != NULL) {
-                    #ifndef ARDUINO_ARCH_AVR // Assuming Arduino Mega or Uno
-                        for (int i = 0; i < __capacity__; i++)
-                            __elements__ [i].~String ();
-                    #endif
+                    __destroyElements__ ();
                     free (__elements__);
                 }
             }
@@ -966,9 +1075,40 @@
             *    
             *  Returns OK or one of the error flags in case of error:
             *    - could not allocate enough memory for requested storage
+            *
+            *  The element is passed by reference so it only gets copied once - into the vector. A temporary (rvalue) element gets moved instead.
             */
     
-            signed char push_back (String element) {
+            signed char push_back (const String& element) { String e (element); return __push_back__ (e); }
+
+            signed char push_back (String&& element) { return __push_back__ (element); }
+
+
+           /*
+            *  Constructs a new element at the end of a vector from String constructor arguments, like:
+            *  
+            *    E.emplace_back (700);
+            *    
+            *  Returns OK or one of the error flags in case of error:
+            *    - could not allocate enough memory for requested storage
+            */
+
+            template <class... Args>
+            signed char emplace_back (Args&&... args) { String e ((Args&&) args...); return __push_back__ (e); }
+
+
+           /*
+            * push_front (unlike push_back) is not a STL C++ vector member function
+            */
+              
+            signed char push_front (const String& element) { String e (element); return __push_front__ (e); }
+
+            signed char push_front (String&& element) { return __push_front__ (element); }
+
+        private:
+
+            // takes over the content of element, element is left empty
+            signed char __push_back__ (String& element) {
                 if (!element) {                             // ... check if parameter construction is valid
                     #ifdef __THROW_VECTOR_QUEUE_EXCEPTIONS__
                         throw err_bad_alloc;
@@ -979,7 +1119,7 @@
 
                 // do we have to resize __elements__ first?
                 if (__size__ == __capacity__) {
-                    signed char e = __changeCapacity__ (__capacity__ + __increment__);
+                    signed char e = __changeCapacity__ (__grownCapacity__ ());
                     if (e) { // != OK
                         #ifdef __THROW_VECTOR_QUEUE_EXCEPTIONS__
                             throw e;
@@ -989,16 +1129,14 @@
                 }          
         
                 // add the new element at the end = (__front__ + __size__) % __capacity__, at this point we can be sure that there is enough __capacity__ of __elements__
+                __constructEmptyString__ (&__elements__ [(__front__ + __size__) % __capacity__]); // free slots are not constructed
                 __swapStrings__ (&__elements__ [(__front__ + __size__) % __capacity__], &element);
                 __size__ ++;
                 return err_ok;
             }
 
-           /*
-            * push_front (unlike push_back) is not a STL C++ vector member function
-            */
-              
-            signed char push_front (String element) {
+            // takes over the content of element, element is left empty
+            signed char __push_front__ (String& element) {
                 if (!element) {                             // ... check if parameter construction is valid
                     #ifdef __THROW_VECTOR_QUEUE_EXCEPTIONS__
                         throw err_bad_alloc;
@@ -1009,7 +1147,7 @@
 
                 // do we have to resize __elements__ first?
                 if (__size__ == __capacity__) {
-                    signed char e = __changeCapacity__ (__capacity__ + __increment__);
+                    signed char e = __changeCapacity__ (__grownCapacity__ ());
                     if (e) { // != OK
                         #ifdef __THROW_VECTOR_QUEUE_EXCEPTIONS__
                             throw e;
@@ -1020,11 +1158,14 @@
         
                 // add the new element at the beginning, at this point we can be sure that there is enough __capacity__ of __elements__
                 __front__ = (__front__ + __capacity__ - 1) % __capacity__; // __front__ - 1
+                __constructEmptyString__ (&__elements__ [__front__]); // free slots are not constructed
                 __swapStrings__ (&__elements__ [__front__], &element);
                 __size__ ++;
                 return err_ok;
             }
 
+        public:
+
 
            /*
             *  Deletes last element from the end of a vector, like:
@@ -1046,10 +1187,10 @@
                 
                 // remove last element
                 __size__ --;
+                __destroyString__ (&__elements__ [(__front__ + __size__) % __capacity__]);
 
-                // do we have to free the space occupied by deleted element?
-                if (__capacity__ > __size__ + __increment__ - 1) 
-                    __changeCapacity__ (__size__); // doesn't matter if it does't succeed, the element is deleted anyway
+                // do we have to free the space occupied by deleted elements?
+                __shrinkIfMostlyEmpty__ (); // doesn't matter if it does't succeed, the element is deleted anyway
                 return err_ok;
             }
 
@@ -1068,12 +1209,12 @@
                 }
 
                 // remove first element
+                __destroyString__ (&__elements__ [__front__]);
                 __front__ = (__front__ + 1) % __capacity__; // __front__ + 1
                 __size__ --;
         
-                // do we have to free the space occupied by deleted element?
-                if (__capacity__ > __size__ + __increment__ - 1) 
-                    __changeCapacity__ (__size__);  // doesn't matter if it does't succeed, the elekent is deleted anyway
+                // do we have to free the space occupied by deleted elements?
+                __shrinkIfMostlyEmpty__ ();  // doesn't matter if it does't succeed, the elekent is deleted anyway
                 return err_ok;
             }
 
@@ -1166,7 +1307,7 @@
 
 
            /*
-            *  Erases the element occupying the position from the vector
+            *  Erases the element occupying the position from the vector, the elements behind it (or in front of it, whichever are fewer) are shifted in place
             *  
             *  Returns OK or one of the error flags in case of error:
             *    - element does't exist
@@ -1194,19 +1335,13 @@
                 // calculate logical index of element to be deleted
                 int pos = position - begin ();
 
-                // do we have to free the space occupied by the element to be deleted? This is the slowest option
-                if (__capacity__ > __size__ - 1 + __increment__ - 1)  
-                    if (__changeCapacity__ (__size__ - 1, pos, - 1) == err_ok)
-                        return err_ok;
-                    // else (if failed to change capacity) proceeed
-
-                // we have to reposition the elements, weather from the __front__ or from the calculated back, whichever is faster
-                if (position < __size__ - pos) {
+                // reposition the elements in place, weather from the __front__ or from the calculated back, whichever is faster, pop_front or pop_back will free the space if needed
+                if (pos < __size__ - pos) {
                     // move all elements form position to 1
                     int e1 = (__front__ + pos) % __capacity__;
                     for (int i = pos; i > 0; i --) {
                         int e2 = (e1 + __capacity__ - 1) % __capacity__; // e1 - 1
-                        __elements__ [e1] = __elements__ [e2];
+                        __swapStrings__ (&__elements__ [e1], &__elements__ [e2]);
                         e1 = e2;
                     }
                     // delete the first element now
@@ -1216,7 +1351,7 @@
                     int e1 = (__front__ + pos) % __capacity__; 
                     for (int i = pos; i < __size__ - 1; i ++) {
                         int e2 = (e1 + 1) % __capacity__; // e2 = e1 + 1
-                        __elements__ [e1] = __elements__ [e2];
+                        __swapStrings__ (&__elements__ [e1], &__elements__ [e2]);
                         e1 = e2;
                     }
                     // delete the last element now
@@ -1225,6 +1360,31 @@
             }
 
 
+           /*
+            *  Erases the element occupying the position from the vector by moving the last element in its place, so nothing has to be shifted but the order
+            *  of the elements is not preserved (erase_unordered is not a STL C++ vector member function)
+            *  
+            *  Returns OK or one of the error flags in case of error:
+            *    - element does't exist
+            */
+
+            signed char erase_unordered (iterator position) {
+                // check if position is valid
+                int pos = position - begin ();
+                if (pos < 0 || pos >= __size__) {
+                    #ifdef __THROW_VECTOR_QUEUE_EXCEPTIONS__
+                        throw err_out_of_range;
+                    #endif                           
+                    __errorFlags__ |= err_out_of_range;                       
+                    return err_out_of_range;
+                }                 
+
+                if (pos < __size__ - 1)
+                    __swapStrings__ (&__elements__ [(__front__ + pos) % __capacity__], &__elements__ [(__front__ + __size__ - 1) % __capacity__]);
+                return pop_back (); // tere is no reason why this wouldn't succeed now, so OK
+            }
+
+
            /*
             *  Inserts a new element at the position into the vector
             *  
@@ -1232,7 +1392,15 @@
             *    - could not allocate enough memory for requested storage
             */
 
-            signed char insert (iterator position, String element) {
+            signed char insert (iterator position, const String& element) { String e (element); return __insert__ (position, e); }
+
+            signed char insert (iterator position, String&& element) { return __insert__ (position, element); }
+
+
+      private:
+
+            // takes over the content of element
+            signed char __insert__ (iterator position, String& element) {
                 if (!element) { // String constuctor failed
                     #ifdef __THROW_VECTOR_QUEUE_EXCEPTIONS__
                         throw err_bad_alloc;
@@ -1242,21 +1410,22 @@
                 }
 
                 if (position == end ())
-                    return push_back (element);
+                    return __push_back__ (element);
 
                 if (!(position != begin ()))               
-                    return push_front (element); 
+                    return __push_front__ (element); 
                 
                 // calculate logical index of element to be deleted
                 int pos = position - begin ();
 
                 // do we have to resize the space occupied by existing the elements? This is the slowest option
                 if (__capacity__ < __size__ + 1) {
-                    signed char e = __changeCapacity__ (__size__ + __increment__, -1, pos);
+                    signed char e = __changeCapacity__ (__grownCapacity__ (), pos);
                     if (e)                              
                         return e;
                     // else
-                    __elements__ [pos] = element;  
+                    __constructEmptyString__ (&__elements__ [pos]); // free slots are not constructed
+                    __swapStrings__ (&__elements__ [pos], &element);  
                     return err_ok; 
                 }
       
@@ -1264,59 +1433,78 @@
                 if (pos < __size__ - pos) {
                     // move elements form 0 to position 1 position down
                     __front__ = (__front__ + __capacity__ - 1) % __capacity__; // __front__ - 1
+                    __constructEmptyString__ (&__elements__ [__front__]); // free slots are not constructed
                     __size__ ++;
                     int e1 = __front__;
                     for (int i = 0; i < pos; i++) {
                         int e2 = (e1 + 1) % __capacity__; // e2 = e1 + 1
-                        __elements__ [e1] = __elements__ [e2];
+                        __swapStrings__ (&__elements__ [e1], &__elements__ [e2]);
                         e1 = e2;
                     }
                     // insert the new element now
-                    __elements__ [e1] = element;
+                    __swapStrings__ (&__elements__ [e1], &element);
                     return err_ok;
                 } else {
                     // move elements from __size__ - 1 to position 1 position up
                     int back = (__front__ + __size__) % __capacity__; // calculated back + 1
+                    __constructEmptyString__ (&__elements__ [back]); // free slots are not constructed
                     __size__ ++;
                     int e1 = back;
                     for (int i = __size__ - 1; i > pos; i--) {
                         int e2 = (e1 + __capacity__ - 1) % __capacity__; // e2 = e1 - 1
-                        __elements__ [e1] = __elements__ [e2];
+                        __swapStrings__ (&__elements__ [e1], &__elements__ [e2]);
                         e1 = e2;
                     }
                     // insert the new element now
-                    __elements__ [e1] = element;        
+                    __swapStrings__ (&__elements__ [e1], &element);        
                     return err_ok;
                 }
             }
 
-
-      private:
-
             String *__elements__ = NULL;      // initially the vector has no elements, __elements__ buffer is empty
             int __capacity__ = 0;             // initial number of elements (or not occupied slots) in __elements__
-            int __increment__ = 5;            // by default, increment elements buffer for 5 element when needed
+            int __increment__ = 5;            // by default, increment elements buffer for at least 5 element when needed
             int __reservation__ = 0;          // no memory reservatio by default
             int __size__ = 0;                 // initially there are not elements in __elements__
             int __front__ = 0;                // points to the first element in __elements__, which do not exist yet at instance creation time
 
     
            /*
-            *  Resizes __elements__ to new capacity with the option of deleting and adding an element meanwhile
+            *  __elements__ grow by half of their capacity (but at least by __increment__) so adding n elements takes O (n) time altogether.
+            *  They shrink only when they are less than a quarter full, so adding and removing elements doesn't resize them each time.
+            */
+
+            int __grownCapacity__ () { return __capacity__ + (__capacity__ / 2 > __increment__ ? __capacity__ / 2 : __increment__); }
+
+            bool __isMostlyEmpty__ (int size) { return size <= __capacity__ / 4 && __shrunkCapacity__ (size) < __capacity__; }
+
+            int __shrunkCapacity__ (int size) {
+                int newCapacity = size == 0 ? 0 : (2 * size > __increment__ ? 2 * size : __increment__);
+                return newCapacity < __reservation__ ? __reservation__ : newCapacity;
+            }
+
+            void __shrinkIfMostlyEmpty__ () {
+                if (__isMostlyEmpty__ (__size__))
+                    __changeCapacity__ (__shrunkCapacity__ (__size__));
+            }
+
+
+           /*
+            *  Resizes __elements__ to new capacity with the option of leaving a free slot for a new element meanwhile
+            *
+            *  Only the elements are constructed in __elements__ buffer, free slots are not. The Strings are moved to the new buffer by copying their
+            *  stack memory, like __swapStrings__ does, so neither constructors nor destructors get called.
             *  
             *  Returns true if succeeds and false in case of error:
             *    - could not allocate enough memory for requested storage
             */
 
-            signed char __changeCapacity__ (int newCapacity, int deleteElementAtPosition = -1, int leaveFreeSlotAtPosition = -1) {
+            signed char __changeCapacity__ (int newCapacity, int leaveFreeSlotAtPosition = -1) {
                 if (newCapacity < __reservation__) newCapacity = __reservation__;
                 if (newCapacity == 0) {
                     // delete old buffer
                     if (__elements__ != NULL) {
-                        #ifndef ARDUINO_ARCH_AVR // Assuming Arduino Mega or Uno
-                            for (int i = 0; i < __capacity__; i++)
-                                __elements__ [i].~String ();
-                        #endif
+                        __destroyElements__ ();
                         free (__elements__);
                     }
 
@@ -1342,50 +1530,66 @@
                     return err_bad_alloc;
                 }
 
-                #ifndef ARDUINO_ARCH_AVR // Assuming Arduino Mega or Uno
-                    new (newElements) String [newCapacity];
-                #else
-                    // if this is not supported by older boards, we can use the following instead:
-                    memset (newElements, 0, sizeof (String) * newCapacity); // prevent caling String destructors at the following assignments
-                    for (int i = 0; i < newCapacity; i++) newElements [i] = String (); // assign empty String
-                #endif
-
                 // copy existing elements to the new buffer
-                if (deleteElementAtPosition >= 0) __size__ --;      // one element will be deleted
-                if (leaveFreeSlotAtPosition >= 0) __size__ ++;      // a slot for 1 element will be added
-                if (__size__ > newCapacity) __size__ = newCapacity; // shouldn't really happen
-                
-                int e = __front__;
-                for (int i = 0; i < __size__; i++) {
-                    // is i-th element supposed to be deleted? Don't copy it then ...
-                    if (i == deleteElementAtPosition) e = (e + 1) % __capacity__; // e ++
-                    
-                    // do we have to leave a free slot for a new element at i-th place? Continue with the next index ...
-                    if (i == leaveFreeSlotAtPosition) continue;
-                    
-                    // we don't need to care of an error occured while creating a newElement String, we'll replace it with a valid __elements__ string anyway
-                    __swapStrings__ (&newElements [i], &__elements__ [e]);
-
-                    e = (e + 1) % __capacity__;
+                int newSize = __size__;
+                if (leaveFreeSlotAtPosition >= 0) newSize ++;       // a slot for 1 element will be added
+                if (newSize > newCapacity) newSize = newCapacity;   // shouldn't really happen
+
+                if (leaveFreeSlotAtPosition < 0) {
+                    // copy the elements with (at most) 2 memcpy calls, the circular queue may wrap around the end of the old buffer
+                    int firstPart = __capacity__ - __front__ < newSize ? __capacity__ - __front__ : newSize;
+                    if (firstPart > 0) memcpy ((void *) newElements, (void *) (__elements__ + __front__), sizeof (String) * firstPart);
+                    if (newSize > firstPart) memcpy ((void *) (newElements + firstPart), (void *) __elements__, sizeof (String) * (newSize - firstPart));
+                } else {
+                    int e = __front__;
+                    for (int i = 0; i < newSize; i++) {
+                        // do we have to leave a free slot for a new element at i-th place? Continue with the next index ...
+                        if (i == leaveFreeSlotAtPosition) continue;
+                        
+                        memcpy ((void *) &newElements [i], (void *) &__elements__ [e], sizeof (String));
+                        e = (e + 1) % __capacity__;
+                    }
                 }
                 
-                // delete the old elements' buffer   
-                if (__elements__ != NULL) {
-                    #ifndef ARDUINO_ARCH_AVR // Assuming Arduino Mega or Uno
-                        for (int i = 0; i < __capacity__; i++)
-                            __elements__ [i].~String ();
-                    #endif
+                // delete the old elements' buffer, the elements have already been moved
+                if (__elements__ != NULL)
                     free (__elements__);
-                }
 
                 // update internal variables
                 __capacity__ = newCapacity;
                 __elements__ = newElements;
+                __size__ = newSize;
                 __front__ = 0;  // the first element is now aligned with 0
                 return err_ok;
             }
 
 
+           /*
+            *  Constructs an empty String in a free (not constructed) slot and destroys the String when the slot gets free again
+            */
+
+            void __constructEmptyString__ (String *slot) {
+                #ifndef ARDUINO_ARCH_AVR // Assuming Arduino Mega or Uno
+                    new (slot) String ();
+                #else
+                    // if this is not supported by older boards, we can use the following instead:
+                    memset ((void *) slot, 0, sizeof (String)); // prevent caling String destructor at the following assignment
+                    *slot = String (); // assign empty String
+                #endif
+            }
+
+            void __destroyString__ (String *slot) {
+                #ifndef ARDUINO_ARCH_AVR // Assuming Arduino Mega or Uno
+                    slot->~String ();
+                #endif
+            }
+
+            void __destroyElements__ () {
+                for (int i = 0, e = __front__; i < __size__; i++, e = (e + 1) % __capacity__)
+                    __destroyString__ (&__elements__ [e]);
+            }
+
+
             // swap strings by swapping their stack memory so constructors doesn't get called and nothing can go wrong like running out of memory meanwhile 
             void __swapStrings__ (String *a, String *b) {
                 char tmp [sizeof (String)];